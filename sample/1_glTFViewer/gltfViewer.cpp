@@ -5,10 +5,14 @@
 #include "buffer.hpp"
 #include "texture_system.hpp"
 #include "mesh_system.hpp"
+#include "job_system.hpp"
+#include "descriptor_writer.hpp"
+#include "uniform_ring.hpp"
 
 #include <string>
 #include <fstream>
 #include <streambuf>
+#include <algorithm>
 
 #include <imgui.h>
 
@@ -62,11 +66,17 @@ int main(int, char**)
 
   Pipeline::InitBackend();
 
+  // Materials index the texture system's bindless table
+  if (!r.getTextureSystem().HasBindlessTable())
+  {
+    spdlog::error("The glTF viewer needs bindless textures, which this device does not support");
+    return 1;
+  }
+
   std::unique_ptr<Pipeline> pipeline;
 
   // Our GPU buffers holding the vertices and the indices
   std::shared_ptr<Buffer> vertexBuffer, indexBuffer;
-  Buffer* uniformBuffer;
 
   BG::VertexBufferBinding vertexBinding;
 
@@ -163,6 +173,10 @@ int main(int, char**)
       // Add shaders
       pipeline->AddFragmentShaders(fragmentShader);
       pipeline->AddVertexShaders(vertexShader);
+      // The textures come from the texture system's bindless set, bound as set 1
+      pipeline->SetDescriptorSetLayout(1, r.getTextureSystem().GetBindlessLayout());
+      // The constants live in the renderer's uniform ring, bound with a dynamic offset
+      pipeline->SetDynamicUniform(0);
       // Set the viewport
       pipeline->SetViewport(float(r.getWidth()), float(r.getHeight()));
       // Add an attachment for the pipeline to render to
@@ -187,43 +201,41 @@ int main(int, char**)
       projMtx = glm::perspective(glm::radians(45.0f), float(width) / float(height), 0.01f, 1000.0f);
       projMtx[1][1] *= -1.0;
 
-      // Map & upload the constants
-      uniformBuffer = r.getMemoryAllocator().AllocTransient(sizeof(ShaderUniform) * r.getSwapchainImageViews().size(), vk::BufferUsageFlagBits::eUniformBuffer);
-      ShaderUniform* uniformBufferGPU = uniformBuffer->Map<ShaderUniform>();
-      uniformBufferGPU->viewProjMtx = projMtx * viewMtx;
-      uniformBuffer->UnMap();
+      // Write the constants into this frame's part of the uniform ring
+      auto uniforms = r.getUniformRing().Push(ShaderUniform{ projMtx * viewMtx });
 
-      // Allocate descriptor sets & bind uniforms
-      auto descSet = pipeline->AllocDescSet(ctx.descPool, r.getTextureSystem().GetNumImageViews() + 1);
-      pipeline->BindGraphicsUniformBuffer(*pipeline, descSet, *uniformBuffer, 0, sizeof(ShaderUniform), 0);
-
-      for (int i = 0; i < r.getTextureSystem().GetNumImageViews(); i++)
-      {
-        pipeline->BindGraphicsImageView(*pipeline, descSet, r.getTextureSystem().GetImageView({ i }), vk::ImageLayout::eShaderReadOnlyOptimal, r.getTextureSystem().GetSampler(), 15, i);
-      }
+      // The descriptor set only references the ring buffer, so it is written once and reused across frames.
+      // Where the constants are in it goes in as a dynamic offset when binding
+      DescriptorWriter writer(r.getDevice());
+      writer.WriteBuffer(0, *uniforms.buffer, 0, sizeof(ShaderUniform), vk::DescriptorType::eUniformBufferDynamic);
+      auto descSet = pipeline->AllocDescSetCached(ctx.descAllocator, writer.GetKey(), [&](vk::DescriptorSet set) { writer.Flush(set); });
+      std::vector<uint32_t> dynamicOffsets = { uniforms.offset };
 
       // Begin & resets the command buffer
       ctx.cmdBuffer.Begin();
-      // Use the RenderPass from the pipeline we built
+      // Flatten the node hierarchy so the draws can be split between worker threads
+      std::vector<std::pair<DrawCmd, glm::mat4>> draws;
+      rootNode->ForEach(globalTransform, [&](const MeshSystem::Node& n, glm::mat4 transform) {
+        if (n.HasMesh()) draws.push_back({ drawObjects[&n], transform });
+        });
+      // Use the RenderPass from the pipeline we built, each task records a chunk of the draws into its own secondary command buffer
       std::vector<vk::ImageView> renderTarget{ ctx.imageView, ctx.depthImageView };
-      ctx.cmdBuffer.WithRenderPass(*pipeline, renderTarget, glm::uvec2(width, height), [&](){
-        // Bind the pipeline to use
-        ctx.cmdBuffer.BindPipeline(*pipeline);
-        // Bind the vertex buffer
-        ctx.cmdBuffer.BindVertexBuffer(vertexBinding, *vertexBuffer, 0);
+      int numTasks = std::max(1, std::min(int(draws.size()), r.getJobSystem().GetNumWorkers()));
+      ctx.RecordParallel(*pipeline, renderTarget, glm::uvec2(width, height), numTasks, [&](CommandBuffer& cmdBuffer, int task) {
+        // The pipeline is already bound, bind the vertex buffer
+        cmdBuffer.BindVertexBuffer(vertexBinding, *vertexBuffer, 0);
         // Bind the index buffer
-        ctx.cmdBuffer.BindIndexBuffer(*indexBuffer, 0);
+        cmdBuffer.BindIndexBuffer(*indexBuffer, 0);
         // Bind the descriptor sets (uniform buffer, texture, etc.)
-        ctx.cmdBuffer.BindGraphicsDescSets(*pipeline, descSet);
-        // Draw objects
-        rootNode->ForEach(globalTransform, [&](const MeshSystem::Node& n, glm::mat4 transform) {
-          if (n.HasMesh())
-          {
-            auto& drawCmd = drawObjects[&n];
-            ctx.cmdBuffer.PushConstants(*pipeline, vk::ShaderStageFlagBits::eVertex, 0, transform);
-            ctx.cmdBuffer.DrawIndexed(drawCmd.indexCount, drawCmd.firstIndex, drawCmd.vertexOffset);
-          }
-          });
+        cmdBuffer.BindGraphicsDescSets(*pipeline, descSet, 0, dynamicOffsets);
+        cmdBuffer.BindGraphicsDescSets(*pipeline, r.getTextureSystem().GetBindlessSet(), 1);
+        // Draw this task's share of the objects
+        for (size_t i = task; i < draws.size(); i += numTasks)
+        {
+          auto& drawCmd = draws[i].first;
+          cmdBuffer.PushConstants(*pipeline, vk::ShaderStageFlagBits::eVertex, 0, draws[i].second);
+          cmdBuffer.DrawIndexed(drawCmd.indexCount, drawCmd.firstIndex, drawCmd.vertexOffset);
+        }
         });
       // End the recording of command buffer
       ctx.cmdBuffer.End();
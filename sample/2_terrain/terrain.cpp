@@ -4,6 +4,8 @@
 #include "command_buffer.hpp"
 #include "buffer.hpp"
 #include "texture_system.hpp"
+#include "descriptor_writer.hpp"
+#include "uniform_ring.hpp"
 
 #include <string>
 #include <fstream>
@@ -94,7 +96,6 @@ int main(int, char**)
 
   // Our GPU buffers holding the vertices and the indices
   std::unique_ptr<Buffer> vertexBuffer, indexBuffer;
-  Buffer* uniformBuffer;
 
   BG::VertexBufferBinding vertexBinding;
 
@@ -130,9 +131,6 @@ int main(int, char**)
       std::copy(indicies.begin(), indicies.end(), indexBufferGPU);
       indexBuffer->UnMap();
 
-      // Allocate a constants buffer
-      //uniformBuffer = r.getMemoryAllocator().AllocCPU2GPU(sizeof(ShaderUniform) * r.getSwapchainImageViews().size(), vk::BufferUsageFlagBits::eUniformBuffer);
-
       // Create a empty pipline
       pipeline = r.CreatePipeline();
       // Add a vertex binding
@@ -147,6 +145,8 @@ int main(int, char**)
       // Add an attachment for the pipeline to render to
       pipeline->AddAttachment(r.getSwapChainFormat(), vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR);
       pipeline->AddDepthAttachment();
+      // Per-draw bindings are pushed straight into the command buffer when the device supports it
+      pipeline->UsePushDescriptors();
       // Build the pipeline
       pipeline->BuildPipeline();
     },
@@ -159,16 +159,21 @@ int main(int, char**)
       glm::mat4 projMtx = glm::perspective(glm::radians(45.0f), float(width) / float(height), 0.1f, 256.0f);
       projMtx[1][1] *= -1.0;
 
-      // Map & upload the constants
-      uniformBuffer = r.getMemoryAllocator().AllocTransient(sizeof(ShaderUniform), vk::BufferUsageFlagBits::eUniformBuffer);
-      ShaderUniform* uniformBufferGPU = uniformBuffer->Map<ShaderUniform>();
-      uniformBufferGPU->viewProjMtx = projMtx * viewMtx;
-      uniformBuffer->UnMap();
+      // Write the constants into this frame's part of the uniform ring
+      auto uniforms = r.getUniformRing().Push(ShaderUniform{ projMtx * viewMtx });
+
+      // Collect the bindings (uniform buffer, texture)
+      DescriptorWriter writer(r.getDevice());
+      writer.WriteBuffer(0, *uniforms.buffer, uniforms.offset, sizeof(ShaderUniform));
+      writer.WriteImage(1, r.getTextureSystem().GetImageView({ 0 }), vk::ImageLayout::eShaderReadOnlyOptimal, r.getTextureSystem().GetSampler());
 
-      // Allocate descriptor sets & bind uniforms
-      auto descSet = pipeline->AllocDescSet(ctx.descPool);
-      pipeline->BindGraphicsUniformBuffer(*pipeline, descSet, *uniformBuffer, 0, sizeof(ShaderUniform), 0);
-      pipeline->BindGraphicsImageView(*pipeline, descSet, r.getTextureSystem().GetImageView({ 0 }), vk::ImageLayout::eShaderReadOnlyOptimal, r.getTextureSystem().GetSampler(), 1);
+      // Without push descriptors, allocate a descriptor set & write it
+      vk::DescriptorSet descSet;
+      if (!pipeline->IsPushDescriptor())
+      {
+        descSet = pipeline->AllocDescSet(ctx.descAllocator);
+        writer.Flush(descSet);
+      }
 
       // Begin & resets the command buffer
       ctx.cmdBuffer.Begin();
@@ -181,8 +186,11 @@ int main(int, char**)
         ctx.cmdBuffer.BindVertexBuffer(vertexBinding, *vertexBuffer, 0);
         // Bind the index buffer
         ctx.cmdBuffer.BindIndexBuffer(*indexBuffer, 0);
-        // Bind the descriptor sets (uniform buffer, texture, etc.)
-        ctx.cmdBuffer.BindGraphicsDescSets(*pipeline, descSet);
+        // Push or bind the descriptors (uniform buffer, texture, etc.)
+        if (pipeline->IsPushDescriptor())
+          ctx.cmdBuffer.PushDescriptors(*pipeline, writer);
+        else
+          ctx.cmdBuffer.BindGraphicsDescSets(*pipeline, descSet);
         // Draw terrain
         ctx.cmdBuffer.PushConstants(*pipeline, vk::ShaderStageFlagBits::eVertex, 0, terrainTransform);
         ctx.cmdBuffer.DrawIndexed(uint32_t(indicies.size()), 0, 0);
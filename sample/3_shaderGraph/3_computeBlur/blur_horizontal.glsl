@@ -0,0 +1,44 @@
+#version 450
+
+// Horizontal half of a separable box blur. Each workgroup loads its part of the row,
+// plus MAX_RADIUS texels on both sides, into shared memory once.
+
+#define GROUP_SIZE 64
+#define MAX_RADIUS 16
+
+layout(local_size_x = GROUP_SIZE, local_size_y = 1) in;
+
+layout(binding = 0) uniform sampler2D output0;
+layout(binding = 1, rgba8) uniform writeonly image2D blurX;
+
+layout(push_constant) uniform Parameters {
+  float radius;
+};
+
+shared vec4 row[GROUP_SIZE + 2 * MAX_RADIUS];
+
+void main()
+{
+  ivec2 size = textureSize(output0, 0);
+  ivec2 px = ivec2(gl_GlobalInvocationID.xy);
+  int first = int(gl_WorkGroupID.x) * GROUP_SIZE - MAX_RADIUS;
+
+  for (int i = int(gl_LocalInvocationID.x); i < GROUP_SIZE + 2 * MAX_RADIUS; i += GROUP_SIZE)
+  {
+    row[i] = texelFetch(output0, ivec2(clamp(first + i, 0, size.x - 1), min(px.y, size.y - 1)), 0);
+  }
+
+  barrier();
+
+  if (px.x >= size.x || px.y >= size.y) return;
+
+  int r = clamp(int(radius), 0, MAX_RADIUS);
+
+  vec4 sum = vec4(0.0);
+  for (int i = -r; i <= r; i++)
+  {
+    sum += row[int(gl_LocalInvocationID.x) + MAX_RADIUS + i];
+  }
+
+  imageStore(blurX, px, sum / float(2 * r + 1));
+}
@@ -0,0 +1,43 @@
+#version 450
+
+// Vertical half of the separable box blur, same as blur_horizontal.glsl along columns
+
+#define GROUP_SIZE 64
+#define MAX_RADIUS 16
+
+layout(local_size_x = 1, local_size_y = GROUP_SIZE) in;
+
+layout(binding = 0) uniform sampler2D blurX;
+layout(binding = 1, rgba8) uniform writeonly image2D blurY;
+
+layout(push_constant) uniform Parameters {
+  float radius;
+};
+
+shared vec4 column[GROUP_SIZE + 2 * MAX_RADIUS];
+
+void main()
+{
+  ivec2 size = textureSize(blurX, 0);
+  ivec2 px = ivec2(gl_GlobalInvocationID.xy);
+  int first = int(gl_WorkGroupID.y) * GROUP_SIZE - MAX_RADIUS;
+
+  for (int i = int(gl_LocalInvocationID.y); i < GROUP_SIZE + 2 * MAX_RADIUS; i += GROUP_SIZE)
+  {
+    column[i] = texelFetch(blurX, ivec2(min(px.x, size.x - 1), clamp(first + i, 0, size.y - 1)), 0);
+  }
+
+  barrier();
+
+  if (px.x >= size.x || px.y >= size.y) return;
+
+  int r = clamp(int(radius), 0, MAX_RADIUS);
+
+  vec4 sum = vec4(0.0);
+  for (int i = -r; i <= r; i++)
+  {
+    sum += column[int(gl_LocalInvocationID.y) + MAX_RADIUS + i];
+  }
+
+  imageStore(blurY, px, sum / float(2 * r + 1));
+}
@@ -0,0 +1,21 @@
+#version 450
+
+layout(location = 0) out vec4 outColor;
+
+layout(location = 0) in vec2 UV;
+
+layout(binding = 7) uniform sampler2D output0;
+layout(binding = 8) uniform sampler2D blurY;
+
+layout(push_constant) uniform Parameters {
+  float gamma;
+  vec3 colorFilter;
+};
+
+void main()
+{
+  vec3 cells = texelFetch(output0, ivec2(gl_FragCoord.st), 0).rgb;
+  vec3 glow = texelFetch(blurY, ivec2(gl_FragCoord.st), 0).rgb;
+
+  outColor = vec4(pow(cells * 0.5 + glow * 2.0, vec3(1.0 / gamma)) * colorFilter, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 450
+
+// One step of the bloom pyramid: the target is half the size of the source,
+// four bilinear taps between the source texels average a 4x4 footprint.
+
+layout(location = 0) out vec4 outColor;
+
+layout(location = 0) in vec2 UV;
+
+layout(binding = 1) uniform sampler2D source;
+
+void main()
+{
+  vec2 texel = 1.0 / vec2(textureSize(source, 0));
+
+  vec4 color = texture(source, UV + texel * vec2(-1.0, -1.0))
+             + texture(source, UV + texel * vec2( 1.0, -1.0))
+             + texture(source, UV + texel * vec2(-1.0,  1.0))
+             + texture(source, UV + texel * vec2( 1.0,  1.0));
+
+  outColor = color * 0.25;
+}
@@ -0,0 +1,29 @@
+#version 450
+
+layout(location = 0) out vec4 outColor;
+
+layout(location = 0) in vec2 UV;
+
+layout(binding = 1) uniform sampler2D output0;
+// Mips of the half resolution bloom pyramid, bound one by one
+layout(binding = 2) uniform sampler2D bloom0;
+layout(binding = 3) uniform sampler2D bloom1;
+layout(binding = 4) uniform sampler2D bloom2;
+layout(binding = 5) uniform sampler2D bloom3;
+
+layout(push_constant) uniform Parameters {
+  float intensity;
+  vec3 colorFilter;
+};
+
+void main()
+{
+  vec3 cells = texelFetch(output0, ivec2(gl_FragCoord.st), 0).rgb;
+
+  vec3 glow = texture(bloom0, UV).rgb * 0.4
+            + texture(bloom1, UV).rgb * 0.3
+            + texture(bloom2, UV).rgb * 0.2
+            + texture(bloom3, UV).rgb * 0.1;
+
+  outColor = vec4(cells * 0.5 + glow * intensity * colorFilter, 1.0);
+}
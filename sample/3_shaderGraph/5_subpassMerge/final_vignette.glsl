@@ -0,0 +1,22 @@
+#version 450
+
+layout(location = 0) out vec4 outColor;
+
+layout(location = 0) in vec2 UV;
+
+// Third subpass, the tonemapped image never leaves tile memory
+layout(input_attachment_index = 0, binding = 7) uniform subpassInput toned;
+
+layout(push_constant) uniform Parameters {
+  float strength;
+};
+
+void main()
+{
+  vec3 color = subpassLoad(toned).rgb;
+
+  vec2 centered = UV * 2.0 - 1.0;
+  float falloff = clamp(1.0 - dot(centered, centered) * strength, 0.0, 1.0);
+
+  outColor = vec4(color * falloff, 1.0);
+}
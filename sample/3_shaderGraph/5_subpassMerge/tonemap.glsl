@@ -0,0 +1,20 @@
+#version 450
+
+layout(location = 0) out vec4 outColor;
+
+layout(location = 0) in vec2 UV;
+
+// Read at the same pixel, so this stage runs as a second subpass after the game of life
+layout(input_attachment_index = 0, binding = 7) uniform subpassInput output0;
+
+layout(push_constant) uniform Parameters {
+  float gamma;
+  vec3 colorFilter;
+};
+
+void main()
+{
+  vec3 lastStageColor = subpassLoad(output0).rgb;
+
+  outColor = vec4(pow(lastStageColor, vec3(1.0 / gamma)) * colorFilter, 1.0);
+}
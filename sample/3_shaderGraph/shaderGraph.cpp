@@ -22,7 +22,7 @@
 using namespace BG;
 
 // Main function
-int main(int, char**)
+int main(int argc, char** argv)
 {
   spdlog::set_level(spdlog::level::debug);
 
@@ -33,7 +33,13 @@ int main(int, char**)
 
   std::shared_ptr<ShaderGraph::Graph> graph;
 
+  // The first argument is a graph json, or the name of a sample graph such as 3_computeBlur
   std::string graphFile = SRC_DIR"/sample/3_shaderGraph/1_gameOfLife/graph.json";
+  if (argc > 1)
+  {
+    graphFile = argv[1];
+    if (!std::filesystem::exists(graphFile)) graphFile = SRC_DIR"/sample/3_shaderGraph/" + graphFile + "/graph.json";
+  }
 
   bool reload = false;
 
@@ -70,6 +76,20 @@ int main(int, char**)
         reload = false;
       }
 
+      // Stage pipelines build in the background, a failed build shows up here
+      if (graph)
+      {
+        try
+        {
+          graph->IsReady();
+        }
+        catch (const std::runtime_error& error)
+        {
+          graph = nullptr;
+          spdlog::error("Shader load failed {}", error.what());
+        }
+      }
+
       ctx.cmdBuffer.Begin();
       if (graph)
         graph->Render(r, ctx);
@@ -14,12 +14,28 @@ namespace BG
 {
   class Buffer;
   class CommandBuffer;
+  class DescriptorAllocator;
+  class DescriptorTemplateData;
+  class DescriptorWriter;
+  class FramebufferCache;
+  class FrameTelemetry;
+  class GpuProfiler;
   class Image;
+  class JobSystem;
   class MemoryAllocator;
+  class ParallelRecorder;
   class Pipeline;
+  class PipelineCache;
+  struct PipelineObjects;
+  class PipelineStateCache;
   class Renderer;
+  class ShaderCache;
+  struct ShaderReflection;
   class TextureSystem;
+  class Timeline;
   class Tracker;
+  class UniformRing;
+  class UploadEngine;
   class BBox;
 
   namespace MeshSystem
@@ -4,6 +4,7 @@
 #include "vk_mem_alloc.h"
 
 BG::MemoryAllocator::MemoryAllocator(vk::PhysicalDevice pDevice, vk::Device device, vk::Instance instance, uint32_t maxFramesInFlight)
+  : m_device(device)
 {
   VmaAllocatorCreateInfo allocatorInfo = {};
   allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_0;
@@ -13,8 +14,6 @@ BG::MemoryAllocator::MemoryAllocator(vk::PhysicalDevice pDevice, vk::Device devi
 
   vmaCreateAllocator(&allocatorInfo, &allocator);
 
-  m_buffers.resize(maxFramesInFlight);
-
   VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
   bufferInfo.size = 0x100;
   bufferInfo.usage = VkBufferUsageFlags(vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferSrc);
@@ -37,18 +36,27 @@ BG::MemoryAllocator::MemoryAllocator(vk::PhysicalDevice pDevice, vk::Device devi
 
 BG::MemoryAllocator::~MemoryAllocator()
 {
-  for (auto& list : m_buffers)
-  {
-    list.clear();
-  }
+  m_currentBuffers.clear();
+  m_submittedBuffers.clear();
   vmaDestroyPool(allocator, transientPool);
   vmaDestroyAllocator(allocator);
 }
 
-void BG::MemoryAllocator::NewFrame()
+void BG::MemoryAllocator::NewFrame(uint64_t completedValue)
 {
-  m_currentFrame = (m_currentFrame + 1) % m_buffers.size();
-  m_buffers[m_currentFrame].clear();
+  // Frames complete in order, so the linear pool is freed from its oldest allocations
+  while (!m_submittedBuffers.empty() && m_submittedBuffers.front().first <= completedValue)
+  {
+    m_submittedBuffers.pop_front();
+  }
+}
+
+void BG::MemoryAllocator::EndFrame(uint64_t submitValue)
+{
+  if (m_currentBuffers.empty()) return;
+
+  m_submittedBuffers.emplace_back(submitValue, std::move(m_currentBuffers));
+  m_currentBuffers.clear();
 }
 
 std::unique_ptr<BG::Buffer> BG::MemoryAllocator::Alloc(size_t size, vk::BufferUsageFlags usage, VmaMemoryUsage memoryUsage)
@@ -77,6 +85,17 @@ BG::Buffer::~Buffer()
   vmaDestroyBuffer(allocator, buffer, allocation);
 }
 
+bool BG::Buffer::IsCoherent()
+{
+  VmaAllocationInfo info;
+  vmaGetAllocationInfo(allocator, allocation, &info);
+
+  VkMemoryPropertyFlags flags;
+  vmaGetMemoryTypeProperties(allocator, info.memoryType, &flags);
+
+  return (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
 std::unique_ptr<BG::Image> BG::MemoryAllocator::AllocImage2D(glm::uvec2 extent, int mipLevels, vk::Format format, vk::ImageUsageFlags usage, vk::ImageLayout layout, VmaMemoryUsage memoryUsage)
 {
   vk::ImageCreateInfo imageInfo;
@@ -123,11 +142,64 @@ BG::Buffer* BG::MemoryAllocator::AllocTransient(size_t size, vk::BufferUsageFlag
 
   Buffer* retVal = ptr.get();
 
-  m_buffers[m_currentFrame].push_back(std::move(ptr));
+  m_currentBuffers.push_back(std::move(ptr));
 
   return retVal;
 }
 
+std::unique_ptr<BG::Image> BG::MemoryAllocator::CreateUnboundImage2D(glm::uvec2 extent, int mipLevels, vk::Format format, vk::ImageUsageFlags usage)
+{
+  vk::ImageCreateInfo imageInfo;
+  imageInfo.extent.width = extent.x;
+  imageInfo.extent.height = extent.y;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = mipLevels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.imageType = vk::ImageType::e2D;
+  imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+  imageInfo.tiling = vk::ImageTiling::eOptimal;
+  imageInfo.usage = usage;
+  imageInfo.sharingMode = vk::SharingMode::eExclusive;
+  imageInfo.samples = vk::SampleCountFlagBits::e1;
+
+  vk::Image image = m_device.createImage(imageInfo);
+
+  return std::make_unique<BG::Image>(allocator, image, VK_NULL_HANDLE);
+}
+
+vk::MemoryRequirements BG::MemoryAllocator::GetMemoryRequirements(const Image& image)
+{
+  return m_device.getImageMemoryRequirements(image.image);
+}
+
+VmaAllocation BG::MemoryAllocator::AllocMemory(const vk::MemoryRequirements& requirements, VmaMemoryUsage memoryUsage)
+{
+  VkMemoryRequirements _requirements = requirements;
+
+  VmaAllocationCreateInfo allocInfo = {};
+  allocInfo.usage = memoryUsage;
+
+  VmaAllocation allocation;
+  if (vmaAllocateMemory(allocator, &_requirements, &allocInfo, &allocation, nullptr) != VK_SUCCESS)
+  {
+    spdlog::error("Failed to allocate {} bytes of image memory", requirements.size);
+    throw std::runtime_error("Image memory allocation failed");
+  }
+
+  return allocation;
+}
+
+void BG::MemoryAllocator::BindImageMemory(Image& image, VmaAllocation memory)
+{
+  vmaBindImageMemory(allocator, memory, image.image);
+}
+
+void BG::MemoryAllocator::FreeMemory(VmaAllocation memory)
+{
+  vmaFreeMemory(allocator, memory);
+}
+
 BG::Image::Image(VmaAllocator& allocator, vk::Image image)
   : allocator(allocator), image(image)
 {
@@ -5,6 +5,8 @@
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan.hpp>
 
+#include <deque>
+
 namespace BG
 {
 
@@ -12,10 +14,11 @@ namespace BG
   {
   private:
     VmaAllocator allocator;
+    vk::Device m_device;
 
-    uint32_t m_currentFrame;
-
-    std::vector<std::vector<std::unique_ptr<Buffer>>> m_buffers;
+    // Transient buffers of the current frame, and of submitted frames tagged with their graphics timeline value
+    std::vector<std::unique_ptr<Buffer>> m_currentBuffers;
+    std::deque<std::pair<uint64_t, std::vector<std::unique_ptr<Buffer>>>> m_submittedBuffers;
 
     VmaPool transientPool;
 
@@ -24,7 +27,9 @@ namespace BG
     MemoryAllocator(vk::PhysicalDevice pDevice, vk::Device device, vk::Instance instance, uint32_t maxFramesInFlight);
     ~MemoryAllocator();
 
-    void NewFrame();
+    // Frees transient buffers of frames whose timeline value has completed
+    void NewFrame(uint64_t completedValue);
+    void EndFrame(uint64_t submitValue);
 
     // Static allocation
     std::unique_ptr<Buffer> Alloc(size_t size, vk::BufferUsageFlags usage, VmaMemoryUsage memoryUsage);
@@ -37,6 +42,14 @@ namespace BG
       vk::ImageLayout layout = vk::ImageLayout::eUndefined, VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY);
 
     Buffer* AllocTransient(size_t size, vk::BufferUsageFlags usage, VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+    // Aliasing: create images without memory, allocate memory covering all of their requirements
+    // and bind them to it. The images only destroy themselves, free the memory after the last one
+    std::unique_ptr<Image> CreateUnboundImage2D(glm::uvec2 extent, int mipLevels, vk::Format format, vk::ImageUsageFlags usage);
+    vk::MemoryRequirements GetMemoryRequirements(const Image& image);
+    VmaAllocation AllocMemory(const vk::MemoryRequirements& requirements, VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_GPU_ONLY);
+    void BindImageMemory(Image& image, VmaAllocation memory);
+    void FreeMemory(VmaAllocation memory);
   };
 
   class Buffer
@@ -53,6 +66,10 @@ namespace BG
 
     template <class T> T* Map() { void* pData; vmaMapMemory(allocator, allocation, &pData); return (T*)(pData); }
     inline void UnMap() { vmaUnmapMemory(allocator, allocation); };
+
+    // CPU writes to memory that is not HOST_COHERENT must be flushed before the GPU reads them
+    bool IsCoherent();
+    inline void Flush(size_t offset = 0, size_t size = VK_WHOLE_SIZE) { vmaFlushAllocation(allocator, allocation, offset, size); }
   };
 
   class Image
@@ -67,7 +84,7 @@ namespace BG
 
   public:
     vk::Image image;
-    VmaAllocation allocation;
+    VmaAllocation allocation = VK_NULL_HANDLE; // VK_NULL_HANDLE when bound to memory owned elsewhere
 
     Image(VmaAllocator& allocator, vk::Image image);
     Image(VmaAllocator& allocator, vk::Image image, VmaAllocation allocation, bool color = true, bool depth = false);
@@ -2,25 +2,115 @@
 #include "buffer.hpp"
 #include "pipelines.hpp"
 #include "lifetime_tracker.hpp"
+#include "gpu_profiler.hpp"
+#include "descriptor_writer.hpp"
+#include "framebuffer_cache.hpp"
 
 void BG::CommandBuffer::Begin()
 {
   m_buf.begin(vk::CommandBufferBeginInfo{ {}, nullptr });
+
+  if (m_profiler) m_profiler->BeginFrame(m_buf);
 }
 
 void BG::CommandBuffer::End()
 {
+  if (m_profiler) m_profiler->EndFrame(m_buf);
+
   m_buf.end();
 }
 
-void BG::CommandBuffer::BeginRenderPass(Pipeline& p, vk::Framebuffer& frameBuffer, glm::uvec2 extent, glm::vec4 clearColor, glm::ivec2 offset)
+void BG::CommandBuffer::BeginRenderPass(Pipeline& p, vk::Framebuffer& frameBuffer, glm::uvec2 extent, glm::vec4 clearColor, glm::ivec2 offset, vk::SubpassContents contents)
+{
+  p.BindRenderPass(m_buf, frameBuffer, extent, clearColor, offset, contents);
+}
+
+void BG::CommandBuffer::BeginRenderPass(vk::RenderPass renderPass, vk::Framebuffer frameBuffer, glm::uvec2 extent, const std::vector<vk::ClearValue>& clearValues, glm::ivec2 offset)
 {
-  p.BindRenderPass(m_buf, frameBuffer, extent, clearColor, offset);
+  vk::RenderPassBeginInfo renderPassInfo;
+  renderPassInfo.renderPass = renderPass;
+  renderPassInfo.framebuffer = frameBuffer;
+  renderPassInfo.renderArea.offset = vk::Offset2D{ offset.x, offset.y };
+  renderPassInfo.renderArea.extent = vk::Extent2D{ extent.x, extent.y };
+  renderPassInfo.setClearValues(clearValues);
+
+  m_buf.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+}
+
+void BG::CommandBuffer::NextSubpass()
+{
+  m_buf.nextSubpass(vk::SubpassContents::eInline);
+}
+
+void BG::CommandBuffer::BeginRendering(
+  const std::vector<vk::ImageView>& colorViews, vk::ImageView depthView, glm::uvec2 extent,
+  const std::vector<vk::AttachmentLoadOp>& loadOps, glm::vec4 clearColor, glm::ivec2 offset, vk::RenderingFlagsKHR flags)
+{
+  if (!m_dispatcher)
+  {
+    spdlog::error("Dynamic rendering needs a command buffer created with the renderer's dispatcher");
+    throw std::runtime_error("Command buffer has no dispatcher");
+  }
+
+  auto loadOp = [&](size_t i) { return i < loadOps.size() ? loadOps[i] : vk::AttachmentLoadOp::eClear; };
+
+  std::vector<vk::RenderingAttachmentInfoKHR> colorAttachments;
+
+  for (size_t i = 0; i < colorViews.size(); i++)
+  {
+    vk::RenderingAttachmentInfoKHR attachment;
+    attachment.imageView = colorViews[i];
+    attachment.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    attachment.loadOp = loadOp(i);
+    attachment.storeOp = vk::AttachmentStoreOp::eStore;
+    attachment.clearValue.color = std::array<float, 4>{ clearColor.r, clearColor.g, clearColor.b, clearColor.a };
+
+    colorAttachments.push_back(attachment);
+  }
+
+  vk::RenderingAttachmentInfoKHR depthAttachment;
+  depthAttachment.imageView = depthView;
+  depthAttachment.imageLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  depthAttachment.loadOp = loadOp(colorViews.size());
+  depthAttachment.storeOp = vk::AttachmentStoreOp::eStore;
+  depthAttachment.clearValue.depthStencil.depth = 1.0f;
+
+  vk::RenderingInfoKHR renderingInfo;
+  renderingInfo.flags = flags;
+  renderingInfo.renderArea.offset = vk::Offset2D{ offset.x, offset.y };
+  renderingInfo.renderArea.extent = vk::Extent2D{ extent.x, extent.y };
+  renderingInfo.layerCount = 1;
+  renderingInfo.setColorAttachments(colorAttachments);
+  if (depthView) renderingInfo.pDepthAttachment = &depthAttachment;
+
+  m_buf.beginRenderingKHR(renderingInfo, *m_dispatcher);
+}
+
+void BG::CommandBuffer::BeginRendering(Pipeline& p, const std::vector<vk::ImageView>& renderTargets, glm::uvec2 extent, glm::vec4 clearColor, glm::ivec2 offset, vk::RenderingFlagsKHR flags)
+{
+  std::vector<vk::ImageView> colorViews = renderTargets;
+  vk::ImageView depthView;
+
+  if (p.HasDepthAttachment() && !colorViews.empty())
+  {
+    depthView = colorViews.back();
+    colorViews.pop_back();
+  }
+
+  BeginRendering(colorViews, depthView, extent, p.GetLoadOps(), clearColor, offset, flags);
+
+  // Secondary command buffers bind the pipeline themselves
+  if (!(flags & vk::RenderingFlagBitsKHR::eContentsSecondaryCommandBuffers)) BindPipeline(p);
+}
+
+void BG::CommandBuffer::EndRendering()
+{
+  m_buf.endRenderingKHR(*m_dispatcher);
 }
 
 void BG::CommandBuffer::BindPipeline(Pipeline& p)
 {
-  m_buf.bindPipeline(vk::PipelineBindPoint::eGraphics, p.GetPipeline());
+  m_buf.bindPipeline(p.GetBindPoint(), p.GetPipeline());
 }
 
 void BG::CommandBuffer::EndRenderPass()
@@ -55,9 +145,112 @@ void BG::CommandBuffer::PushConstants(Pipeline& p, vk::ShaderStageFlagBits stage
   m_buf.pushConstants(p.GetLayout(), stage, offset, size, data);
 }
 
-void BG::CommandBuffer::BindGraphicsDescSets(Pipeline& p, vk::DescriptorSet descSet, int set)
+void BG::CommandBuffer::BindGraphicsDescSets(Pipeline& p, vk::DescriptorSet descSet, int set, const std::vector<uint32_t>& dynamicOffsets)
+{
+  m_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, p.GetLayout(), set, descSet, dynamicOffsets);
+}
+
+void BG::CommandBuffer::BindComputeDescSets(Pipeline& p, vk::DescriptorSet descSet, int set, const std::vector<uint32_t>& dynamicOffsets)
+{
+  m_buf.bindDescriptorSets(vk::PipelineBindPoint::eCompute, p.GetLayout(), set, descSet, dynamicOffsets);
+}
+
+void BG::CommandBuffer::PushUniformBuffer(Pipeline& p, int binding, const BG::Buffer& buffer, uint64_t offset, uint64_t range)
+{
+  vk::DescriptorBufferInfo bufferInfo{ buffer.buffer, offset, range };
+
+  vk::WriteDescriptorSet descSetWrite;
+  descSetWrite.dstBinding = binding;
+  descSetWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
+  descSetWrite.descriptorCount = 1;
+  descSetWrite.pBufferInfo = &bufferInfo;
+
+  p.PushDescriptorSet(m_buf, { descSetWrite });
+}
+
+void BG::CommandBuffer::PushImageView(Pipeline& p, int binding, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler)
+{
+  vk::DescriptorImageInfo imageInfo{ sampler, view, layout };
+
+  vk::WriteDescriptorSet descSetWrite;
+  descSetWrite.dstBinding = binding;
+  descSetWrite.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  descSetWrite.descriptorCount = 1;
+  descSetWrite.pImageInfo = &imageInfo;
+
+  p.PushDescriptorSet(m_buf, { descSetWrite });
+}
+
+void BG::CommandBuffer::PushDescriptors(Pipeline& p, DescriptorWriter& writer)
+{
+  p.PushDescriptorSet(m_buf, writer.GetWrites());
+}
+
+void BG::CommandBuffer::PushDescriptors(Pipeline& p, DescriptorTemplateData& data)
+{
+  p.PushDescriptorSetWithTemplate(m_buf, data.GetData());
+}
+
+void BG::CommandBuffer::SetViewport(glm::uvec2 extent, glm::ivec2 offset)
+{
+  vk::Viewport viewport(float(offset.x), float(offset.y), float(extent.x), float(extent.y), 0.0f, 1.0f);
+  vk::Rect2D scissor(vk::Offset2D(offset.x, offset.y), vk::Extent2D(extent.x, extent.y));
+
+  m_buf.setViewport(0, viewport);
+  m_buf.setScissor(0, scissor);
+}
+
+void BG::CommandBuffer::Dispatch(uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ)
+{
+  m_buf.dispatch(groupCountX, groupCountY, groupCountZ);
+}
+
+void BG::CommandBuffer::DispatchInvocations(Pipeline& p, glm::uvec3 invocations)
 {
-  m_buf.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, p.GetLayout(), set, 1, &descSet, 0, nullptr);
+  glm::uvec3 groupSize = p.GetWorkgroupSize();
+  glm::uvec3 groups = (invocations + groupSize - glm::uvec3(1)) / groupSize;
+
+  m_buf.dispatch(groups.x, groups.y, groups.z);
+}
+
+void BG::CommandBuffer::GlobalBarrier(vk::PipelineStageFlags fromStage, vk::PipelineStageFlags toStage, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess)
+{
+  vk::MemoryBarrier barrier;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+
+  m_buf.pipelineBarrier(fromStage, toStage, vk::DependencyFlags(0), 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void BG::CommandBuffer::BufferBarrier(const BG::Buffer& buffer, vk::PipelineStageFlags fromStage, vk::PipelineStageFlags toStage, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess, uint32_t srcQueueFamily, uint32_t dstQueueFamily)
+{
+  vk::BufferMemoryBarrier barrier;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = srcQueueFamily;
+  barrier.dstQueueFamilyIndex = dstQueueFamily;
+  barrier.buffer = buffer.buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+
+  m_buf.pipelineBarrier(fromStage, toStage, vk::DependencyFlags(0), 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void BG::CommandBuffer::BeginScope(const std::string& name)
+{
+  if (m_profiler) m_profiler->BeginScope(m_buf, name);
+}
+
+void BG::CommandBuffer::EndScope()
+{
+  if (m_profiler) m_profiler->EndScope(m_buf);
+}
+
+void BG::CommandBuffer::WithScope(const std::string& name, std::function<void()> func)
+{
+  BeginScope(name);
+  func();
+  EndScope();
 }
 
 vk::AccessFlags getAccessFlags(vk::ImageLayout layout, bool read)
@@ -134,6 +327,35 @@ void BG::CommandBuffer::ImageTransition(vk::Image image, vk::PipelineStageFlags
   m_buf.pipelineBarrier(fromStage, toStage, vk::DependencyFlags(0), 0, nullptr, 0, nullptr, 1, &barrierToTransfer);
 }
 
+vk::Framebuffer BG::CommandBuffer::CreateTransientFramebuffer(Pipeline& p, std::vector<vk::ImageView> renderTargets, glm::uvec2 extent)
+{
+  vk::FramebufferCreateInfo framebufferInfo;
+  framebufferInfo.setRenderPass(p.GetRenderPass());
+  framebufferInfo.setAttachments(renderTargets);
+  framebufferInfo.setWidth(extent.x);
+  framebufferInfo.setHeight(extent.y);
+  framebufferInfo.setLayers(1);
+
+  auto fb = m_device.createFramebufferUnique(framebufferInfo);
+  vk::Framebuffer handle = fb.get();
+
+  m_tracker.DisposeFramebuffer(std::move(fb));
+
+  return handle;
+}
+
+vk::Framebuffer BG::CommandBuffer::GetFramebuffer(Pipeline& p, const std::vector<vk::ImageView>& renderTargets, glm::uvec2 extent)
+{
+  if (m_framebufferCache) return m_framebufferCache->Get(p.GetRenderPass(), renderTargets, extent);
+
+  return CreateTransientFramebuffer(p, renderTargets, extent);
+}
+
+void BG::CommandBuffer::ExecuteCommands(const std::vector<vk::CommandBuffer>& buffers)
+{
+  if (!buffers.empty()) m_buf.executeCommands(buffers);
+}
+
 void BG::CommandBuffer::WithRenderPass(Pipeline& p, vk::Framebuffer& frameBuffer, glm::uvec2 extent, glm::vec4 clearColor, glm::ivec2 offset, std::function<void()> func)
 {
   this->BeginRenderPass(p, frameBuffer, extent, clearColor, offset);
@@ -148,18 +370,17 @@ void BG::CommandBuffer::WithRenderPass(Pipeline& p, vk::Framebuffer& frameBuffer
 
 void BG::CommandBuffer::WithRenderPass(Pipeline& p, std::vector<vk::ImageView> renderTargets, glm::uvec2 extent, glm::vec4 clearColor, glm::ivec2 offset, std::function<void()> func)
 {
-  vk::FramebufferCreateInfo framebufferInfo;
-  framebufferInfo.setRenderPass(p.GetRenderPass());
-  framebufferInfo.setAttachments(renderTargets);
-  framebufferInfo.setWidth(extent.x);
-  framebufferInfo.setHeight(extent.y);
-  framebufferInfo.setLayers(1);
-
-  auto fb = m_device.createFramebufferUnique(framebufferInfo);
+  if (p.IsDynamicRendering())
+  {
+    BeginRendering(p, renderTargets, extent, clearColor, offset);
+    func();
+    EndRendering();
+    return;
+  }
 
-  WithRenderPass(p, fb.get(), extent, glm::vec4(0.0), glm::ivec2(0), func);
+  vk::Framebuffer fb = GetFramebuffer(p, renderTargets, extent);
 
-  m_tracker.DisposeFramebuffer(std::move(fb));
+  WithRenderPass(p, fb, extent, glm::vec4(0.0), glm::ivec2(0), func);
 }
 
 void BG::CommandBuffer::WithRenderPass(Pipeline& p, std::vector<vk::ImageView> renderTargets, glm::uvec2 extent, std::function<void()> func)
@@ -167,7 +388,9 @@ void BG::CommandBuffer::WithRenderPass(Pipeline& p, std::vector<vk::ImageView> r
   WithRenderPass(p, renderTargets, extent, glm::vec4(0.0), glm::ivec2(0), func);
 }
 
-BG::CommandBuffer::CommandBuffer(vk::Device device, vk::CommandBuffer buf, BG::Tracker& tracker)
-  : m_device(device), m_buf(buf), m_tracker(tracker)
+BG::CommandBuffer::CommandBuffer(
+  vk::Device device, vk::CommandBuffer buf, BG::Tracker& tracker,
+  BG::GpuProfiler* profiler, BG::FramebufferCache* framebufferCache, const vk::DispatchLoaderDynamic* dispatcher)
+  : m_device(device), m_buf(buf), m_tracker(tracker), m_profiler(profiler), m_framebufferCache(framebufferCache), m_dispatcher(dispatcher)
 {
 }
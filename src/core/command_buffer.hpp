@@ -13,6 +13,9 @@ namespace BG
     vk::CommandBuffer m_buf;
     vk::Device m_device;
     Tracker& m_tracker;
+    GpuProfiler* m_profiler;
+    FramebufferCache* m_framebufferCache;
+    const vk::DispatchLoaderDynamic* m_dispatcher;
 
   public:
     void Begin();
@@ -23,9 +26,39 @@ namespace BG
       vk::Framebuffer& frameBuffer,
       glm::uvec2 extent,
       glm::vec4 clearColor = glm::vec4(1.0),
+      glm::ivec2 offset = glm::ivec2(0),
+      vk::SubpassContents contents = vk::SubpassContents::eInline);
+    // For render passes no pipeline owns (see Pipeline::SetRenderPass), one clear value per attachment
+    void BeginRenderPass(
+      vk::RenderPass renderPass,
+      vk::Framebuffer frameBuffer,
+      glm::uvec2 extent,
+      const std::vector<vk::ClearValue>& clearValues,
       glm::ivec2 offset = glm::ivec2(0));
+    void NextSubpass();
     void BindPipeline(Pipeline& p);
     void EndRenderPass();
+
+    // Dynamic rendering: no render pass or framebuffer, every pipeline built with UseDynamicRendering() and
+    // matching formats can draw until EndRendering. Attachments must be in eColorAttachmentOptimal / eDepthStencilAttachmentOptimal.
+    // loadOps: one per color view then depth, all eClear if empty
+    void BeginRendering(
+      const std::vector<vk::ImageView>& colorViews,
+      vk::ImageView depthView,
+      glm::uvec2 extent,
+      const std::vector<vk::AttachmentLoadOp>& loadOps = {},
+      glm::vec4 clearColor = glm::vec4(0.0),
+      glm::ivec2 offset = glm::ivec2(0),
+      vk::RenderingFlagsKHR flags = {});
+    // renderTargets as for WithRenderPass (depth last), load ops from p's attachments
+    void BeginRendering(
+      Pipeline& p,
+      const std::vector<vk::ImageView>& renderTargets,
+      glm::uvec2 extent,
+      glm::vec4 clearColor = glm::vec4(0.0),
+      glm::ivec2 offset = glm::ivec2(0),
+      vk::RenderingFlagsKHR flags = {});
+    void EndRendering();
     void Draw(uint32_t vertexCount, uint32_t firstVertex = 0, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
     void DrawIndexed(uint32_t indexCount, uint32_t firstIndex = 0, uint32_t vertexOffset = 0, uint32_t instanceCount = 1, uint32_t firstInstance = 0);
     void BindVertexBuffer(VertexBufferBinding binding, const BG::Buffer& buffer, size_t offset);
@@ -36,7 +69,37 @@ namespace BG
       PushConstants(p, stage, offset, sizeof(data), &data);
     }
 
-    void BindGraphicsDescSets(Pipeline& p, vk::DescriptorSet descSet, int set = 0);
+    // dynamicOffsets: one per dynamic buffer in the set, in binding order
+    void BindGraphicsDescSets(Pipeline& p, vk::DescriptorSet descSet, int set = 0, const std::vector<uint32_t>& dynamicOffsets = {});
+    void BindComputeDescSets(Pipeline& p, vk::DescriptorSet descSet, int set = 0, const std::vector<uint32_t>& dynamicOffsets = {});
+
+    // Set 0 of a pipeline built with UsePushDescriptors(), written straight into the command buffer
+    void PushUniformBuffer(Pipeline& p, int binding, const BG::Buffer& buffer, uint64_t offset, uint64_t range);
+    void PushImageView(Pipeline& p, int binding, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler);
+    void PushDescriptors(Pipeline& p, DescriptorWriter& writer);
+    void PushDescriptors(Pipeline& p, DescriptorTemplateData& data);
+
+    // For pipelines built with UseDynamicViewport, sets the scissor to the same rectangle
+    void SetViewport(glm::uvec2 extent, glm::ivec2 offset = glm::ivec2(0));
+
+    void Dispatch(uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1);
+    // Enough workgroups of the bound compute pipeline to cover the given number of invocations
+    void DispatchInvocations(Pipeline& p, glm::uvec3 invocations);
+
+    void GlobalBarrier(vk::PipelineStageFlags fromStage, vk::PipelineStageFlags toStage, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess);
+
+    // Pass different queue families to release / acquire ownership between queues,
+    // the same barrier has to be recorded on both the releasing and the acquiring queue
+    void BufferBarrier(
+      const BG::Buffer& buffer,
+      vk::PipelineStageFlags fromStage, vk::PipelineStageFlags toStage,
+      vk::AccessFlags srcAccess, vk::AccessFlags dstAccess,
+      uint32_t srcQueueFamily = VK_QUEUE_FAMILY_IGNORED, uint32_t dstQueueFamily = VK_QUEUE_FAMILY_IGNORED);
+
+    // GPU timing scopes, only recorded when the command buffer has a profiler attached
+    void BeginScope(const std::string& name);
+    void EndScope();
+    void WithScope(const std::string& name, std::function<void()> func);
 
     void ImageTransition(
       const BG::Image& image,
@@ -51,6 +114,13 @@ namespace BG
       vk::ImageAspectFlags aspect,
       int baseMip = 0, int levels = 1, int baseLayer = 0, int layers = 1);
 
+    // Framebuffer that lives until this frame slot comes around again
+    vk::Framebuffer CreateTransientFramebuffer(Pipeline& p, std::vector<vk::ImageView> renderTargets, glm::uvec2 extent);
+    // From the framebuffer cache when the command buffer has one, transient otherwise
+    vk::Framebuffer GetFramebuffer(Pipeline& p, const std::vector<vk::ImageView>& renderTargets, glm::uvec2 extent);
+
+    void ExecuteCommands(const std::vector<vk::CommandBuffer>& buffers);
+
     void WithRenderPass(
       Pipeline& p,
       vk::Framebuffer& frameBuffer,
@@ -79,7 +149,9 @@ namespace BG
       glm::uvec2 extent,
       std::function<void()> func);
 
-    CommandBuffer(vk::Device device, vk::CommandBuffer buf, BG::Tracker& tracker);
+    CommandBuffer(
+      vk::Device device, vk::CommandBuffer buf, BG::Tracker& tracker,
+      BG::GpuProfiler* profiler = nullptr, BG::FramebufferCache* framebufferCache = nullptr, const vk::DispatchLoaderDynamic* dispatcher = nullptr);
 
     inline vk::CommandBuffer GetVkCmdBuf() { return m_buf; }
   };
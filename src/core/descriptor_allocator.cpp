@@ -0,0 +1,200 @@
+#include "descriptor_allocator.hpp"
+
+static const uint32_t SETS_PER_POOL = 256;
+
+BG::DescriptorAllocator::DescriptorAllocator(vk::Device device, uint32_t numFrames)
+  : m_device(device), m_evictAfterFrames(numFrames + 1)
+{
+  m_frames.resize(numFrames);
+}
+
+vk::UniqueDescriptorPool BG::DescriptorAllocator::CreatePool(bool freeable)
+{
+  std::vector<vk::DescriptorPoolSize> poolSizes = {
+      { vk::DescriptorType::eSampler, 1000 },
+      { vk::DescriptorType::eCombinedImageSampler, 1000 },
+      { vk::DescriptorType::eSampledImage, 1000 },
+      { vk::DescriptorType::eStorageImage, 1000 },
+      { vk::DescriptorType::eUniformTexelBuffer, 1000 },
+      { vk::DescriptorType::eStorageTexelBuffer, 1000 },
+      { vk::DescriptorType::eUniformBuffer, 1000 },
+      { vk::DescriptorType::eStorageBuffer, 1000 },
+      { vk::DescriptorType::eUniformBufferDynamic, 1000 },
+      { vk::DescriptorType::eStorageBufferDynamic, 1000 },
+      { vk::DescriptorType::eInputAttachment, 1000 }
+  };
+
+  vk::DescriptorPoolCreateInfo info;
+  info.setPoolSizes(poolSizes);
+  info.maxSets = SETS_PER_POOL;
+  if (freeable) info.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+
+  return m_device.createDescriptorPoolUnique(info);
+}
+
+vk::DescriptorPool BG::DescriptorAllocator::GrabPool()
+{
+  if (!m_freePools.empty())
+  {
+    auto pool = m_freePools.back();
+    m_freePools.pop_back();
+    return pool;
+  }
+
+  m_allPools.push_back(CreatePool(false));
+
+  spdlog::debug("Descriptor allocator: {} pools", m_allPools.size());
+
+  return m_allPools.back().get();
+}
+
+vk::DescriptorSet BG::DescriptorAllocator::TryAllocate(vk::DescriptorPool pool, vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount)
+{
+  vk::DescriptorSetVariableDescriptorCountAllocateInfoEXT variableCount;
+  variableCount.pDescriptorCounts = &variableDescriptorCount;
+  variableCount.descriptorSetCount = 1;
+
+  vk::DescriptorSetAllocateInfo allocInfo;
+  allocInfo.descriptorPool = pool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &layout;
+
+  if (variableDescriptorCount != 0) allocInfo.pNext = &variableCount;
+
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  auto result = vk::Result(vkAllocateDescriptorSets(m_device, reinterpret_cast<const VkDescriptorSetAllocateInfo*>(&allocInfo), &set));
+
+  if (result == vk::Result::eErrorOutOfPoolMemory || result == vk::Result::eErrorFragmentedPool) return nullptr;
+
+  if (result != vk::Result::eSuccess)
+  {
+    spdlog::error("Descriptor set allocation failed: {}", vk::to_string(result));
+    throw std::runtime_error("Descriptor set allocation failed");
+  }
+
+  return set;
+}
+
+void BG::DescriptorAllocator::NewFrame(int frameIndex)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  m_currentFrame = frameIndex;
+  m_frameCount++;
+
+  auto& frame = m_frames[m_currentFrame];
+
+  for (auto pool : frame.pools)
+  {
+    m_device.resetDescriptorPool(pool);
+    m_freePools.push_back(pool);
+  }
+
+  frame.pools.clear();
+  frame.current = 0;
+
+  // Anything unused for longer than the frames in flight is not referenced by the GPU anymore
+  for (auto it = m_cache.begin(); it != m_cache.end();)
+  {
+    if (m_frameCount - it->second.lastUsedFrame > m_evictAfterFrames)
+    {
+      m_device.freeDescriptorSets(it->second.pool, it->second.set);
+      it = m_cache.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+vk::DescriptorSet BG::DescriptorAllocator::Allocate(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto& frame = m_frames[m_currentFrame];
+
+  while (true)
+  {
+    bool fresh = frame.current == frame.pools.size();
+    if (fresh) frame.pools.push_back(GrabPool());
+
+    auto set = TryAllocate(frame.pools[frame.current], layout, variableDescriptorCount);
+    if (set) return set;
+
+    // A set that doesn't fit into an empty pool never will
+    if (fresh)
+    {
+      spdlog::error("Descriptor set does not fit into an empty pool (variable count {})", variableDescriptorCount);
+      throw std::runtime_error("Descriptor set too large");
+    }
+
+    frame.current++;
+  }
+}
+
+size_t BG::DescriptorAllocator::KeyHash::operator()(const std::vector<uint64_t>& key) const
+{
+  uint64_t h = 0;
+  for (auto word : key) HashCombine(h, word);
+  return size_t(h);
+}
+
+vk::DescriptorSet BG::DescriptorAllocator::AllocateCached(vk::DescriptorSetLayout layout, const std::vector<uint64_t>& writeKey, const std::function<void(vk::DescriptorSet)>& write, uint32_t variableDescriptorCount)
+{
+  std::vector<uint64_t> key = writeKey;
+  key.push_back(uint64_t(VkDescriptorSetLayout(layout)));
+  key.push_back(variableDescriptorCount);
+
+  vk::DescriptorSet set;
+
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    auto it = m_cache.find(key);
+    if (it != m_cache.end())
+    {
+      it->second.lastUsedFrame = m_frameCount;
+      return it->second.set;
+    }
+
+    vk::DescriptorPool pool;
+
+    for (auto cachePool : m_cachePools)
+    {
+      set = TryAllocate(cachePool, layout, variableDescriptorCount);
+      if (set)
+      {
+        pool = cachePool;
+        break;
+      }
+    }
+
+    if (!set)
+    {
+      m_allPools.push_back(CreatePool(true));
+      m_cachePools.push_back(m_allPools.back().get());
+
+      pool = m_cachePools.back();
+      set = TryAllocate(pool, layout, variableDescriptorCount);
+
+      if (!set)
+      {
+        spdlog::error("Descriptor set does not fit into an empty pool (variable count {})", variableDescriptorCount);
+        throw std::runtime_error("Descriptor set too large");
+      }
+    }
+
+    m_cache[std::move(key)] = { set, pool, m_frameCount };
+
+    // Written under the lock, so no other thread sees the set before it's complete
+    write(set);
+  }
+
+  return set;
+}
+
+void BG::DescriptorAllocator::HashCombine(uint64_t& seed, uint64_t value)
+{
+  seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
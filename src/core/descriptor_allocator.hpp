@@ -0,0 +1,82 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+namespace BG
+{
+
+  // Descriptor sets for the frame, allocated from a chain of pools per swapchain image.
+  // A new pool is chained when the current one runs out, and all pools of an image are
+  // reset and reused when the image comes around again.
+  // Sets that reference only long-lived resources can be cached by a hash of those resources,
+  // they are written once and kept until unused for a few frames.
+  class DescriptorAllocator
+  {
+  private:
+    struct FramePools
+    {
+      std::vector<vk::DescriptorPool> pools;
+      size_t current = 0;
+    };
+
+    struct CachedSet
+    {
+      vk::DescriptorSet set;
+      vk::DescriptorPool pool;
+      uint64_t lastUsedFrame;
+    };
+
+    vk::Device m_device;
+
+    std::mutex m_mutex;
+
+    std::vector<vk::UniqueDescriptorPool> m_allPools;
+    std::vector<vk::DescriptorPool> m_freePools;
+
+    std::vector<FramePools> m_frames;
+    int m_currentFrame = 0;
+    uint64_t m_frameCount = 0;
+
+    struct KeyHash
+    {
+      size_t operator()(const std::vector<uint64_t>& key) const;
+    };
+
+    // Cached sets live in their own pools, which are never reset as a whole.
+    // Keyed by the full write key plus layout and variable count, so a hash collision is just a miss
+    std::vector<vk::DescriptorPool> m_cachePools;
+    std::unordered_map<std::vector<uint64_t>, CachedSet, KeyHash> m_cache;
+    uint64_t m_evictAfterFrames;
+
+    vk::UniqueDescriptorPool CreatePool(bool freeable);
+    vk::DescriptorPool GrabPool();
+    // Returns null if the pool ran out
+    vk::DescriptorSet TryAllocate(vk::DescriptorPool pool, vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount);
+
+  public:
+    // numFrames is the number of swapchain images, cached sets are evicted after numFrames + 1 frames unused
+    DescriptorAllocator(vk::Device device, uint32_t numFrames);
+
+    // Recycles the pools of this frame, the GPU must be done with it
+    void NewFrame(int frameIndex);
+
+    // Valid until the frame comes around again
+    vk::DescriptorSet Allocate(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount = 0);
+
+    // Returns the set cached for (layout, key), calling write only when the set was just allocated.
+    // The key must cover every resource written, and those resources must outlive the set.
+    vk::DescriptorSet AllocateCached(
+      vk::DescriptorSetLayout layout, const std::vector<uint64_t>& key,
+      const std::function<void(vk::DescriptorSet)>& write,
+      uint32_t variableDescriptorCount = 0);
+
+    static void HashCombine(uint64_t& seed, uint64_t value);
+  };
+
+}
@@ -0,0 +1,103 @@
+#include "descriptor_writer.hpp"
+#include "descriptor_allocator.hpp"
+#include "pipelines.hpp"
+#include "buffer.hpp"
+
+#include <cstring>
+
+BG::DescriptorWriter::DescriptorWriter(vk::Device device)
+  : m_device(device)
+{
+}
+
+BG::DescriptorWriter& BG::DescriptorWriter::WriteBuffer(int binding, const Buffer& buffer, uint64_t offset, uint64_t range, vk::DescriptorType type, int arrayElement)
+{
+  m_writes.push_back({ uint32_t(binding), uint32_t(arrayElement), type, false, m_bufferInfos.size() });
+  m_bufferInfos.push_back({ buffer.buffer, offset, range });
+
+  m_key.push_back(uint64_t(type));
+  m_key.insert(m_key.end(), { uint64_t(binding) << 32 | uint32_t(arrayElement), uint64_t(VkBuffer(buffer.buffer)), offset, range });
+
+  return *this;
+}
+
+BG::DescriptorWriter& BG::DescriptorWriter::WriteImage(int binding, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler, vk::DescriptorType type, int arrayElement)
+{
+  m_writes.push_back({ uint32_t(binding), uint32_t(arrayElement), type, true, m_imageInfos.size() });
+  m_imageInfos.push_back({ sampler, view, layout });
+
+  m_key.push_back(uint64_t(type));
+  m_key.insert(m_key.end(), { uint64_t(binding) << 32 | uint32_t(arrayElement), uint64_t(VkImageView(view)), uint64_t(VkSampler(sampler)), uint64_t(layout) });
+
+  return *this;
+}
+
+void BG::DescriptorWriter::Flush(vk::DescriptorSet set)
+{
+  if (m_writes.empty()) return;
+
+  m_device.updateDescriptorSets(GetWrites(set), {});
+}
+
+std::vector<vk::WriteDescriptorSet> BG::DescriptorWriter::GetWrites(vk::DescriptorSet set)
+{
+  std::vector<vk::WriteDescriptorSet> descSetWrites(m_writes.size());
+
+  for (size_t i = 0; i < m_writes.size(); i++)
+  {
+    auto& write = m_writes[i];
+    auto& descSetWrite = descSetWrites[i];
+
+    descSetWrite.dstSet = set;
+    descSetWrite.dstBinding = write.binding;
+    descSetWrite.dstArrayElement = write.arrayElement;
+    descSetWrite.descriptorType = write.type;
+    descSetWrite.descriptorCount = 1;
+
+    if (write.isImage)
+      descSetWrite.pImageInfo = &m_imageInfos[write.infoIndex];
+    else
+      descSetWrite.pBufferInfo = &m_bufferInfos[write.infoIndex];
+  }
+
+  return descSetWrites;
+}
+
+void BG::DescriptorWriter::Clear()
+{
+  m_bufferInfos.clear();
+  m_imageInfos.clear();
+  m_writes.clear();
+  m_key.clear();
+}
+
+BG::DescriptorTemplateData::DescriptorTemplateData(Pipeline& p)
+  : m_pipeline(p)
+{
+  m_data.resize(p.GetTemplateDataSize(), 0);
+}
+
+BG::DescriptorTemplateData& BG::DescriptorTemplateData::SetBuffer(int binding, const Buffer& buffer, uint64_t offset, uint64_t range, int arrayElement)
+{
+  vk::DescriptorBufferInfo info{ buffer.buffer, offset, range };
+  std::memcpy(m_data.data() + m_pipeline.GetTemplateOffset(binding, arrayElement), &info, sizeof(info));
+
+  m_key.insert(m_key.end(), { uint64_t(binding) << 32 | uint32_t(arrayElement), uint64_t(VkBuffer(buffer.buffer)), offset, range });
+
+  return *this;
+}
+
+BG::DescriptorTemplateData& BG::DescriptorTemplateData::SetImage(int binding, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler, int arrayElement)
+{
+  vk::DescriptorImageInfo info{ sampler, view, layout };
+  std::memcpy(m_data.data() + m_pipeline.GetTemplateOffset(binding, arrayElement), &info, sizeof(info));
+
+  m_key.insert(m_key.end(), { uint64_t(binding) << 32 | uint32_t(arrayElement), uint64_t(VkImageView(view)), uint64_t(VkSampler(sampler)), uint64_t(layout) });
+
+  return *this;
+}
+
+void BG::DescriptorTemplateData::Apply(vk::DescriptorSet set)
+{
+  m_pipeline.UpdateDescSetWithTemplate(set, m_data.data());
+}
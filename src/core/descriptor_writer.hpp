@@ -0,0 +1,80 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+namespace BG
+{
+
+  // Collects the descriptor writes of one set and applies them with a single updateDescriptorSets.
+  // GetKey() covers every resource written, so it can key Pipeline::AllocDescSetCached:
+  //   auto set = p.AllocDescSetCached(ctx.descAllocator, writer.GetKey(), [&](vk::DescriptorSet s) { writer.Flush(s); });
+  class DescriptorWriter
+  {
+  private:
+    struct PendingWrite
+    {
+      uint32_t binding;
+      uint32_t arrayElement;
+      vk::DescriptorType type;
+      bool isImage;
+      size_t infoIndex;
+    };
+
+    vk::Device m_device;
+
+    std::vector<vk::DescriptorBufferInfo> m_bufferInfos;
+    std::vector<vk::DescriptorImageInfo> m_imageInfos;
+    std::vector<PendingWrite> m_writes;
+
+    // Binding, handles, offsets and layouts of every write, in order
+    std::vector<uint64_t> m_key;
+
+  public:
+    DescriptorWriter(vk::Device device);
+
+    DescriptorWriter& WriteBuffer(
+      int binding, const Buffer& buffer, uint64_t offset, uint64_t range,
+      vk::DescriptorType type = vk::DescriptorType::eUniformBuffer, int arrayElement = 0);
+
+    DescriptorWriter& WriteImage(
+      int binding, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler,
+      vk::DescriptorType type = vk::DescriptorType::eCombinedImageSampler, int arrayElement = 0);
+
+    inline const std::vector<uint64_t>& GetKey() { return m_key; }
+    inline size_t GetNumWrites() { return m_writes.size(); }
+
+    // Writes everything collected into set, the writes are kept so the same data can go to another set
+    void Flush(vk::DescriptorSet set);
+
+    // The collected writes targeting set, they point into this writer. Push descriptors pass a null set
+    std::vector<vk::WriteDescriptorSet> GetWrites(vk::DescriptorSet set = nullptr);
+
+    void Clear();
+  };
+
+  // Packed data for Pipeline::UpdateDescSetWithTemplate, laid out from the pipeline's reflected bindings.
+  // The whole set is updated in one driver call.
+  class DescriptorTemplateData
+  {
+  private:
+    Pipeline& m_pipeline;
+    std::vector<uint8_t> m_data;
+
+    // Binding, handles, offsets and layouts of every write, in order
+    std::vector<uint64_t> m_key;
+
+  public:
+    DescriptorTemplateData(Pipeline& p);
+
+    DescriptorTemplateData& SetBuffer(int binding, const Buffer& buffer, uint64_t offset, uint64_t range, int arrayElement = 0);
+    DescriptorTemplateData& SetImage(int binding, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler, int arrayElement = 0);
+
+    inline const void* GetData() { return m_data.data(); }
+    inline const std::vector<uint64_t>& GetKey() { return m_key; }
+
+    void Apply(vk::DescriptorSet set);
+  };
+
+}
@@ -0,0 +1,208 @@
+#include "frame_telemetry.hpp"
+
+#include "imgui.h"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+using namespace BG;
+
+static double GetMetric(const FrameTelemetry::Sample& s, FrameTelemetry::Metric metric)
+{
+  switch (metric)
+  {
+  case FrameTelemetry::Metric::Frame: return s.frameMs;
+  case FrameTelemetry::Metric::Acquire: return s.acquireMs;
+  case FrameTelemetry::Metric::FenceWait: return s.fenceWaitMs;
+  case FrameTelemetry::Metric::RenderCpu: return s.renderCpuMs;
+  case FrameTelemetry::Metric::GuiWait: return s.guiWaitMs;
+  case FrameTelemetry::Metric::Present: return s.presentMs;
+  default: return 0.0;
+  }
+}
+
+static const char* GetMetricName(FrameTelemetry::Metric metric)
+{
+  switch (metric)
+  {
+  case FrameTelemetry::Metric::Frame: return "frame";
+  case FrameTelemetry::Metric::Acquire: return "acquire";
+  case FrameTelemetry::Metric::FenceWait: return "fenceWait";
+  case FrameTelemetry::Metric::RenderCpu: return "renderCpu";
+  case FrameTelemetry::Metric::GuiWait: return "guiWait";
+  case FrameTelemetry::Metric::Present: return "present";
+  default: return "unknown";
+  }
+}
+
+static const FrameTelemetry::Metric allMetrics[] = {
+  FrameTelemetry::Metric::Frame,
+  FrameTelemetry::Metric::Acquire,
+  FrameTelemetry::Metric::FenceWait,
+  FrameTelemetry::Metric::RenderCpu,
+  FrameTelemetry::Metric::GuiWait,
+  FrameTelemetry::Metric::Present
+};
+
+BG::FrameTelemetry::FrameTelemetry(size_t capacity)
+{
+  m_ring.resize(capacity);
+}
+
+void BG::FrameTelemetry::Record(const Sample& sample)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  m_ring[m_head] = sample;
+  m_head = (m_head + 1) % m_ring.size();
+  m_count = std::min(m_count + 1, m_ring.size());
+}
+
+std::vector<FrameTelemetry::Sample> BG::FrameTelemetry::GetSamplesLocked()
+{
+  std::vector<Sample> samples;
+  samples.reserve(m_count);
+
+  size_t first = (m_head + m_ring.size() - m_count) % m_ring.size();
+  for (size_t i = 0; i < m_count; i++)
+  {
+    samples.push_back(m_ring[(first + i) % m_ring.size()]);
+  }
+
+  return samples;
+}
+
+std::vector<FrameTelemetry::Sample> BG::FrameTelemetry::GetSamples()
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return GetSamplesLocked();
+}
+
+FrameTelemetry::Stats BG::FrameTelemetry::ComputeStats(const std::vector<Sample>& samples, Metric metric)
+{
+  Stats stats;
+
+  if (samples.empty()) return stats;
+
+  std::vector<double> values;
+  values.reserve(samples.size());
+  for (auto& s : samples) values.push_back(GetMetric(s, metric));
+
+  std::sort(values.begin(), values.end());
+
+  auto percentile = [&](double p) {
+    size_t index = size_t(p * double(values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+  };
+
+  stats.p50 = percentile(0.50);
+  stats.p95 = percentile(0.95);
+  stats.p99 = percentile(0.99);
+  stats.max = values.back();
+
+  return stats;
+}
+
+FrameTelemetry::Stats BG::FrameTelemetry::GetStats(Metric metric)
+{
+  return ComputeStats(GetSamples(), metric);
+}
+
+bool BG::FrameTelemetry::DumpCSV(std::string path)
+{
+  auto samples = GetSamples();
+
+  std::ofstream f(path);
+  if (!f.is_open())
+  {
+    spdlog::error("Failed to open {} for frame telemetry", path);
+    return false;
+  }
+
+  f << "frame,frameMs,acquireMs,fenceWaitMs,renderCpuMs,guiWaitMs,presentMs\n";
+  for (auto& s : samples)
+  {
+    f << s.frame << "," << s.frameMs << "," << s.acquireMs << "," << s.fenceWaitMs << ","
+      << s.renderCpuMs << "," << s.guiWaitMs << "," << s.presentMs << "\n";
+  }
+
+  spdlog::info("Wrote {} frame telemetry samples to {}", samples.size(), path);
+
+  return true;
+}
+
+bool BG::FrameTelemetry::DumpJSON(std::string path)
+{
+  using json = nlohmann::json;
+
+  auto samples = GetSamples();
+
+  json j;
+
+  for (auto metric : allMetrics)
+  {
+    auto stats = ComputeStats(samples, metric);
+    j["stats"][GetMetricName(metric)] = { { "p50", stats.p50 }, { "p95", stats.p95 }, { "p99", stats.p99 }, { "max", stats.max } };
+  }
+
+  j["samples"] = json::array();
+  for (auto& s : samples)
+  {
+    j["samples"].push_back({
+      { "frame", s.frame },
+      { "frameMs", s.frameMs },
+      { "acquireMs", s.acquireMs },
+      { "fenceWaitMs", s.fenceWaitMs },
+      { "renderCpuMs", s.renderCpuMs },
+      { "guiWaitMs", s.guiWaitMs },
+      { "presentMs", s.presentMs } });
+  }
+
+  std::ofstream f(path);
+  if (!f.is_open())
+  {
+    spdlog::error("Failed to open {} for frame telemetry", path);
+    return false;
+  }
+
+  f << j.dump(2);
+
+  spdlog::info("Wrote {} frame telemetry samples to {}", samples.size(), path);
+
+  return true;
+}
+
+void BG::FrameTelemetry::DumpOnExit()
+{
+  if (m_dumpOnExitPath.empty()) return;
+
+  std::string path = m_dumpOnExitPath;
+
+  if (path.size() >= 5 && path.substr(path.size() - 5) == ".json")
+    DumpJSON(path);
+  else
+    DumpCSV(path);
+}
+
+void BG::FrameTelemetry::RenderGUI()
+{
+  auto samples = GetSamples();
+
+  if (samples.empty()) return;
+
+  if (ImGui::CollapsingHeader("Frame Telemetry"))
+  {
+    ImGui::Text("%-10s %8s %8s %8s %8s", "ms", "p50", "p95", "p99", "max");
+    for (auto metric : allMetrics)
+    {
+      auto stats = ComputeStats(samples, metric);
+      ImGui::Text("%-10s %8.3f %8.3f %8.3f %8.3f", GetMetricName(metric), stats.p50, stats.p95, stats.p99, stats.max);
+    }
+
+    if (ImGui::Button("Dump CSV")) DumpCSV("frame_telemetry.csv");
+    ImGui::SameLine();
+    if (ImGui::Button("Dump JSON")) DumpJSON("frame_telemetry.json");
+  }
+}
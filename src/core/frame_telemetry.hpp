@@ -0,0 +1,67 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <mutex>
+
+namespace BG
+{
+
+  class FrameTelemetry
+  {
+  public:
+    // All timings in milliseconds
+    struct Sample
+    {
+      uint64_t frame;
+      double frameMs;      // start of previous frame to start of this frame
+      double acquireMs;    // acquireNextImageKHR
+      double fenceWaitMs;  // blocked on the graphics timeline (frame slot + image)
+      double renderCpuMs;  // render callback
+      double guiWaitMs;    // taking the latest GUI frame from the GUI thread
+      double presentMs;    // submit + presentKHR
+    };
+
+    enum class Metric
+    {
+      Frame, Acquire, FenceWait, RenderCpu, GuiWait, Present
+    };
+
+    struct Stats
+    {
+      double p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+    };
+
+  private:
+    std::mutex m_mutex;
+
+    std::vector<Sample> m_ring;
+    size_t m_head = 0;
+    size_t m_count = 0;
+
+    std::string m_dumpOnExitPath;
+
+    std::vector<Sample> GetSamplesLocked();
+
+  public:
+    FrameTelemetry(size_t capacity = 8192);
+
+    void Record(const Sample& sample);
+
+    // Samples in the ring, oldest first
+    std::vector<Sample> GetSamples();
+
+    Stats GetStats(Metric metric);
+    static Stats ComputeStats(const std::vector<Sample>& samples, Metric metric);
+
+    bool DumpCSV(std::string path);
+    bool DumpJSON(std::string path);
+
+    // Format is picked from the extension (.json, otherwise CSV)
+    inline void SetDumpOnExit(std::string path) { m_dumpOnExitPath = path; }
+    void DumpOnExit();
+
+    void RenderGUI();
+  };
+
+}
@@ -0,0 +1,109 @@
+#include "framebuffer_cache.hpp"
+#include "lifetime_tracker.hpp"
+
+#include <algorithm>
+
+bool BG::FramebufferCache::Key::operator==(const Key& other) const
+{
+  return renderPass == other.renderPass && views == other.views && width == other.width && height == other.height;
+}
+
+size_t BG::FramebufferCache::KeyHash::operator()(const Key& key) const
+{
+  size_t h = std::hash<VkRenderPass>()(key.renderPass);
+
+  auto combine = [&](size_t v) { h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2); };
+
+  for (auto view : key.views) combine(std::hash<VkImageView>()(view));
+  combine(size_t((uint64_t(key.width) << 32) | key.height));
+
+  return h;
+}
+
+BG::FramebufferCache::FramebufferCache(vk::Device device, Tracker& tracker)
+  : m_device(device), m_tracker(tracker)
+{
+}
+
+vk::Framebuffer BG::FramebufferCache::Get(vk::RenderPass renderPass, const std::vector<vk::ImageView>& views, glm::uvec2 extent)
+{
+  Key key;
+  key.renderPass = static_cast<VkRenderPass>(renderPass);
+  key.views.reserve(views.size());
+  for (auto view : views) key.views.push_back(static_cast<VkImageView>(view));
+  key.width = extent.x;
+  key.height = extent.y;
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto it = m_entries.find(key);
+  if (it != m_entries.end())
+  {
+    it->second.lastUsedFrame = m_frame;
+    return it->second.framebuffer.get();
+  }
+
+  vk::FramebufferCreateInfo framebufferInfo;
+  framebufferInfo.setRenderPass(renderPass);
+  framebufferInfo.setAttachments(views);
+  framebufferInfo.setWidth(extent.x);
+  framebufferInfo.setHeight(extent.y);
+  framebufferInfo.setLayers(1);
+
+  auto fb = m_device.createFramebufferUnique(framebufferInfo);
+  vk::Framebuffer handle = fb.get();
+
+  m_entries.emplace(std::move(key), Entry{ std::move(fb), m_frame });
+  m_createdThisFrame++;
+
+  return handle;
+}
+
+template <class Pred> void BG::FramebufferCache::EvictIf(Pred pred)
+{
+  for (auto it = m_entries.begin(); it != m_entries.end();)
+  {
+    if (pred(it->first, it->second))
+    {
+      m_tracker.DisposeFramebuffer(std::move(it->second.framebuffer));
+      it = m_entries.erase(it);
+    }
+    else
+    {
+      it++;
+    }
+  }
+}
+
+void BG::FramebufferCache::InvalidateView(vk::ImageView view)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  VkImageView handle = static_cast<VkImageView>(view);
+  EvictIf([&](const Key& key, const Entry&) {
+    return std::find(key.views.begin(), key.views.end(), handle) != key.views.end();
+    });
+}
+
+void BG::FramebufferCache::InvalidateRenderPass(vk::RenderPass renderPass)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  VkRenderPass handle = static_cast<VkRenderPass>(renderPass);
+  EvictIf([&](const Key& key, const Entry&) { return key.renderPass == handle; });
+}
+
+void BG::FramebufferCache::NewFrame()
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  if (m_createdThisFrame > 0)
+  {
+    spdlog::debug("Framebuffer cache: {} created last frame, {} cached", m_createdThisFrame, m_entries.size());
+  }
+
+  m_frame++;
+  m_createdThisFrame = 0;
+
+  EvictIf([&](const Key&, const Entry& entry) { return entry.lastUsedFrame + EVICT_AFTER_FRAMES < m_frame; });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace BG
+{
+
+  // Framebuffers keyed by render pass + attachment views + extent, shared by every WithRenderPass / RecordParallel.
+  // Entries go away when a view or render pass they reference is invalidated, or after going unused for a while;
+  // the framebuffers are handed to the Tracker since in-flight frames may still use them.
+  class FramebufferCache
+  {
+  private:
+    static const uint64_t EVICT_AFTER_FRAMES = 64;
+
+    struct Key
+    {
+      VkRenderPass renderPass;
+      std::vector<VkImageView> views;
+      uint32_t width, height;
+
+      bool operator==(const Key& other) const;
+    };
+
+    struct KeyHash
+    {
+      size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+      vk::UniqueFramebuffer framebuffer;
+      uint64_t lastUsedFrame;
+    };
+
+    vk::Device m_device;
+    Tracker& m_tracker;
+
+    std::mutex m_mutex;
+    std::unordered_map<Key, Entry, KeyHash> m_entries;
+
+    uint64_t m_frame = 0;
+    uint32_t m_createdThisFrame = 0;
+
+    template <class Pred> void EvictIf(Pred pred);
+
+  public:
+    FramebufferCache(vk::Device device, Tracker& tracker);
+
+    vk::Framebuffer Get(vk::RenderPass renderPass, const std::vector<vk::ImageView>& views, glm::uvec2 extent);
+
+    // Call before destroying an image view / render pass that may have been rendered to through the cache
+    void InvalidateView(vk::ImageView view);
+    void InvalidateRenderPass(vk::RenderPass renderPass);
+
+    // Evicts entries unused for EVICT_AFTER_FRAMES frames, main thread only (disposes into the Tracker)
+    void NewFrame();
+
+    inline size_t GetNumFramebuffers() { return m_entries.size(); }
+  };
+
+}
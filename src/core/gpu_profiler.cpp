@@ -0,0 +1,214 @@
+#include "gpu_profiler.hpp"
+
+#include "imgui.h"
+
+#include <algorithm>
+
+using namespace BG;
+
+BG::GpuProfiler::GpuProfiler(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t numFrames)
+  : m_device(device)
+{
+  auto properties = physicalDevice.getProperties();
+  auto queueFamilies = physicalDevice.getQueueFamilyProperties();
+
+  uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+
+  m_supported = validBits > 0 && properties.limits.timestampPeriod > 0.0f;
+  m_timestampPeriod = properties.limits.timestampPeriod;
+  m_timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+  if (!m_supported)
+  {
+    spdlog::warn("GPU timestamps are not supported on the graphics queue, GPU profiler disabled");
+    return;
+  }
+
+  m_frames.resize(numFrames);
+
+  for (auto& frame : m_frames)
+  {
+    frame.pool = m_device.createQueryPoolUnique({ {}, vk::QueryType::eTimestamp, MAX_QUERIES });
+  }
+}
+
+void BG::GpuProfiler::ReadBack(FrameQueries& frame)
+{
+  if (!frame.recorded || frame.numQueries == 0) return;
+
+  frame.recorded = false;
+
+  std::vector<uint64_t> timestamps(frame.numQueries);
+
+  // No wait flag: if the GPU is not done with this slot yet we drop the sample rather than stall
+  auto result = m_device.getQueryPoolResults(
+    frame.pool.get(), 0, frame.numQueries,
+    timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+    vk::QueryResultFlagBits::e64);
+
+  if (result != vk::Result::eSuccess) return;
+
+  uint64_t frameStart = timestamps[frame.scopes[0].beginQuery] & m_timestampMask;
+
+  std::vector<ScopeTiming> results;
+
+  for (auto& scope : frame.scopes)
+  {
+    if (scope.endQuery == UINT32_MAX) continue;
+
+    uint64_t begin = timestamps[scope.beginQuery] & m_timestampMask;
+    uint64_t end = timestamps[scope.endQuery] & m_timestampMask;
+
+    ScopeTiming timing;
+    timing.name = scope.name;
+    timing.depth = scope.depth;
+    timing.startMs = double(begin - frameStart) * m_timestampPeriod * 1e-6;
+    timing.durationMs = double(end - begin) * m_timestampPeriod * 1e-6;
+
+    results.push_back(timing);
+  }
+
+  std::lock_guard<std::mutex> lk(m_resultMutex);
+  m_results = std::move(results);
+}
+
+void BG::GpuProfiler::NewFrame(uint32_t frameIndex)
+{
+  if (!m_supported) return;
+
+  m_currentFrame = frameIndex;
+
+  auto& frame = m_frames[m_currentFrame];
+
+  ReadBack(frame);
+
+  frame.scopes.clear();
+  frame.numQueries = 0;
+  m_scopeStack.clear();
+}
+
+void BG::GpuProfiler::BeginFrame(vk::CommandBuffer buf)
+{
+  if (!m_supported) return;
+
+  auto& frame = m_frames[m_currentFrame];
+
+  frame.scopes.clear();
+  frame.numQueries = 0;
+  m_scopeStack.clear();
+
+  buf.resetQueryPool(frame.pool.get(), 0, MAX_QUERIES);
+
+  BeginScope(buf, "Frame");
+}
+
+void BG::GpuProfiler::EndFrame(vk::CommandBuffer buf)
+{
+  if (!m_supported) return;
+
+  // Close anything left open, including the frame scope itself
+  while (!m_scopeStack.empty())
+  {
+    EndScope(buf);
+  }
+
+  m_frames[m_currentFrame].recorded = true;
+}
+
+void BG::GpuProfiler::BeginScope(vk::CommandBuffer buf, const std::string& name)
+{
+  if (!m_supported) return;
+
+  auto& frame = m_frames[m_currentFrame];
+
+  if (frame.numQueries + 2 > MAX_QUERIES)
+  {
+    m_scopeStack.push_back(UINT32_MAX);
+    return;
+  }
+
+  ScopeRecord scope;
+  scope.name = name;
+  scope.depth = int(m_scopeStack.size());
+  scope.beginQuery = frame.numQueries++;
+  scope.endQuery = UINT32_MAX;
+
+  buf.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, frame.pool.get(), scope.beginQuery);
+
+  m_scopeStack.push_back(uint32_t(frame.scopes.size()));
+  frame.scopes.push_back(scope);
+}
+
+void BG::GpuProfiler::EndScope(vk::CommandBuffer buf)
+{
+  if (!m_supported || m_scopeStack.empty()) return;
+
+  uint32_t index = m_scopeStack.back();
+  m_scopeStack.pop_back();
+
+  if (index == UINT32_MAX) return;
+
+  auto& frame = m_frames[m_currentFrame];
+  auto& scope = frame.scopes[index];
+
+  scope.endQuery = frame.numQueries++;
+
+  buf.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, frame.pool.get(), scope.endQuery);
+}
+
+std::vector<GpuProfiler::ScopeTiming> BG::GpuProfiler::GetResults()
+{
+  std::lock_guard<std::mutex> lk(m_resultMutex);
+  return m_results;
+}
+
+void BG::GpuProfiler::RenderGUI()
+{
+  if (!m_supported) return;
+
+  auto results = GetResults();
+
+  if (results.empty()) return;
+
+  ImGui::Begin("GPU Profiler");
+
+  const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+
+  int maxDepth = 0;
+  for (auto& scope : results) maxDepth = std::max(maxDepth, scope.depth);
+
+  // Flame view, the root scope spans the whole width
+  double frameMs = std::max(results[0].durationMs, 1e-6);
+  float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  ImDrawList* drawList = ImGui::GetWindowDrawList();
+
+  for (auto& scope : results)
+  {
+    ImVec2 p0(origin.x + float(scope.startMs / frameMs) * width, origin.y + scope.depth * rowHeight);
+    ImVec2 p1(p0.x + std::max(float(scope.durationMs / frameMs) * width, 1.0f), p0.y + rowHeight - 1.0f);
+
+    float hue = 0.6f - 0.12f * float(scope.depth % 5);
+    ImU32 color = ImGui::ColorConvertFloat4ToU32(ImColor::HSV(hue, 0.6f, 0.7f));
+
+    drawList->AddRectFilled(p0, p1, color, 2.0f);
+    drawList->PushClipRect(p0, p1, true);
+    drawList->AddText(ImVec2(p0.x + 3.0f, p0.y), IM_COL32_WHITE, scope.name.c_str());
+    drawList->PopClipRect();
+
+    if (ImGui::IsMouseHoveringRect(p0, p1))
+    {
+      ImGui::SetTooltip("%s: %.3f ms", scope.name.c_str(), scope.durationMs);
+    }
+  }
+
+  ImGui::Dummy(ImVec2(width, (maxDepth + 1) * rowHeight));
+
+  // Per-pass timings
+  for (auto& scope : results)
+  {
+    ImGui::Text("%*s%s %.3f ms", scope.depth * 2, "", scope.name.c_str(), scope.durationMs);
+  }
+
+  ImGui::End();
+}
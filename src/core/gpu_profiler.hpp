@@ -0,0 +1,77 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <mutex>
+
+namespace BG
+{
+
+  class GpuProfiler
+  {
+  public:
+    struct ScopeTiming
+    {
+      std::string name;
+      int depth;
+      double startMs;
+      double durationMs;
+    };
+
+  private:
+    static const uint32_t MAX_QUERIES = 512;
+
+    struct ScopeRecord
+    {
+      std::string name;
+      int depth;
+      uint32_t beginQuery;
+      uint32_t endQuery;
+    };
+
+    // One query pool per frame slot, results are read back when the slot comes around again
+    struct FrameQueries
+    {
+      vk::UniqueQueryPool pool;
+      std::vector<ScopeRecord> scopes;
+      uint32_t numQueries = 0;
+      bool recorded = false;
+    };
+
+    vk::Device m_device;
+
+    bool m_supported = false;
+    double m_timestampPeriod = 1.0; // nanoseconds per tick
+    uint64_t m_timestampMask = ~0ull;
+
+    std::vector<FrameQueries> m_frames;
+    uint32_t m_currentFrame = 0;
+
+    std::vector<uint32_t> m_scopeStack;
+
+    std::mutex m_resultMutex;
+    std::vector<ScopeTiming> m_results;
+
+    void ReadBack(FrameQueries& frame);
+
+  public:
+    GpuProfiler(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t numFrames);
+
+    // Collect the results of the last frame using this slot (without waiting), then make it current
+    void NewFrame(uint32_t frameIndex);
+
+    void BeginFrame(vk::CommandBuffer buf);
+    void EndFrame(vk::CommandBuffer buf);
+
+    void BeginScope(vk::CommandBuffer buf, const std::string& name);
+    void EndScope(vk::CommandBuffer buf);
+
+    std::vector<ScopeTiming> GetResults();
+
+    // Flame graph & per-scope timings, called from the GUI thread
+    void RenderGUI();
+  };
+
+}
@@ -0,0 +1,105 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+BG::JobSystem::JobSystem(int numWorkers)
+{
+  if (numWorkers <= 0) numWorkers = std::max(int(std::thread::hardware_concurrency()) - 1, 1);
+
+  for (int i = 0; i < numWorkers; i++)
+  {
+    m_workers.emplace_back([this, i] { WorkerLoop(i); });
+  }
+
+  spdlog::debug("Job system started with {} workers", numWorkers);
+}
+
+BG::JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+
+  for (auto& t : m_workers) t.join();
+}
+
+void BG::JobSystem::WorkerLoop(int worker)
+{
+  while (true)
+  {
+    Job job;
+
+    {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      m_cv.wait(lk, [&] { return m_stop || !m_queue.empty(); });
+
+      if (m_stop && m_queue.empty()) return;
+
+      job = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+
+    try
+    {
+      job(worker);
+    }
+    catch (const std::exception& e)
+    {
+      spdlog::error("Job failed on worker {}: {}", worker, e.what());
+    }
+  }
+}
+
+void BG::JobSystem::Submit(Job job)
+{
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_queue.push_back(std::move(job));
+  }
+  m_cv.notify_one();
+}
+
+void BG::JobSystem::ParallelFor(int count, std::function<void(int worker, int index)> func)
+{
+  if (count <= 0) return;
+
+  // One job per worker, each pulling indices until the range is exhausted
+  int numJobs = std::min(count, GetNumWorkers());
+
+  std::atomic<int> nextIndex{ 0 };
+  int remainingJobs = numJobs;
+  std::exception_ptr error;
+
+  std::mutex doneMutex;
+  std::condition_variable doneCv;
+
+  for (int i = 0; i < numJobs; i++)
+  {
+    Submit([&](int worker) {
+      try
+      {
+        for (int index = nextIndex++; index < count; index = nextIndex++)
+        {
+          func(worker, index);
+        }
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lk(doneMutex);
+        if (!error) error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lk(doneMutex);
+      if (--remainingJobs == 0) doneCv.notify_one();
+    });
+  }
+
+  std::unique_lock<std::mutex> lk(doneMutex);
+  doneCv.wait(lk, [&] { return remainingJobs == 0; });
+
+  if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace BG
+{
+
+  // Fixed pool of worker threads. Jobs get the index of the worker running them,
+  // so callers can keep per-worker state (e.g. command pools) without locking.
+  class JobSystem
+  {
+  public:
+    using Job = std::function<void(int worker)>;
+
+  private:
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Job> m_queue;
+    bool m_stop = false;
+
+    void WorkerLoop(int worker);
+
+  public:
+    // 0 workers means one per hardware thread, minus the main thread
+    JobSystem(int numWorkers = 0);
+    ~JobSystem();
+
+    inline int GetNumWorkers() { return int(m_workers.size()); }
+
+    void Submit(Job job);
+
+    // Runs func for every index in [0, count) on the workers and blocks until all are done.
+    // The first exception thrown by func is rethrown on the calling thread.
+    void ParallelFor(int count, std::function<void(int worker, int index)> func);
+  };
+
+}
@@ -1,24 +1,27 @@
 #include "lifetime_tracker.hpp"
 
-void BG::Tracker::FrameObjects::ClearAll()
+void BG::Tracker::DisposeFramebuffer(vk::UniqueFramebuffer fb)
 {
-  framebuffers.clear();
+  m_current.framebuffers.push_back(std::move(fb));
 }
 
-void BG::Tracker::DisposeFramebuffer(vk::UniqueFramebuffer fb)
+void BG::Tracker::NewFrame(uint64_t completedValue)
 {
-  m_frames[m_currentFrame].framebuffers.push_back(std::move(fb));
+  while (!m_submitted.empty() && m_submitted.front().timelineValue <= completedValue)
+  {
+    m_submitted.pop_front();
+  }
 }
 
-void BG::Tracker::NewFrame()
+void BG::Tracker::EndFrame(uint64_t submitValue)
 {
-  m_currentFrame = (m_currentFrame + 1) % m_numFramesInFlight;
+  if (m_current.framebuffers.empty()) return;
 
-  m_frames[m_currentFrame].ClearAll();
+  m_current.timelineValue = submitValue;
+  m_submitted.push_back(std::move(m_current));
+  m_current = FrameObjects();
 }
 
-BG::Tracker::Tracker(int maxFrames)
-  : m_numFramesInFlight(maxFrames)
+BG::Tracker::Tracker()
 {
-  m_frames.resize(maxFrames);
 }
@@ -3,29 +3,33 @@
 #include "berkeley_gfx.hpp"
 #include <vulkan/vulkan.hpp>
 
+#include <deque>
+
 namespace BG
 {
+  // Keeps objects alive until the GPU is done with the frame that used them.
+  // Objects disposed during a frame are tagged with the graphics timeline value of its submit.
   class Tracker
   {
   private:
-    int m_numFramesInFlight = 3;
-    int m_currentFrame = 0;
-
     struct FrameObjects
     {
+      uint64_t timelineValue = 0;
       std::vector<vk::UniqueFramebuffer> framebuffers;
-
-      void ClearAll();
     };
 
-    std::vector<FrameObjects> m_frames;
+    FrameObjects m_current;
+    std::deque<FrameObjects> m_submitted;
 
   public:
     void DisposeFramebuffer(vk::UniqueFramebuffer fb);
 
-    void NewFrame();
+    // Releases everything from frames whose timeline value has completed
+    void NewFrame(uint64_t completedValue);
+    // Tags the objects disposed since NewFrame with the value the frame's submit signals
+    void EndFrame(uint64_t submitValue);
 
-    Tracker(int maxFrames);
+    Tracker();
   };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,105 @@
+#include "parallel_recorder.hpp"
+#include "command_buffer.hpp"
+#include "pipelines.hpp"
+#include "job_system.hpp"
+
+BG::ParallelRecorder::ParallelRecorder(vk::Device device, JobSystem& jobs, Tracker& tracker, uint32_t queueFamily, uint32_t numFrames)
+  : m_device(device), m_jobs(jobs), m_tracker(tracker)
+{
+  m_frames.resize(numFrames);
+
+  for (auto& frame : m_frames)
+  {
+    frame.resize(m_jobs.GetNumWorkers());
+
+    for (auto& worker : frame)
+    {
+      worker.pool = m_device.createCommandPoolUnique({ vk::CommandPoolCreateFlagBits::eTransient, queueFamily });
+    }
+  }
+}
+
+void BG::ParallelRecorder::NewFrame(int frameIndex)
+{
+  m_currentFrame = frameIndex;
+
+  for (auto& worker : m_frames[m_currentFrame])
+  {
+    if (worker.used == 0) continue;
+
+    m_device.resetCommandPool(worker.pool.get(), {});
+    worker.used = 0;
+  }
+}
+
+vk::CommandBuffer BG::ParallelRecorder::NextBuffer(WorkerPool& worker)
+{
+  if (worker.used == worker.buffers.size())
+  {
+    worker.buffers.push_back(std::move(m_device.allocateCommandBuffersUnique({ worker.pool.get(), vk::CommandBufferLevel::eSecondary, 1 })[0]));
+  }
+
+  return worker.buffers[worker.used++].get();
+}
+
+void BG::ParallelRecorder::Record(CommandBuffer& primary, Pipeline& p, vk::Framebuffer& frameBuffer, glm::uvec2 extent, glm::vec4 clearColor, glm::ivec2 offset, int numTasks, std::function<void(CommandBuffer&, int)> func)
+{
+  primary.BeginRenderPass(p, frameBuffer, extent, clearColor, offset, vk::SubpassContents::eSecondaryCommandBuffers);
+
+  vk::CommandBufferInheritanceInfo inheritance;
+  inheritance.renderPass = p.GetRenderPass();
+  inheritance.subpass = 0;
+  inheritance.framebuffer = frameBuffer;
+
+  RecordSecondaries(primary, p, inheritance, numTasks, func);
+
+  primary.EndRenderPass();
+}
+
+void BG::ParallelRecorder::Record(CommandBuffer& primary, Pipeline& p, const std::vector<vk::ImageView>& renderTargets, glm::uvec2 extent, glm::vec4 clearColor, glm::ivec2 offset, int numTasks, std::function<void(CommandBuffer&, int)> func)
+{
+  primary.BeginRendering(p, renderTargets, extent, clearColor, offset, vk::RenderingFlagBitsKHR::eContentsSecondaryCommandBuffers);
+
+  auto colorFormats = p.GetColorFormats();
+
+  vk::CommandBufferInheritanceRenderingInfoKHR renderingInheritance;
+  renderingInheritance.setColorAttachmentFormats(colorFormats);
+  renderingInheritance.depthAttachmentFormat = p.GetDepthFormat();
+  renderingInheritance.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+  vk::CommandBufferInheritanceInfo inheritance;
+  inheritance.pNext = &renderingInheritance;
+
+  RecordSecondaries(primary, p, inheritance, numTasks, func);
+
+  primary.EndRendering();
+}
+
+void BG::ParallelRecorder::RecordSecondaries(CommandBuffer& primary, Pipeline& p, const vk::CommandBufferInheritanceInfo& inheritance, int numTasks, std::function<void(CommandBuffer&, int)>& func)
+{
+  vk::CommandBufferBeginInfo beginInfo;
+  beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+  beginInfo.pInheritanceInfo = &inheritance;
+
+  std::vector<vk::CommandBuffer> secondaries(numTasks);
+
+  auto& frame = m_frames[m_currentFrame];
+
+  m_jobs.ParallelFor(numTasks, [&](int worker, int task) {
+    vk::CommandBuffer buf = NextBuffer(frame[worker]);
+
+    buf.begin(beginInfo);
+
+    // No profiler here, its scope stack belongs to the primary command buffer
+    CommandBuffer bgBuf(m_device, buf, m_tracker);
+    bgBuf.BindPipeline(p);
+
+    func(bgBuf, task);
+
+    buf.end();
+
+    secondaries[task] = buf;
+    });
+
+  primary.ExecuteCommands(secondaries);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <functional>
+
+namespace BG
+{
+
+  // Records draws into secondary command buffers on the job system workers.
+  // Every worker owns one command pool per frame slot, so recording never needs a lock
+  // and a whole slot is recycled with a single pool reset.
+  class ParallelRecorder
+  {
+  private:
+    struct WorkerPool
+    {
+      vk::UniqueCommandPool pool;
+      std::vector<vk::UniqueCommandBuffer> buffers;
+      size_t used = 0;
+    };
+
+    vk::Device m_device;
+    JobSystem& m_jobs;
+    Tracker& m_tracker;
+
+    // [frame][worker]
+    std::vector<std::vector<WorkerPool>> m_frames;
+    int m_currentFrame = 0;
+
+    vk::CommandBuffer NextBuffer(WorkerPool& worker);
+
+    void RecordSecondaries(CommandBuffer& primary, Pipeline& p, const vk::CommandBufferInheritanceInfo& inheritance, int numTasks, std::function<void(CommandBuffer&, int)>& func);
+
+  public:
+    ParallelRecorder(vk::Device device, JobSystem& jobs, Tracker& tracker, uint32_t queueFamily, uint32_t numFrames);
+
+    // Resets the pools of this frame slot, the GPU must be done with it
+    void NewFrame(int frameIndex);
+
+    // Begins p's render pass on primary, records numTasks secondary buffers in parallel and executes them.
+    // func gets a command buffer with p already bound and the index of the task.
+    void Record(
+      CommandBuffer& primary,
+      Pipeline& p,
+      vk::Framebuffer& frameBuffer,
+      glm::uvec2 extent,
+      glm::vec4 clearColor,
+      glm::ivec2 offset,
+      int numTasks,
+      std::function<void(CommandBuffer&, int)> func);
+
+    // Same for a dynamic rendering pipeline, renderTargets as for CommandBuffer::BeginRendering(p, ...)
+    void Record(
+      CommandBuffer& primary,
+      Pipeline& p,
+      const std::vector<vk::ImageView>& renderTargets,
+      glm::uvec2 extent,
+      glm::vec4 clearColor,
+      glm::ivec2 offset,
+      int numTasks,
+      std::function<void(CommandBuffer&, int)> func);
+  };
+
+}
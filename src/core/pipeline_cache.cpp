@@ -0,0 +1,123 @@
+#include "pipeline_cache.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace BG;
+
+std::filesystem::path BG::PipelineCache::GetCacheDirectory()
+{
+  const char* dir = std::getenv("BG_CACHE_DIR");
+
+  if (dir != nullptr && dir[0] != '\0') return std::filesystem::path(dir);
+
+  return std::filesystem::path("bg_cache");
+}
+
+BG::PipelineCache::PipelineCache(vk::Device device, vk::PhysicalDevice physicalDevice)
+  : m_device(device)
+{
+  auto properties = physicalDevice.getProperties();
+
+  std::string uuid;
+  for (auto byte : properties.pipelineCacheUUID)
+  {
+    uuid += fmt::format("{:02x}", byte);
+  }
+
+  m_path = GetCacheDirectory() / fmt::format("pipelines_{:04x}_{:04x}_{:08x}_{}.bin", properties.vendorID, properties.deviceID, properties.driverVersion, uuid);
+
+  std::vector<uint8_t> data;
+
+  std::ifstream f(m_path, std::ios::binary);
+  if (f.is_open())
+  {
+    data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+
+    if (!ValidateHeader(data, properties))
+    {
+      spdlog::warn("Ignoring pipeline cache {}, header does not match the device", m_path.string());
+      data.clear();
+    }
+  }
+
+  vk::PipelineCacheCreateInfo info;
+  info.initialDataSize = data.size();
+  info.pInitialData = data.empty() ? nullptr : data.data();
+
+  m_cache = m_device.createPipelineCacheUnique(info);
+
+  m_warm = !data.empty();
+
+  spdlog::info("Pipeline cache: {} ({} bytes from {})", m_warm ? "warm start" : "cold start", data.size(), m_path.string());
+}
+
+BG::PipelineCache::~PipelineCache()
+{
+  Save();
+}
+
+bool BG::PipelineCache::ValidateHeader(const std::vector<uint8_t>& data, const vk::PhysicalDeviceProperties& properties)
+{
+  // VkPipelineCacheHeaderVersionOne
+  struct Header
+  {
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  } header;
+
+  if (data.size() < sizeof(Header)) return false;
+
+  std::memcpy(&header, data.data(), sizeof(Header));
+
+  return header.headerSize >= sizeof(Header) && header.headerSize <= data.size()
+    && header.headerVersion == uint32_t(vk::PipelineCacheHeaderVersion::eOne)
+    && header.vendorID == properties.vendorID
+    && header.deviceID == properties.deviceID
+    && std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+}
+
+void BG::PipelineCache::AddBuildTime(double ms)
+{
+  m_buildTimeUs += uint64_t(ms * 1000.0);
+  m_numBuilds++;
+}
+
+void BG::PipelineCache::Save()
+{
+  auto data = m_device.getPipelineCacheData(m_cache.get());
+
+  spdlog::info("Pipeline cache: {} pipelines built in {:.2f} ms ({} start)", m_numBuilds.load(), double(m_buildTimeUs.load()) * 1e-3, m_warm ? "warm" : "cold");
+
+  std::error_code ec;
+  std::filesystem::create_directories(m_path.parent_path(), ec);
+
+  // Write to a temporary file first, so a crash never leaves a truncated cache behind
+  auto tmpPath = m_path;
+  tmpPath += ".tmp";
+
+  {
+    std::ofstream f(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!f.is_open())
+    {
+      spdlog::error("Failed to open {} for the pipeline cache", tmpPath.string());
+      return;
+    }
+
+    f.write(reinterpret_cast<const char*>(data.data()), data.size());
+  }
+
+  std::filesystem::rename(tmpPath, m_path, ec);
+
+  if (ec)
+  {
+    spdlog::error("Failed to write pipeline cache {}: {}", m_path.string(), ec.message());
+    return;
+  }
+
+  spdlog::info("Saved {} bytes of pipeline cache to {}", data.size(), m_path.string());
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <filesystem>
+
+namespace BG
+{
+
+  // vk::PipelineCache shared by all pipelines of a renderer, persisted in the cache directory.
+  // The file name is keyed by vendor, device, driver version and pipeline cache UUID,
+  // and the data is only handed to the driver if its header matches the device.
+  class PipelineCache
+  {
+  private:
+    vk::Device m_device;
+    vk::UniquePipelineCache m_cache;
+
+    std::filesystem::path m_path;
+    bool m_warm = false;
+
+    std::atomic<uint64_t> m_buildTimeUs{ 0 };
+    std::atomic<uint32_t> m_numBuilds{ 0 };
+
+    bool ValidateHeader(const std::vector<uint8_t>& data, const vk::PhysicalDeviceProperties& properties);
+
+  public:
+    PipelineCache(vk::Device device, vk::PhysicalDevice physicalDevice);
+    ~PipelineCache();
+
+    inline vk::PipelineCache Get() { return m_cache.get(); }
+
+    // True when valid data from a previous run was loaded
+    inline bool IsWarm() { return m_warm; }
+
+    // Pipeline creation time accumulated for the cold / warm start report
+    void AddBuildTime(double ms);
+
+    void Save();
+
+    // $BG_CACHE_DIR, or bg_cache in the working directory
+    static std::filesystem::path GetCacheDirectory();
+  };
+
+}
@@ -0,0 +1,97 @@
+#include "pipeline_state_cache.hpp"
+#include "framebuffer_cache.hpp"
+#include "descriptor_allocator.hpp"
+
+size_t BG::PipelineStateCache::KeyHash::operator()(const Key& key) const
+{
+  uint64_t h = 0;
+  for (auto word : key) DescriptorAllocator::HashCombine(h, word);
+  return size_t(h);
+}
+
+std::shared_ptr<BG::PipelineObjects> BG::PipelineStateCache::Find(const Key& key)
+{
+  std::unique_lock<std::mutex> lk(m_mutex);
+
+  auto it = m_entries.find(key);
+  if (it != m_entries.end())
+  {
+    if (it->second.building.valid())
+    {
+      auto building = it->second.building;
+      lk.unlock();
+
+      auto objects = building.get().lock();
+      if (objects)
+      {
+        m_hits++;
+        return objects;
+      }
+
+      // The build failed or its pipelines are already gone, try again
+      return Find(key);
+    }
+
+    auto objects = it->second.objects.lock();
+    if (objects)
+    {
+      m_hits++;
+      return objects;
+    }
+  }
+
+  auto& entry = m_entries[key];
+  entry.objects.reset();
+  entry.promise = std::make_shared<std::promise<std::weak_ptr<PipelineObjects>>>();
+  entry.building = entry.promise->get_future().share();
+
+  m_misses++;
+  return nullptr;
+}
+
+void BG::PipelineStateCache::Add(const Key& key, std::shared_ptr<PipelineObjects> objects)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  // Drop entries whose pipelines are all gone
+  for (auto it = m_entries.begin(); it != m_entries.end();)
+  {
+    if (!it->second.building.valid() && it->second.objects.expired())
+      it = m_entries.erase(it);
+    else
+      it++;
+  }
+
+  auto& entry = m_entries[key];
+  entry.objects = objects;
+
+  if (entry.promise)
+  {
+    entry.promise->set_value(objects);
+    entry.promise = nullptr;
+    entry.building = {};
+  }
+
+  spdlog::debug("Pipeline state cache: {} pipelines, {} hits, {} misses", m_entries.size(), m_hits.load(), m_misses.load());
+}
+
+void BG::PipelineStateCache::Abandon(const Key& key)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto it = m_entries.find(key);
+  if (it == m_entries.end()) return;
+
+  if (it->second.promise) it->second.promise->set_value({});
+
+  m_entries.erase(it);
+}
+
+void BG::PipelineStateCache::Release(std::shared_ptr<PipelineObjects>& objects, FramebufferCache& framebufferCache)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  if (objects.use_count() == 1 && objects->renderpass) framebufferCache.InvalidateRenderPass(objects->renderpass.get());
+
+  objects.reset();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
+namespace BG
+{
+
+  // The Vulkan objects built by Pipeline::BuildPipeline, shared by every Pipeline with the same state
+  struct PipelineObjects
+  {
+    vk::UniqueDescriptorSetLayout descriptorSetLayout;
+    vk::UniquePipelineLayout      layout;
+    vk::UniqueRenderPass          renderpass;
+    vk::UniquePipeline            pipeline;
+    vk::UniqueDescriptorUpdateTemplate descUpdateTemplate;
+  };
+
+  // Deduplicates pipelines by their whole state (SPIR-V, vertex input, fixed function state,
+  // attachments, descriptor layout), serialized to words by Pipeline::GetStateKey. Entries are reference
+  // counted by the Pipelines using them: the objects are destroyed with the last one, the cache only keeps weak references.
+  // A miss reserves the key, so pipelines with the same state built concurrently wait for the first build.
+  class PipelineStateCache
+  {
+  public:
+    using Key = std::vector<uint64_t>;
+
+  private:
+    struct KeyHash
+    {
+      size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+      std::weak_ptr<PipelineObjects> objects;
+      // Set while the objects are being built, resolves to an empty reference if the build failed.
+      // Weak, so waiters don't count as users in Release
+      std::shared_ptr<std::promise<std::weak_ptr<PipelineObjects>>> promise;
+      std::shared_future<std::weak_ptr<PipelineObjects>> building;
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<Key, Entry, KeyHash> m_entries;
+
+    // Read without the lock by GetHits / GetMisses
+    std::atomic<uint32_t> m_hits{ 0 };
+    std::atomic<uint32_t> m_misses{ 0 };
+
+  public:
+    // Waits when the key is being built. nullptr on a miss: the key is now reserved,
+    // build the objects and Add them, or Abandon the key if the build fails
+    std::shared_ptr<PipelineObjects> Find(const Key& key);
+    void Add(const Key& key, std::shared_ptr<PipelineObjects> objects);
+    void Abandon(const Key& key);
+
+    // Drops a Pipeline's reference. The last user invalidates the render pass's framebuffers,
+    // under the lock so a concurrent Find can't pick the objects up in between.
+    void Release(std::shared_ptr<PipelineObjects>& objects, FramebufferCache& framebufferCache);
+
+    inline uint32_t GetHits() { return m_hits; }
+    inline uint32_t GetMisses() { return m_misses; }
+  };
+
+}
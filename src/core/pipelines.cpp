@@ -1,14 +1,35 @@
 #include "pipelines.hpp"
 #include "renderer.hpp"
 #include "buffer.hpp"
+#include "pipeline_cache.hpp"
+#include "descriptor_allocator.hpp"
+#include "framebuffer_cache.hpp"
+#include "pipeline_state_cache.hpp"
+#include "shader_cache.hpp"
 
 #include <glslang/Public/ShaderLang.h>
 #include <SPIRV/GlslangToSpv.h>
 
 #include <SPIRV-Reflect/spirv_reflect.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
 using namespace BG;
 
+// glslang keeps per-thread state, each thread compiling shaders holds a reference on the process
+struct GlslangThreadScope
+{
+  GlslangThreadScope() { glslang::InitializeProcess(); }
+  ~GlslangThreadScope() { glslang::FinalizeProcess(); }
+};
+
+static void InitGlslangThread()
+{
+  thread_local GlslangThreadScope scope;
+}
+
 std::vector<uint32_t> BuildSPIRV(glslang::TProgram& program, EShLanguage shaderType)
 {
   std::vector<unsigned int> spirv;
@@ -22,31 +43,61 @@ std::vector<uint32_t> BuildSPIRV(glslang::TProgram& program, EShLanguage shaderT
   return spirv;
 }
 
-void BindDescriptorReflection(Pipeline& p, int binding, SpvReflectDescriptorType type, vk::ShaderStageFlags stage, int arraySize = 1, bool unbounded = false)
+void BindDescriptorReflection(Pipeline& p, int binding, vk::DescriptorType type, vk::ShaderStageFlags stage, int arraySize = 1, bool unbounded = false)
 {
-  if (type == SPV_REFLECT_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+  if (type == vk::DescriptorType::eUniformBuffer)
   {
     spdlog::debug("Descriptor: binding = {}, Uniform Buffer", binding);
     p.AddDescriptorUniform(binding, stage, arraySize, unbounded);
   }
-  else if (type == SPV_REFLECT_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
+  else if (type == vk::DescriptorType::eCombinedImageSampler)
   {
     spdlog::debug("Descriptor: binding = {}, Texture / Combined Sampler", binding);
     p.AddDescriptorTexture(binding, stage, arraySize, unbounded);
   }
+  else if (type == vk::DescriptorType::eStorageBuffer)
+  {
+    spdlog::debug("Descriptor: binding = {}, Storage Buffer", binding);
+    p.AddDescriptorStorageBuffer(binding, stage, arraySize, unbounded);
+  }
+  else if (type == vk::DescriptorType::eStorageImage)
+  {
+    spdlog::debug("Descriptor: binding = {}, Storage Image", binding);
+    p.AddDescriptorStorageImage(binding, stage, arraySize, unbounded);
+  }
+  else if (type == vk::DescriptorType::eInputAttachment)
+  {
+    spdlog::debug("Descriptor: binding = {}, Input Attachment", binding);
+    p.AddDescriptorInputAttachment(binding, stage, arraySize);
+  }
 }
 
-std::vector<uint32_t> BG::Pipeline::BuildProgramFromSrc(std::string shaders, int _shaderType)
+// Everything besides the source that changes the SPIR-V, part of the shader cache key
+static const int ClientInputSemanticsVersion = 100;
+static const glslang::EShTargetClientVersion VulkanClientVersion = glslang::EShTargetVulkan_1_0;
+static const glslang::EShTargetLanguageVersion TargetVersion = glslang::EShTargetSpv_1_0;
+static const EShMessages CompileMessages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
+static const int DefaultVersion = 100;
+
+static std::string GetCompilerOptions()
+{
+  // A glslang update can change the SPIR-V for the same source
+  auto version = glslang::GetVersion();
+
+  return fmt::format("glslang={}.{}.{}{} input={} client={} target=spv{}.{} messages={} default={} validate=1",
+    version.major, version.minor, version.patch, version.flavor,
+    ClientInputSemanticsVersion, int(VulkanClientVersion), (int(TargetVersion) >> 16) & 0xff, (int(TargetVersion) >> 8) & 0xff,
+    int(CompileMessages), DefaultVersion);
+}
+
+static std::vector<uint32_t> CompileGLSL(const std::string& shaders, EShLanguage shaderType)
 {
-  EShLanguage shaderType = EShLanguage(_shaderType);
+  InitGlslangThread();
 
   const char* shaderCStr = shaders.c_str();
 
   glslang::TShader shader(shaderType);
   shader.setStrings(&shaderCStr, 1);
-  int ClientInputSemanticsVersion = 100;
-  glslang::EShTargetClientVersion VulkanClientVersion = glslang::EShTargetVulkan_1_0;
-  glslang::EShTargetLanguageVersion TargetVersion = glslang::EShTargetSpv_1_0;
 
   shader.setEnvInput(glslang::EShSourceGlsl, shaderType, glslang::EShClientVulkan, ClientInputSemanticsVersion);
   shader.setEnvClient(glslang::EShClientVulkan, VulkanClientVersion);
@@ -62,11 +113,7 @@ std::vector<uint32_t> BG::Pipeline::BuildProgramFromSrc(std::string shaders, int
   Resources.limits.generalVariableIndexing = true;
   Resources.limits.generalVaryingIndexing = true;
 
-  EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
-
-  const int DefaultVersion = 100;
-
-  if (!shader.parse(&Resources, DefaultVersion, false, messages))
+  if (!shader.parse(&Resources, DefaultVersion, false, CompileMessages))
   {
     spdlog::error("GLSL Parsing Failed\n{}{}", shader.getInfoLog(), shader.getInfoDebugLog());
     throw std::runtime_error("GLSL Parsing Error");
@@ -75,30 +122,41 @@ std::vector<uint32_t> BG::Pipeline::BuildProgramFromSrc(std::string shaders, int
   glslang::TProgram program;
   program.addShader(&shader);
 
-  if (!program.link(messages))
+  if (!program.link(CompileMessages))
   {
     spdlog::error("Link failed");
     throw std::runtime_error("GLSL Linking Error");
   }
   
-  auto spirv = BuildSPIRV(program, shaderType);
+  return BuildSPIRV(program, shaderType);
+}
+
+static ShaderReflection ReflectSPIRV(const std::vector<uint32_t>& spirv)
+{
+  ShaderReflection reflection;
 
   SpvReflectShaderModule module;
   SpvReflectResult result = spvReflectCreateShaderModule(spirv.size() * sizeof(uint32_t), spirv.data(), &module);
   assert(result == SPV_REFLECT_RESULT_SUCCESS);
 
-  vk::ShaderStageFlags stage;
-
   switch (module.shader_stage)
   {
   case (SPV_REFLECT_SHADER_STAGE_FRAGMENT_BIT):
-    stage = vk::ShaderStageFlagBits::eFragment;
+    reflection.stage = vk::ShaderStageFlagBits::eFragment;
     break;
   case (SPV_REFLECT_SHADER_STAGE_VERTEX_BIT):
-    stage = vk::ShaderStageFlagBits::eVertex;
+    reflection.stage = vk::ShaderStageFlagBits::eVertex;
+    break;
+  case (SPV_REFLECT_SHADER_STAGE_COMPUTE_BIT):
+    reflection.stage = vk::ShaderStageFlagBits::eCompute;
+    if (module.entry_point_count > 0)
+    {
+      auto& localSize = module.entry_points[0].local_size;
+      reflection.workgroupSize = glm::uvec3(localSize.x, localSize.y, localSize.z);
+    }
     break;
   default:
-    stage = vk::ShaderStageFlagBits::eAll;
+    reflection.stage = vk::ShaderStageFlagBits::eAll;
     break;
   }
 
@@ -106,79 +164,145 @@ std::vector<uint32_t> BG::Pipeline::BuildProgramFromSrc(std::string shaders, int
   {
     SpvReflectDescriptorBinding& binding = module.descriptor_bindings[i];
 
-    bool unbounded = binding.type_description->op == SpvOpTypeRuntimeArray;
-
-    if (std::string(binding.name) != "")
+    // Higher sets are provided through SetDescriptorSetLayout
+    if (binding.set != 0)
     {
-      spdlog::debug("Descriptor name {}, unbounded={}", binding.name, unbounded);
-      this->m_name2bindings[binding.name] = binding.binding;
+      spdlog::debug("Descriptor set {} binding {} is external", binding.set, binding.binding);
+      continue;
     }
 
-    if (binding.block.members != nullptr)
+    ShaderReflection::Descriptor descriptor;
+    descriptor.name = binding.name;
+    descriptor.binding = binding.binding;
+    descriptor.type = vk::DescriptorType(binding.descriptor_type);
+    descriptor.unbounded = binding.type_description->op == SpvOpTypeRuntimeArray;
+    descriptor.isBlock = binding.block.members != nullptr;
+    descriptor.blockSize = binding.block.padded_size;
+
+    if (descriptor.isBlock)
     {
       for (uint32_t j = 0; j < binding.block.member_count; j++)
       {
-        auto& member = binding.block.members[j];
-
-        spdlog::debug("Member variable name {}, offset {}", member.name, member.absolute_offset);
-        this->m_name2bindings[member.name] = binding.binding;
-        this->m_memberOffsets[member.name] = member.absolute_offset;
+        descriptor.members.push_back({ binding.block.members[j].name, binding.block.members[j].absolute_offset });
       }
-    
-      this->m_uniformBlockSize[binding.name] = binding.block.padded_size;
-      spdlog::debug("Block size {}", binding.block.padded_size);
     }
 
-    BindDescriptorReflection(*this, binding.binding, binding.descriptor_type, stage, 1, unbounded);
+    reflection.descriptors.push_back(descriptor);
   }
 
   for (uint32_t i = 0; i < module.push_constant_block_count; i++)
   {
-    auto& pushConstant = module.push_constant_blocks[i];
+    auto& block = module.push_constant_blocks[i];
 
-    this->AddPushConstant(pushConstant.absolute_offset, pushConstant.padded_size, stage);
-  
-    spdlog::debug("Push constant {}, offset={}, size={}", i, pushConstant.absolute_offset, pushConstant.padded_size);
+    ShaderReflection::PushConstant pushConstant;
+    pushConstant.offset = block.absolute_offset;
+    pushConstant.size = block.padded_size;
 
-    for (uint32_t j = 0; j < pushConstant.member_count; j++)
+    for (uint32_t j = 0; j < block.member_count; j++)
     {
-      auto& member = pushConstant.members[j];
-
-      spdlog::debug("Member variable name {}, offset {}", member.name, member.absolute_offset);
-      this->m_memberOffsets[member.name] = member.absolute_offset;
+      pushConstant.members.push_back({ block.members[j].name, block.members[j].absolute_offset });
     }
+
+    reflection.pushConstants.push_back(pushConstant);
   }
 
   spvReflectDestroyShaderModule(&module);
 
-  return spirv;
+  return reflection;
 }
 
-vk::UniqueShaderModule BG::Pipeline::AddShaders(std::string shaders, int shaderType)
+void BG::Pipeline::ApplyReflection(const ShaderReflection& reflection)
 {
-  std::vector<uint32_t> spirv = BuildProgramFromSrc(shaders, shaderType);
+  vk::ShaderStageFlags stage = reflection.stage;
 
-  auto shaderModule = m_device.createShaderModuleUnique({ {}, spirv });
+  if (stage == vk::ShaderStageFlagBits::eCompute)
+  {
+    m_workgroupSize = reflection.workgroupSize;
+    spdlog::debug("Workgroup size {}x{}x{}", m_workgroupSize.x, m_workgroupSize.y, m_workgroupSize.z);
+  }
 
-  return shaderModule;
+  for (auto& binding : reflection.descriptors)
+  {
+    if (binding.name != "")
+    {
+      spdlog::debug("Descriptor name {}, unbounded={}", binding.name, binding.unbounded);
+      this->m_name2bindings[binding.name] = binding.binding;
+    }
+
+    if (binding.isBlock)
+    {
+      for (auto& member : binding.members)
+      {
+        spdlog::debug("Member variable name {}, offset {}", member.name, member.offset);
+        this->m_name2bindings[member.name] = binding.binding;
+        this->m_memberOffsets[member.name] = member.offset;
+      }
+    
+      this->m_uniformBlockSize[binding.name] = binding.blockSize;
+      spdlog::debug("Block size {}", binding.blockSize);
+    }
+
+    BindDescriptorReflection(*this, binding.binding, binding.type, stage, 1, binding.unbounded);
+  }
+
+  for (size_t i = 0; i < reflection.pushConstants.size(); i++)
+  {
+    auto& pushConstant = reflection.pushConstants[i];
+
+    this->AddPushConstant(pushConstant.offset, pushConstant.size, stage);
+  
+    spdlog::debug("Push constant {}, offset={}, size={}", i, pushConstant.offset, pushConstant.size);
+
+    for (auto& member : pushConstant.members)
+    {
+      spdlog::debug("Member variable name {}, offset {}", member.name, member.offset);
+      this->m_memberOffsets[member.name] = member.offset;
+    }
+  }
 }
 
-void BG::Pipeline::AddFragmentShaders(std::string shaders)
+std::vector<uint32_t> BG::Pipeline::BuildProgramFromSrc(std::string shaders, int shaderType)
 {
-  auto shader = AddShaders(shaders, EShLangFragment);
+  ShaderCache& cache = r.getShaderCache();
+  auto key = ShaderCache::MakeKey(shaders, shaderType, GetCompilerOptions());
+
+  // A cache hit skips glslang and SPIRV-Reflect
+  ShaderCache::Entry entry;
+  if (!cache.Load(key, entry))
+  {
+    entry.spirv = CompileGLSL(shaders, EShLanguage(shaderType));
+    entry.reflection = ReflectSPIRV(entry.spirv);
+    cache.Store(key, entry);
+  }
 
-  m_stageCreateInfos.push_back(vk::PipelineShaderStageCreateInfo{ {}, vk::ShaderStageFlagBits::eFragment, shader.get(), "main" });
+  ApplyReflection(entry.reflection);
 
-  m_shaderModules.push_back(std::move(shader));
+  return entry.spirv;
 }
 
-void BG::Pipeline::AddVertexShaders(std::string shaders)
+void BG::Pipeline::AddShaders(std::string shaders, int shaderType, vk::ShaderStageFlagBits stage, bool deferCompile)
 {
-  auto shader = AddShaders(shaders, EShLangVertex);
+  if (deferCompile)
+    m_pendingShaders.push_back({ shaders, shaderType, stage });
+  else
+    m_shaderStages.push_back({ stage, BuildProgramFromSrc(shaders, shaderType) });
+}
 
-  m_stageCreateInfos.push_back(vk::PipelineShaderStageCreateInfo{ {}, vk::ShaderStageFlagBits::eVertex, shader.get(), "main" });
+void BG::Pipeline::AddFragmentShaders(std::string shaders, bool deferCompile)
+{
+  AddShaders(shaders, EShLangFragment, vk::ShaderStageFlagBits::eFragment, deferCompile);
+}
 
-  m_shaderModules.push_back(std::move(shader));
+void BG::Pipeline::AddVertexShaders(std::string shaders, bool deferCompile)
+{
+  AddShaders(shaders, EShLangVertex, vk::ShaderStageFlagBits::eVertex, deferCompile);
+}
+
+void BG::Pipeline::AddComputeShaders(std::string shaders, bool deferCompile)
+{
+  AddShaders(shaders, EShLangCompute, vk::ShaderStageFlagBits::eCompute, deferCompile);
+
+  m_isCompute = true;
 }
 
 void BG::Pipeline::AddAttribute(VertexBufferBinding binding, int location, vk::Format format, size_t offset)
@@ -220,6 +344,32 @@ void BG::Pipeline::AddDescriptorUniform(int binding, vk::ShaderStageFlags stage,
     m_descSetLayoutBindingFlags.push_back(vk::DescriptorBindingFlagBits(0));
 }
 
+void BG::Pipeline::SetDynamicUniform(int binding)
+{
+  // Deferred shaders are only reflected in BuildPipeline
+  m_dynamicUniforms.push_back(binding);
+}
+
+void BG::Pipeline::ApplyDynamicUniforms()
+{
+  for (int binding : m_dynamicUniforms)
+  {
+    auto it = std::find_if(m_descSetLayoutBindings.begin(), m_descSetLayoutBindings.end(), [&](const vk::DescriptorSetLayoutBinding& b) {
+      return b.binding == uint32_t(binding) && b.descriptorType == vk::DescriptorType::eUniformBuffer;
+    });
+
+    if (it == m_descSetLayoutBindings.end())
+    {
+      spdlog::error("Binding {} is not a uniform buffer", binding);
+      throw std::runtime_error("Dynamic uniform on a binding that is not a uniform buffer");
+    }
+
+    it->descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+  }
+
+  m_dynamicUniforms.clear();
+}
+
 void BG::Pipeline::AddDescriptorTexture(int binding, vk::ShaderStageFlags stage, int count, bool unbounded)
 {
   vk::DescriptorSetLayoutBinding layoutBinding;
@@ -236,6 +386,51 @@ void BG::Pipeline::AddDescriptorTexture(int binding, vk::ShaderStageFlags stage,
     m_descSetLayoutBindingFlags.push_back(vk::DescriptorBindingFlagBits(0));
 }
 
+void BG::Pipeline::AddDescriptorStorageBuffer(int binding, vk::ShaderStageFlags stage, int count, bool unbounded)
+{
+  vk::DescriptorSetLayoutBinding layoutBinding;
+  layoutBinding.binding = binding;
+  layoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  layoutBinding.descriptorCount = count;
+  layoutBinding.stageFlags = stage;
+  layoutBinding.pImmutableSamplers = nullptr;
+
+  m_descSetLayoutBindings.push_back(layoutBinding);
+  if (unbounded)
+    m_descSetLayoutBindingFlags.push_back(vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eVariableDescriptorCount);
+  else
+    m_descSetLayoutBindingFlags.push_back(vk::DescriptorBindingFlagBits(0));
+}
+
+void BG::Pipeline::AddDescriptorInputAttachment(int binding, vk::ShaderStageFlags stage, int count)
+{
+  vk::DescriptorSetLayoutBinding layoutBinding;
+  layoutBinding.binding = binding;
+  layoutBinding.descriptorType = vk::DescriptorType::eInputAttachment;
+  layoutBinding.descriptorCount = count;
+  layoutBinding.stageFlags = stage;
+  layoutBinding.pImmutableSamplers = nullptr;
+
+  m_descSetLayoutBindings.push_back(layoutBinding);
+  m_descSetLayoutBindingFlags.push_back(vk::DescriptorBindingFlagBits(0));
+}
+
+void BG::Pipeline::AddDescriptorStorageImage(int binding, vk::ShaderStageFlags stage, int count, bool unbounded)
+{
+  vk::DescriptorSetLayoutBinding layoutBinding;
+  layoutBinding.binding = binding;
+  layoutBinding.descriptorType = vk::DescriptorType::eStorageImage;
+  layoutBinding.descriptorCount = unbounded ? 4096 : count;
+  layoutBinding.stageFlags = stage;
+  layoutBinding.pImmutableSamplers = nullptr;
+
+  m_descSetLayoutBindings.push_back(layoutBinding);
+  if (unbounded)
+    m_descSetLayoutBindingFlags.push_back(vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eVariableDescriptorCount);
+  else
+    m_descSetLayoutBindingFlags.push_back(vk::DescriptorBindingFlagBits(0));
+}
+
 void BG::Pipeline::SetViewport(float width, float height, float x, float y, float minDepth, float maxDepth)
 {
   m_viewport.x = x;
@@ -294,8 +489,119 @@ void BG::Pipeline::AddDepthAttachment(vk::ImageLayout initialLayout, vk::ImageLa
   m_useDepthAttachment = true;
 }
 
+std::vector<uint64_t> BG::Pipeline::GetStateKey()
+{
+  std::vector<uint64_t> key;
+  auto add = [&](uint64_t v) { key.push_back(v); };
+  auto addFloat = [&](float v) { uint32_t bits; memcpy(&bits, &v, sizeof(bits)); add(bits); };
+
+  for (auto& shaderStage : m_shaderStages)
+  {
+    add(uint64_t(shaderStage.stage));
+    add(shaderStage.spirv.size());
+    for (auto word : shaderStage.spirv) add(word);
+  }
+
+  for (auto& binding : m_bindingDescriptions)
+  {
+    add(binding.binding); add(binding.stride); add(uint64_t(binding.inputRate));
+  }
+
+  for (auto& attribute : m_attributeDescriptions)
+  {
+    add(attribute.location); add(attribute.binding); add(uint64_t(attribute.format)); add(attribute.offset);
+  }
+
+  add(uint64_t(m_inputAssemblyInfo.topology));
+  add(m_inputAssemblyInfo.primitiveRestartEnable);
+
+  addFloat(m_viewport.x); addFloat(m_viewport.y); addFloat(m_viewport.width); addFloat(m_viewport.height);
+  addFloat(m_viewport.minDepth); addFloat(m_viewport.maxDepth);
+  add(uint64_t(int64_t(m_scissor.offset.x))); add(uint64_t(int64_t(m_scissor.offset.y)));
+  add(m_scissor.extent.width); add(m_scissor.extent.height);
+
+  add(m_rasterizer.depthClampEnable); add(m_rasterizer.rasterizerDiscardEnable);
+  add(uint64_t(m_rasterizer.polygonMode)); add(uint32_t(m_rasterizer.cullMode)); add(uint64_t(m_rasterizer.frontFace));
+  add(m_rasterizer.depthBiasEnable); addFloat(m_rasterizer.lineWidth);
+  add(uint64_t(m_multisampling.rasterizationSamples)); add(m_multisampling.sampleShadingEnable);
+
+  // Attachments (blend and depth state follow from them)
+  auto addAttachment = [&](const vk::AttachmentDescription& a) {
+    add(uint64_t(a.format)); add(uint64_t(a.samples));
+    add(uint64_t(a.loadOp)); add(uint64_t(a.storeOp)); add(uint64_t(a.stencilLoadOp)); add(uint64_t(a.stencilStoreOp));
+    add(uint64_t(a.initialLayout)); add(uint64_t(a.finalLayout));
+  };
+
+  add(m_attachments.size());
+  for (auto& attachment : m_attachments) addAttachment(attachment);
+  add(m_useDepthAttachment);
+  if (m_useDepthAttachment) addAttachment(m_depthAttachment);
+
+  for (size_t i = 0; i < m_descSetLayoutBindings.size(); i++)
+  {
+    auto& binding = m_descSetLayoutBindings[i];
+    add(binding.binding); add(uint64_t(binding.descriptorType)); add(binding.descriptorCount);
+    add(uint32_t(binding.stageFlags)); add(uint32_t(m_descSetLayoutBindingFlags[i]));
+  }
+
+  for (auto& range : m_pushConstants)
+  {
+    add(uint32_t(range.stageFlags)); add(range.offset); add(range.size);
+  }
+
+  for (auto& external : m_externalSetLayouts)
+  {
+    add(external.first); add(uint64_t(VkDescriptorSetLayout(external.second)));
+  }
+
+  add(m_isCompute); add(m_usePushDescriptors); add(m_useDynamicRendering); add(m_useDynamicViewport);
+  add(uint64_t(VkRenderPass(m_externalRenderPass))); add(m_subpass);
+
+  return key;
+}
+
 void BG::Pipeline::BuildPipeline()
 {
+  for (auto& pending : m_pendingShaders)
+  {
+    m_shaderStages.push_back({ pending.stage, BuildProgramFromSrc(pending.source, pending.shaderType) });
+  }
+  m_pendingShaders.clear();
+
+  ApplyDynamicUniforms();
+
+  auto stateKey = GetStateKey();
+
+  m_objects = r.getPipelineStateCache().Find(stateKey);
+
+  if (m_objects)
+  {
+    // A live pipeline has the same state, only this Pipeline's template offsets are missing
+    BuildDescriptorUpdateTemplate();
+    m_created = true;
+    return;
+  }
+
+  try
+  {
+    BuildObjects();
+  }
+  catch (...)
+  {
+    // Pipelines waiting for this state build it themselves
+    r.getPipelineStateCache().Abandon(stateKey);
+    throw;
+  }
+
+  r.getPipelineStateCache().Add(stateKey, m_objects);
+
+  m_created = true;
+}
+
+void BG::Pipeline::BuildObjects()
+{
+  m_objects = std::make_shared<PipelineObjects>();
+
   vk::DescriptorSetLayoutCreateInfo layoutInfo;
   vk::DescriptorSetLayoutBindingFlagsCreateInfo layoutFlagsInfo;
   layoutFlagsInfo.setBindingCount(m_descSetLayoutBindings.size());
@@ -306,15 +612,90 @@ void BG::Pipeline::BuildPipeline()
     layoutInfo.setPNext(&layoutFlagsInfo);
   }
 
-  m_descriptorSetLayout = m_device.createDescriptorSetLayoutUnique(layoutInfo);
+  if (m_usePushDescriptors)
+  {
+    for (auto flags : m_descSetLayoutBindingFlags)
+    {
+      if (flags & vk::DescriptorBindingFlagBits::eVariableDescriptorCount)
+      {
+        spdlog::error("Push descriptor sets can't have variable sized arrays");
+        throw std::runtime_error("Variable sized array in push descriptor set");
+      }
+    }
+
+    for (auto& layoutBinding : m_descSetLayoutBindings)
+    {
+      if (layoutBinding.descriptorType == vk::DescriptorType::eUniformBufferDynamic)
+      {
+        spdlog::error("Push descriptor sets can't have dynamic uniform buffers (binding {})", layoutBinding.binding);
+        throw std::runtime_error("Dynamic uniform buffer in push descriptor set");
+      }
+    }
+
+    layoutInfo.flags |= vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR;
+  }
+
+  m_objects->descriptorSetLayout = m_device.createDescriptorSetLayoutUnique(layoutInfo);
+
+  std::vector<vk::DescriptorSetLayout> setLayouts = { m_objects->descriptorSetLayout.get() };
+
+  for (auto& external : m_externalSetLayouts)
+  {
+    if (external.first != setLayouts.size())
+    {
+      spdlog::error("Descriptor set {} has no layout", setLayouts.size());
+      throw std::runtime_error("Descriptor set layouts are not contiguous");
+    }
+
+    setLayouts.push_back(external.second);
+  }
 
   vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout.get();
+  pipelineLayoutInfo.setSetLayouts(setLayouts);
   pipelineLayoutInfo.setPushConstantRanges(m_pushConstants);
 
-  m_layout = m_device.createPipelineLayoutUnique(pipelineLayoutInfo);
+  m_objects->layout = m_device.createPipelineLayoutUnique(pipelineLayoutInfo);
+
+  BuildDescriptorUpdateTemplate();
+
+  std::vector<vk::UniqueShaderModule> shaderModules;
+  std::vector<vk::PipelineShaderStageCreateInfo> stages;
+
+  for (auto& shaderStage : m_shaderStages)
+  {
+    shaderModules.push_back(m_device.createShaderModuleUnique({ {}, shaderStage.spirv }));
+    stages.push_back(vk::PipelineShaderStageCreateInfo{ {}, shaderStage.stage, shaderModules.back().get(), "main" });
+  }
+
+  if (m_isCompute)
+    BuildComputePipeline(stages);
+  else
+    BuildGraphicsPipeline(stages);
+}
+
+std::shared_future<void> BG::Pipeline::BuildPipelineAsync()
+{
+  auto promise = std::make_shared<std::promise<void>>();
+  m_buildFuture = promise->get_future().share();
+
+  r.getCompileJobSystem().Submit([this, promise](int worker) {
+    try
+    {
+      BuildPipeline();
+      promise->set_value();
+    }
+    catch (const std::exception& e)
+    {
+      spdlog::error("Async pipeline build failed: {}", e.what());
+      promise->set_exception(std::current_exception());
+    }
+  });
+
+  return m_buildFuture;
+}
 
+void BG::Pipeline::BuildGraphicsPipeline(const std::vector<vk::PipelineShaderStageCreateInfo>& stages)
+{
   std::vector<vk::AttachmentReference> attachments;
 
   uint32_t attachmentCount;
@@ -338,17 +719,18 @@ void BG::Pipeline::BuildPipeline()
   if (m_useDepthAttachment) mainSubpass.setPDepthStencilAttachment(&depthAttachmentRef);
   subpass.push_back(mainSubpass);
 
-  if (m_useDepthAttachment)
-  {
-    std::vector<vk::AttachmentDescription> allAttachements;
-    allAttachements = m_attachments;
-    allAttachements.push_back(m_depthAttachment);
+  // Dynamic rendering pipelines only know the formats
+  std::vector<vk::Format> colorFormats = GetColorFormats();
+  vk::PipelineRenderingCreateInfoKHR renderingInfo;
+  renderingInfo.setColorAttachmentFormats(colorFormats);
+  renderingInfo.depthAttachmentFormat = GetDepthFormat();
 
-    m_renderpass = m_device.createRenderPassUnique({ {}, allAttachements, subpass });
-  }
-  else
+  if (!m_useDynamicRendering && !m_externalRenderPass)
   {
-    m_renderpass = m_device.createRenderPassUnique({ {}, m_attachments, subpass });
+    std::vector<vk::AttachmentDescription> allAttachements = m_attachments;
+    if (m_useDepthAttachment) allAttachements.push_back(m_depthAttachment);
+
+    m_objects->renderpass = m_device.createRenderPassUnique({ {}, allAttachements, subpass });
   }
 
   std::vector<vk::PipelineColorBlendAttachmentState> colorBlendAttachments;
@@ -380,7 +762,7 @@ void BG::Pipeline::BuildPipeline()
   }
 
   vk::GraphicsPipelineCreateInfo pipelineInfo;
-  pipelineInfo.setStages(m_stageCreateInfos);
+  pipelineInfo.setStages(stages);
   pipelineInfo.pVertexInputState = &m_vertexInputInfo;
   pipelineInfo.pInputAssemblyState = &m_inputAssemblyInfo;
   pipelineInfo.pViewportState = &m_viewportInfo;
@@ -388,18 +770,227 @@ void BG::Pipeline::BuildPipeline()
   pipelineInfo.pMultisampleState = &m_multisampling;
   pipelineInfo.pDepthStencilState = m_useDepthAttachment ? &depthStencilState : nullptr;
   pipelineInfo.pColorBlendState = &blendInfo;
-  pipelineInfo.pDynamicState = nullptr;
-  pipelineInfo.layout = m_layout.get();
-  pipelineInfo.renderPass = m_renderpass.get();
-  pipelineInfo.subpass = 0;
+  std::vector<vk::DynamicState> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+  vk::PipelineDynamicStateCreateInfo dynamicStateInfo;
+  dynamicStateInfo.setDynamicStates(dynamicStates);
+
+  pipelineInfo.pDynamicState = m_useDynamicViewport ? &dynamicStateInfo : nullptr;
+  pipelineInfo.layout = m_objects->layout.get();
+  pipelineInfo.renderPass = m_externalRenderPass ? m_externalRenderPass : m_objects->renderpass.get();
+  pipelineInfo.subpass = m_subpass;
+  if (m_useDynamicRendering) pipelineInfo.pNext = &renderingInfo;
   
-  auto result = m_device.createGraphicsPipelineUnique(nullptr, pipelineInfo, nullptr);
+  auto buildStart = std::chrono::steady_clock::now();
+
+  auto result = m_device.createGraphicsPipelineUnique(r.getPipelineCache().Get(), pipelineInfo, nullptr);
 
   if (result.result != vk::Result::eSuccess) throw std::runtime_error("Create pipeline failed");
 
-  m_pipeline = std::move(result.value);
+  r.getPipelineCache().AddBuildTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
 
-  m_created = true;
+  m_objects->pipeline = std::move(result.value);
+}
+
+void BG::Pipeline::BuildComputePipeline(const std::vector<vk::PipelineShaderStageCreateInfo>& stages)
+{
+  if (stages.size() != 1)
+  {
+    spdlog::error("A compute pipeline takes exactly one compute shader, got {} stages", stages.size());
+    throw std::runtime_error("Invalid compute pipeline");
+  }
+
+  vk::ComputePipelineCreateInfo pipelineInfo;
+  pipelineInfo.stage = stages[0];
+  pipelineInfo.layout = m_objects->layout.get();
+
+  auto buildStart = std::chrono::steady_clock::now();
+
+  auto result = m_device.createComputePipelineUnique(r.getPipelineCache().Get(), pipelineInfo, nullptr);
+
+  if (result.result != vk::Result::eSuccess) throw std::runtime_error("Create compute pipeline failed");
+
+  r.getPipelineCache().AddBuildTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
+
+  m_objects->pipeline = std::move(result.value);
+}
+
+void BG::Pipeline::BuildDescriptorUpdateTemplate()
+{
+  std::vector<size_t> order;
+  for (size_t i = 0; i < m_descSetLayoutBindings.size(); i++)
+  {
+    // Variable sized arrays have no fixed place in the packed data
+    if (m_descSetLayoutBindingFlags[i] & vk::DescriptorBindingFlagBits::eVariableDescriptorCount) continue;
+    order.push_back(i);
+  }
+
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return m_descSetLayoutBindings[a].binding < m_descSetLayoutBindings[b].binding; });
+
+  std::vector<vk::DescriptorUpdateTemplateEntry> entries;
+  uint32_t offset = 0;
+
+  for (auto i : order)
+  {
+    auto& layoutBinding = m_descSetLayoutBindings[i];
+
+    uint32_t stride;
+    switch (layoutBinding.descriptorType)
+    {
+    case vk::DescriptorType::eUniformBuffer:
+    case vk::DescriptorType::eStorageBuffer:
+    case vk::DescriptorType::eUniformBufferDynamic:
+    case vk::DescriptorType::eStorageBufferDynamic:
+      stride = sizeof(vk::DescriptorBufferInfo);
+      break;
+    case vk::DescriptorType::eUniformTexelBuffer:
+    case vk::DescriptorType::eStorageTexelBuffer:
+      stride = sizeof(vk::BufferView);
+      break;
+    default:
+      stride = sizeof(vk::DescriptorImageInfo);
+      break;
+    }
+
+    vk::DescriptorUpdateTemplateEntry entry;
+    entry.dstBinding = layoutBinding.binding;
+    entry.dstArrayElement = 0;
+    entry.descriptorCount = layoutBinding.descriptorCount;
+    entry.descriptorType = layoutBinding.descriptorType;
+    entry.offset = offset;
+    entry.stride = stride;
+
+    entries.push_back(entry);
+    m_templateBindings[layoutBinding.binding] = { offset, stride, layoutBinding.descriptorCount };
+
+    offset += stride * layoutBinding.descriptorCount;
+  }
+
+  m_templateDataSize = offset;
+
+  // Already there when the objects came from the pipeline state cache
+  if (entries.empty() || m_objects->descUpdateTemplate) return;
+
+  vk::DescriptorUpdateTemplateCreateInfo templateInfo;
+  templateInfo.setDescriptorUpdateEntries(entries);
+  templateInfo.templateType = m_usePushDescriptors ? vk::DescriptorUpdateTemplateType::ePushDescriptorsKHR : vk::DescriptorUpdateTemplateType::eDescriptorSet;
+  templateInfo.descriptorSetLayout = m_objects->descriptorSetLayout.get();
+  templateInfo.pipelineBindPoint = GetBindPoint();
+  templateInfo.pipelineLayout = m_objects->layout.get();
+  templateInfo.set = 0;
+
+  m_objects->descUpdateTemplate = m_device.createDescriptorUpdateTemplateUnique(templateInfo);
+}
+
+uint32_t BG::Pipeline::GetTemplateOffset(int binding, int arrayElement)
+{
+  auto it = m_templateBindings.find(uint32_t(binding));
+
+  if (it == m_templateBindings.end() || uint32_t(arrayElement) >= it->second.count)
+  {
+    spdlog::error("Binding {}[{}] is not part of the descriptor update template", binding, arrayElement);
+    throw std::runtime_error("Binding not in descriptor update template");
+  }
+
+  return it->second.offset + it->second.stride * uint32_t(arrayElement);
+}
+
+void BG::Pipeline::UseDynamicViewport()
+{
+  m_useDynamicViewport = true;
+
+  // The counts still come from the pipeline, the values are ignored
+  m_viewportInfo.viewportCount = 1;
+  m_viewportInfo.pViewports = &m_viewport;
+  m_viewportInfo.scissorCount = 1;
+  m_viewportInfo.pScissors = &m_scissor;
+}
+
+void BG::Pipeline::SetRenderPass(vk::RenderPass renderPass, uint32_t subpass)
+{
+  m_externalRenderPass = renderPass;
+  m_subpass = subpass;
+}
+
+bool BG::Pipeline::UseDynamicRendering()
+{
+  m_useDynamicRendering = r.m_hasDynamicRendering;
+  return m_useDynamicRendering;
+}
+
+std::vector<vk::Format> BG::Pipeline::GetColorFormats()
+{
+  std::vector<vk::Format> formats;
+  for (auto& attachment : m_attachments) formats.push_back(attachment.format);
+  return formats;
+}
+
+vk::Format BG::Pipeline::GetDepthFormat()
+{
+  return m_useDepthAttachment ? m_depthAttachment.format : vk::Format::eUndefined;
+}
+
+std::vector<vk::AttachmentLoadOp> BG::Pipeline::GetLoadOps()
+{
+  std::vector<vk::AttachmentLoadOp> loadOps;
+  for (auto& attachment : m_attachments) loadOps.push_back(attachment.loadOp);
+  if (m_useDepthAttachment) loadOps.push_back(m_depthAttachment.loadOp);
+  return loadOps;
+}
+
+bool BG::Pipeline::UsePushDescriptors()
+{
+  m_usePushDescriptors = r.m_hasPushDescriptor;
+  return m_usePushDescriptors;
+}
+
+void BG::Pipeline::PushDescriptorSet(vk::CommandBuffer buf, const std::vector<vk::WriteDescriptorSet>& descSetWrites)
+{
+  if (!m_usePushDescriptors)
+  {
+    spdlog::error("Pipeline does not use push descriptors");
+    throw std::runtime_error("Pipeline does not use push descriptors");
+  }
+
+  buf.pushDescriptorSetKHR(GetBindPoint(), GetLayout(), 0, descSetWrites, r.getDispatcher());
+}
+
+void BG::Pipeline::PushDescriptorSetWithTemplate(vk::CommandBuffer buf, const void* data)
+{
+  if (!m_usePushDescriptors || !m_created || !m_objects->descUpdateTemplate)
+  {
+    spdlog::error("Pipeline has no push descriptor update template");
+    throw std::runtime_error("Pipeline has no push descriptor update template");
+  }
+
+  buf.pushDescriptorSetWithTemplateKHR(m_objects->descUpdateTemplate.get(), GetLayout(), 0, data, r.getDispatcher());
+}
+
+void BG::Pipeline::UpdateDescSetWithTemplate(vk::DescriptorSet descSet, const void* data)
+{
+  if (m_usePushDescriptors)
+  {
+    spdlog::error("Push descriptor pipelines push their template data, see PushDescriptorSetWithTemplate");
+    throw std::runtime_error("Push descriptor pipelines can't update sets");
+  }
+
+  if (!m_created || !m_objects->descUpdateTemplate)
+  {
+    spdlog::error("Pipeline has no descriptor update template");
+    throw std::runtime_error("Pipeline has no descriptor update template");
+  }
+
+  m_device.updateDescriptorSetWithTemplate(descSet, m_objects->descUpdateTemplate.get(), data);
+}
+
+void BG::Pipeline::SetDescriptorSetLayout(uint32_t set, vk::DescriptorSetLayout layout)
+{
+  if (set == 0)
+  {
+    spdlog::error("Set 0 is built from reflection");
+    throw std::runtime_error("Set 0 is built from reflection");
+  }
+
+  m_externalSetLayouts[set] = layout;
 }
 
 void BG::Pipeline::AddPushConstant(uint32_t offset, uint32_t size, vk::ShaderStageFlags stage)
@@ -412,8 +1003,19 @@ void BG::Pipeline::AddPushConstant(uint32_t offset, uint32_t size, vk::ShaderSta
   m_pushConstants.push_back(range);
 }
 
+void BG::Pipeline::CheckAllocatable()
+{
+  if (m_usePushDescriptors)
+  {
+    spdlog::error("Set 0 of a push descriptor pipeline is pushed, not allocated");
+    throw std::runtime_error("Allocating a push descriptor set");
+  }
+}
+
 vk::DescriptorSet Pipeline::AllocDescSet(vk::DescriptorPool pool, int variableDescriptorCount)
 {
+  CheckAllocatable();
+
   uint32_t vCount = variableDescriptorCount;
 
   vk::DescriptorSetVariableDescriptorCountAllocateInfoEXT variableCount;
@@ -423,13 +1025,27 @@ vk::DescriptorSet Pipeline::AllocDescSet(vk::DescriptorPool pool, int variableDe
   vk::DescriptorSetAllocateInfo allocInfo;
   allocInfo.descriptorPool = pool;
   allocInfo.descriptorSetCount = 1;
-  allocInfo.pSetLayouts = &m_descriptorSetLayout.get();
+  allocInfo.pSetLayouts = &m_objects->descriptorSetLayout.get();
 
   if (variableDescriptorCount != 0) allocInfo.pNext = &variableCount;
 
   return m_device.allocateDescriptorSets(allocInfo)[0];
 }
 
+vk::DescriptorSet Pipeline::AllocDescSet(DescriptorAllocator& allocator, int variableDescriptorCount)
+{
+  CheckAllocatable();
+
+  return allocator.Allocate(m_objects->descriptorSetLayout.get(), uint32_t(variableDescriptorCount));
+}
+
+vk::DescriptorSet Pipeline::AllocDescSetCached(DescriptorAllocator& allocator, const std::vector<uint64_t>& key, const std::function<void(vk::DescriptorSet)>& write, int variableDescriptorCount)
+{
+  CheckAllocatable();
+
+  return allocator.AllocateCached(m_objects->descriptorSetLayout.get(), key, write, uint32_t(variableDescriptorCount));
+}
+
 
 void BG::Pipeline::BindGraphicsUniformBuffer(Pipeline& p, vk::DescriptorSet descSet, const BG::Buffer& buffer, uint32_t offset, uint32_t range, int binding, int arrayElement)
 {
@@ -449,6 +1065,41 @@ void BG::Pipeline::BindGraphicsUniformBuffer(Pipeline& p, vk::DescriptorSet desc
   m_device.updateDescriptorSets(1, &descSetWrite, 0, nullptr);
 }
 
+void BG::Pipeline::BindStorageBuffer(Pipeline& p, vk::DescriptorSet descSet, const BG::Buffer& buffer, uint32_t offset, uint32_t range, int binding, int arrayElement)
+{
+  vk::DescriptorBufferInfo bufferInfo;
+  bufferInfo.buffer = buffer.buffer;
+  bufferInfo.offset = offset;
+  bufferInfo.range = range;
+
+  vk::WriteDescriptorSet descSetWrite;
+  descSetWrite.dstSet = descSet;
+  descSetWrite.dstBinding = binding;
+  descSetWrite.dstArrayElement = arrayElement;
+  descSetWrite.descriptorType = vk::DescriptorType::eStorageBuffer;
+  descSetWrite.descriptorCount = 1;
+  descSetWrite.pBufferInfo = &bufferInfo;
+
+  m_device.updateDescriptorSets(1, &descSetWrite, 0, nullptr);
+}
+
+void BG::Pipeline::BindStorageImage(Pipeline& p, vk::DescriptorSet descSet, vk::ImageView view, int binding, int arrayElement)
+{
+  vk::DescriptorImageInfo imageInfo;
+  imageInfo.imageLayout = vk::ImageLayout::eGeneral;
+  imageInfo.imageView = view;
+
+  vk::WriteDescriptorSet descSetWrite;
+  descSetWrite.dstSet = descSet;
+  descSetWrite.dstBinding = binding;
+  descSetWrite.dstArrayElement = arrayElement;
+  descSetWrite.descriptorType = vk::DescriptorType::eStorageImage;
+  descSetWrite.descriptorCount = 1;
+  descSetWrite.pImageInfo = &imageInfo;
+
+  m_device.updateDescriptorSets(1, &descSetWrite, 0, nullptr);
+}
+
 void BG::Pipeline::BindGraphicsImageView(Pipeline& p, vk::DescriptorSet descSet, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler, int binding, int arrayElement)
 {
   vk::DescriptorImageInfo imageInfo;
@@ -471,7 +1122,7 @@ vk::RenderPass Pipeline::GetRenderPass()
 {
   if (m_created)
   {
-    return m_renderpass.get();
+    return m_externalRenderPass ? m_externalRenderPass : m_objects->renderpass.get();
   }
   else
   {
@@ -484,7 +1135,7 @@ vk::Pipeline Pipeline::GetPipeline()
 {
   if (m_created)
   {
-    return m_pipeline.get();
+    return m_objects->pipeline.get();
   }
   else
   {
@@ -497,7 +1148,7 @@ vk::PipelineLayout Pipeline::GetLayout()
 {
   if (m_created)
   {
-    return m_layout.get();
+    return m_objects->layout.get();
   }
   else
   {
@@ -511,7 +1162,8 @@ void BG::Pipeline::BindRenderPass(
   vk::Framebuffer& frameBuffer,
   glm::uvec2 extent,
   glm::vec4 clearColor,
-  glm::ivec2 offset)
+  glm::ivec2 offset,
+  vk::SubpassContents contents)
 {
   if (!m_created)
   {
@@ -519,8 +1171,26 @@ void BG::Pipeline::BindRenderPass(
     throw std::runtime_error("Pipeline is not built");
   }
 
+  if (m_isCompute)
+  {
+    spdlog::error("Compute pipelines have no render pass");
+    throw std::runtime_error("Compute pipelines have no render pass");
+  }
+
+  if (m_useDynamicRendering)
+  {
+    spdlog::error("Dynamic rendering pipelines have no render pass, use CommandBuffer::BeginRendering");
+    throw std::runtime_error("Dynamic rendering pipelines have no render pass");
+  }
+
+  if (m_externalRenderPass)
+  {
+    spdlog::error("Pipeline is built for an external render pass, begin it with CommandBuffer::BeginRenderPass");
+    throw std::runtime_error("Pipeline has an external render pass");
+  }
+
   vk::RenderPassBeginInfo renderPassInfo{};
-  renderPassInfo.renderPass = m_renderpass.get();
+  renderPassInfo.renderPass = m_objects->renderpass.get();
   renderPassInfo.framebuffer = frameBuffer;
   renderPassInfo.renderArea.offset = vk::Offset2D{ offset.x, offset.y };
   renderPassInfo.renderArea.extent = vk::Extent2D{ extent.x, extent.y };
@@ -541,9 +1211,10 @@ void BG::Pipeline::BindRenderPass(
 
   renderPassInfo.setClearValues(clearValues);
 
-  buf.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+  buf.beginRenderPass(renderPassInfo, contents);
 
-  buf.bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline.get());
+  // Secondary command buffers bind the pipeline themselves
+  if (contents == vk::SubpassContents::eInline) buf.bindPipeline(vk::PipelineBindPoint::eGraphics, m_objects->pipeline.get());
 }
 
 BG::Pipeline::Pipeline(Renderer& r, vk::Device device)
@@ -567,6 +1238,15 @@ BG::Pipeline::Pipeline(Renderer& r, vk::Device device)
   m_multisampling.rasterizationSamples = vk::SampleCountFlagBits::e1;
 }
 
+BG::Pipeline::~Pipeline()
+{
+  // The compile job still uses this pipeline
+  if (m_buildFuture.valid()) m_buildFuture.wait();
+
+  // Only the last user takes the shared render pass down
+  if (m_objects) r.getPipelineStateCache().Release(m_objects, r.getFramebufferCache());
+}
+
 void BG::Pipeline::InitBackend()
 {
   if (!glslangInitialized)
@@ -4,6 +4,11 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+
 namespace BG
 {
   static bool glslangInitialized = false;
@@ -11,7 +16,7 @@ namespace BG
   class Pipeline
   {
   private:
-    vk::UniqueShaderModule AddShaders(std::string shaders, int shaderType);
+    void AddShaders(std::string shaders, int shaderType, vk::ShaderStageFlagBits stage, bool deferCompile);
 
     vk::Device m_device;
 
@@ -26,35 +31,94 @@ namespace BG
     vk::PipelineRasterizationStateCreateInfo       m_rasterizer;
     vk::PipelineMultisampleStateCreateInfo         m_multisampling;
 
-    std::vector<vk::UniqueShaderModule>            m_shaderModules;
-    std::vector<vk::PipelineShaderStageCreateInfo> m_stageCreateInfos;
+    struct ShaderStage
+    {
+      vk::ShaderStageFlagBits stage;
+      std::vector<uint32_t> spirv;
+    };
+
+    // Modules are only created when the pipeline state cache has no match
+    std::vector<ShaderStage>                       m_shaderStages;
+
+    struct PendingShader
+    {
+      std::string source;
+      int shaderType;
+      vk::ShaderStageFlagBits stage;
+    };
+
+    // Sources added with deferCompile, compiled by BuildPipeline (on a worker for BuildPipelineAsync)
+    std::vector<PendingShader>                     m_pendingShaders;
     std::vector<vk::AttachmentDescription>         m_attachments;
 
     vk::AttachmentDescription m_depthAttachment;
     bool m_useDepthAttachment = false;
 
-    vk::UniqueDescriptorSetLayout m_descriptorSetLayout;
-    vk::UniquePipelineLayout      m_layout;
-    vk::UniqueRenderPass          m_renderpass;
-    vk::UniquePipeline            m_pipeline;
+    // Shared with other pipelines built from the same state, see PipelineStateCache
+    std::shared_ptr<PipelineObjects> m_objects;
     
-    bool m_created = false;
+    // Set last by BuildPipeline, possibly on a compile worker
+    std::atomic<bool> m_created{ false };
+    bool m_isCompute = false;
+    bool m_usePushDescriptors = false;
+    bool m_useDynamicRendering = false;
+    bool m_useDynamicViewport = false;
+
+    // Set with SetRenderPass, owned by the caller
+    vk::RenderPass m_externalRenderPass;
+    uint32_t m_subpass = 0;
+
+    glm::uvec3 m_workgroupSize = glm::uvec3(1);
 
     std::vector<vk::VertexInputBindingDescription> m_bindingDescriptions;
     std::vector<vk::VertexInputAttributeDescription> m_attributeDescriptions;
     std::vector<vk::DescriptorSetLayoutBinding> m_descSetLayoutBindings;
     std::vector<vk::DescriptorBindingFlags> m_descSetLayoutBindingFlags;
     std::vector<vk::PushConstantRange> m_pushConstants;
+    std::vector<int> m_dynamicUniforms;
+
+    std::shared_future<void> m_buildFuture;
 
+    // Sets other than 0 come from outside (e.g. the bindless texture table), by set index
+    std::map<uint32_t, vk::DescriptorSetLayout> m_externalSetLayouts;
+
+    // Compiles through the renderer's ShaderCache
     std::vector<uint32_t> BuildProgramFromSrc(std::string shaders, int shaderType);
+    void ApplyReflection(const ShaderReflection& reflection);
+
+    // Every word of state the built objects depend on, the PipelineStateCache key
+    std::vector<uint64_t> GetStateKey();
+
+    // Creates the Vulkan objects after a PipelineStateCache miss
+    void BuildObjects();
+    void BuildGraphicsPipeline(const std::vector<vk::PipelineShaderStageCreateInfo>& stages);
+    void BuildComputePipeline(const std::vector<vk::PipelineShaderStageCreateInfo>& stages);
+    void BuildDescriptorUpdateTemplate();
+    void ApplyDynamicUniforms();
+    void CheckAllocatable();
+
+    struct TemplateBinding
+    {
+      uint32_t offset;
+      uint32_t stride;
+      uint32_t count;
+    };
+
+    std::unordered_map<uint32_t, TemplateBinding> m_templateBindings;
+    size_t m_templateDataSize = 0;
     
     std::unordered_map<std::string, uint32_t> m_name2bindings;
     std::unordered_map<std::string, uint32_t> m_memberOffsets;
     std::unordered_map<std::string, uint32_t> m_uniformBlockSize;
 
   public:
-    void AddFragmentShaders(std::string shaders);
-    void AddVertexShaders(std::string shaders);
+    // With deferCompile the source is only stored and compiled by BuildPipeline / BuildPipelineAsync,
+    // reflected bindings (GetBindingByName, ...) are then available once the pipeline is built
+    void AddFragmentShaders(std::string shaders, bool deferCompile = false);
+    void AddVertexShaders(std::string shaders, bool deferCompile = false);
+
+    // A pipeline with a compute shader is built as a compute pipeline, without render pass or attachments
+    void AddComputeShaders(std::string shaders, bool deferCompile = false);
 
     template <class T> VertexBufferBinding AddVertexBuffer(bool perVertex = true)
     {
@@ -74,9 +138,20 @@ namespace BG
 
     void AddDescriptorUniform(int binding, vk::ShaderStageFlags stage, int count = 1, bool unbound = false);
     void AddDescriptorTexture(int binding, vk::ShaderStageFlags stage, int count = 1, bool unbound = false);
+    void AddDescriptorStorageBuffer(int binding, vk::ShaderStageFlags stage, int count = 1, bool unbound = false);
+    void AddDescriptorStorageImage(int binding, vk::ShaderStageFlags stage, int count = 1, bool unbound = false);
+    // subpassInput, written with the view of an attachment of the current subpass and no sampler
+    void AddDescriptorInputAttachment(int binding, vk::ShaderStageFlags stage, int count = 1);
 
     void AddPushConstant(uint32_t offset, uint32_t size, vk::ShaderStageFlags stage);
 
+    // Turns a reflected uniform block into a dynamic uniform buffer, call before BuildPipeline (applied there).
+    // The set then holds the buffer (e.g. from the UniformRing) and each bind passes the offset
+    void SetDynamicUniform(int binding);
+
+    // Reflection only builds set 0, every higher set used by the shaders needs a layout from here
+    void SetDescriptorSetLayout(uint32_t set, vk::DescriptorSetLayout layout);
+
     void SetViewport(float width, float height, float x = 0.0, float y = 0.0, float minDepth = 0.0f, float maxDepth = 1.0f);
     void SetScissor(int x, int y, int width, int height);
 
@@ -85,23 +160,80 @@ namespace BG
 
     void BuildPipeline();
 
+    // Compiles the deferred shaders and builds the pipeline on the renderer's compile job system.
+    // Don't touch the pipeline until IsReady(); get() on the future rethrows a failed build
+    std::shared_future<void> BuildPipelineAsync();
+    inline bool IsReady() { return m_created; }
+    inline std::shared_future<void> GetBuildFuture() { return m_buildFuture; }
+
+    // Builds set 0 as a push descriptor layout when VK_KHR_push_descriptor is available, returns whether it will.
+    // Set 0 is then written with CommandBuffer::Push* instead of AllocDescSet + BindGraphicsDescSets
+    bool UsePushDescriptors();
+    inline bool IsPushDescriptor() { return m_usePushDescriptors; }
+
+    // Builds against the attachment formats only (VK_KHR_dynamic_rendering), returns whether it will.
+    // The pipeline then has no render pass; draw inside CommandBuffer::BeginRendering / WithRenderPass.
+    // The attachments' initial / final layouts are not applied, transition the images around the rendering
+    bool UseDynamicRendering();
+    inline bool IsDynamicRendering() { return m_useDynamicRendering; }
+
+    // Builds for a subpass of a render pass created by the caller (e.g. with several subpasses) instead of its own.
+    // The attachments added here must match the subpass' color attachments. Begin the render pass with
+    // CommandBuffer::BeginRenderPass(vk::RenderPass, ...), the render pass has to outlive the pipeline build
+    void SetRenderPass(vk::RenderPass renderPass, uint32_t subpass);
+    inline bool HasExternalRenderPass() { return bool(m_externalRenderPass); }
+    inline uint32_t GetSubpass() { return m_subpass; }
+
+    // Viewport & scissor are set while recording (CommandBuffer::SetViewport), one pipeline then draws to targets of any size
+    void UseDynamicViewport();
+    inline bool IsDynamicViewport() { return m_useDynamicViewport; }
+
+    std::vector<vk::Format> GetColorFormats();
+    // eUndefined without depth attachment
+    vk::Format GetDepthFormat();
+    // Color attachments, then depth
+    std::vector<vk::AttachmentLoadOp> GetLoadOps();
+    inline bool HasDepthAttachment() { return m_useDepthAttachment; }
+
+    void PushDescriptorSet(vk::CommandBuffer buf, const std::vector<vk::WriteDescriptorSet>& descSetWrites);
+    void PushDescriptorSetWithTemplate(vk::CommandBuffer buf, const void* data);
+
     vk::DescriptorSet AllocDescSet(vk::DescriptorPool pool, int variableDescriptorCount = 0);
+    vk::DescriptorSet AllocDescSet(DescriptorAllocator& allocator, int variableDescriptorCount = 0);
+    // Reuses the set written for the same key in an earlier frame, write is only called for new sets
+    vk::DescriptorSet AllocDescSetCached(DescriptorAllocator& allocator, const std::vector<uint64_t>& key, const std::function<void(vk::DescriptorSet)>& write, int variableDescriptorCount = 0);
 
     void BindGraphicsUniformBuffer(Pipeline& p, vk::DescriptorSet descSet, const BG::Buffer& buffer, uint32_t offset, uint32_t range, int binding, int arrayElement = 0);
     void BindGraphicsImageView(Pipeline& p, vk::DescriptorSet descSet, vk::ImageView view, vk::ImageLayout layout, vk::Sampler sampler, int binding, int arrayElement = 0);
+    void BindStorageBuffer(Pipeline& p, vk::DescriptorSet descSet, const BG::Buffer& buffer, uint32_t offset, uint32_t range, int binding, int arrayElement = 0);
+    // Storage images are expected in eGeneral layout
+    void BindStorageImage(Pipeline& p, vk::DescriptorSet descSet, vk::ImageView view, int binding, int arrayElement = 0);
+
+    // Descriptor update template over all bindings without a variable count, in binding order.
+    // Each binding takes count vk::DescriptorImageInfo / vk::DescriptorBufferInfo at its offset (see DescriptorTemplateData)
+    uint32_t GetTemplateOffset(int binding, int arrayElement = 0);
+    inline size_t GetTemplateDataSize() { return m_templateDataSize; }
+    void UpdateDescSetWithTemplate(vk::DescriptorSet descSet, const void* data);
 
     vk::RenderPass GetRenderPass();
     vk::Pipeline GetPipeline();
     vk::PipelineLayout GetLayout();
 
+    inline bool IsCompute() { return m_isCompute; }
+    inline vk::PipelineBindPoint GetBindPoint() { return m_isCompute ? vk::PipelineBindPoint::eCompute : vk::PipelineBindPoint::eGraphics; }
+    // local_size of the compute shader, from reflection
+    inline glm::uvec3 GetWorkgroupSize() { return m_workgroupSize; }
+
     void BindRenderPass(
       vk::CommandBuffer& buf,
       vk::Framebuffer& frameBuffer,
       glm::uvec2 extent,
       glm::vec4 clearColor = glm::vec4(1.0),
-      glm::ivec2 offset = glm::ivec2(0));
+      glm::ivec2 offset = glm::ivec2(0),
+      vk::SubpassContents contents = vk::SubpassContents::eInline);
 
     Pipeline(Renderer& r, vk::Device device);
+    ~Pipeline();
 
     static void InitBackend();
   };
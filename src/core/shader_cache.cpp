@@ -0,0 +1,345 @@
+#include "shader_cache.hpp"
+#include "pipeline_cache.hpp"
+#include "descriptor_allocator.hpp"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace BG;
+using json = nlohmann::json;
+
+namespace
+{
+  const uint32_t FILE_MAGIC = 0x43534742; // "BGSC"
+
+  struct FileHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t keyBytes;
+    uint32_t spirvWords;
+    uint32_t reflectionBytes;
+  };
+
+  json MembersToJson(const std::vector<ShaderReflection::Member>& members)
+  {
+    json j = json::array();
+    for (auto& member : members) j.push_back({ { "name", member.name }, { "offset", member.offset } });
+    return j;
+  }
+
+  std::vector<ShaderReflection::Member> MembersFromJson(const json& j)
+  {
+    std::vector<ShaderReflection::Member> members;
+    for (auto& member : j) members.push_back({ member.at("name").get<std::string>(), member.at("offset").get<uint32_t>() });
+    return members;
+  }
+
+  json ReflectionToJson(const ShaderReflection& reflection)
+  {
+    json j;
+
+    j["stage"] = uint32_t(reflection.stage);
+    j["workgroupSize"] = { reflection.workgroupSize.x, reflection.workgroupSize.y, reflection.workgroupSize.z };
+
+    j["descriptors"] = json::array();
+    for (auto& descriptor : reflection.descriptors)
+    {
+      j["descriptors"].push_back({
+        { "name", descriptor.name },
+        { "binding", descriptor.binding },
+        { "type", uint32_t(descriptor.type) },
+        { "unbounded", descriptor.unbounded },
+        { "members", MembersToJson(descriptor.members) },
+        { "blockSize", descriptor.blockSize },
+        { "isBlock", descriptor.isBlock } });
+    }
+
+    j["pushConstants"] = json::array();
+    for (auto& pushConstant : reflection.pushConstants)
+    {
+      j["pushConstants"].push_back({
+        { "offset", pushConstant.offset },
+        { "size", pushConstant.size },
+        { "members", MembersToJson(pushConstant.members) } });
+    }
+
+    return j;
+  }
+
+  ShaderReflection ReflectionFromJson(const json& j)
+  {
+    ShaderReflection reflection;
+
+    reflection.stage = vk::ShaderStageFlags(j.at("stage").get<uint32_t>());
+    j.at("workgroupSize")[0].get_to(reflection.workgroupSize.x);
+    j.at("workgroupSize")[1].get_to(reflection.workgroupSize.y);
+    j.at("workgroupSize")[2].get_to(reflection.workgroupSize.z);
+
+    for (auto& jsonDescriptor : j.at("descriptors"))
+    {
+      ShaderReflection::Descriptor descriptor;
+      descriptor.name = jsonDescriptor.at("name").get<std::string>();
+      descriptor.binding = jsonDescriptor.at("binding").get<uint32_t>();
+      descriptor.type = vk::DescriptorType(jsonDescriptor.at("type").get<uint32_t>());
+      descriptor.unbounded = jsonDescriptor.at("unbounded").get<bool>();
+      descriptor.members = MembersFromJson(jsonDescriptor.at("members"));
+      descriptor.blockSize = jsonDescriptor.at("blockSize").get<uint32_t>();
+      descriptor.isBlock = jsonDescriptor.at("isBlock").get<bool>();
+      reflection.descriptors.push_back(descriptor);
+    }
+
+    for (auto& jsonPushConstant : j.at("pushConstants"))
+    {
+      ShaderReflection::PushConstant pushConstant;
+      pushConstant.offset = jsonPushConstant.at("offset").get<uint32_t>();
+      pushConstant.size = jsonPushConstant.at("size").get<uint32_t>();
+      pushConstant.members = MembersFromJson(jsonPushConstant.at("members"));
+      reflection.pushConstants.push_back(pushConstant);
+    }
+
+    return reflection;
+  }
+}
+
+BG::ShaderCache::ShaderCache(size_t maxBytes)
+  : m_maxBytes(maxBytes)
+{
+  const char* enabled = std::getenv("BG_SHADER_CACHE");
+  if (enabled != nullptr && std::string(enabled) == "0")
+  {
+    m_enabled = false;
+    spdlog::info("Shader cache disabled");
+    return;
+  }
+
+  m_directory = PipelineCache::GetCacheDirectory() / "shaders";
+
+  std::error_code ec;
+  std::filesystem::create_directories(m_directory, ec);
+
+  for (auto& file : std::filesystem::directory_iterator(m_directory, ec))
+  {
+    if (!file.is_regular_file() || file.path().extension() != ".spv") continue;
+
+    uint64_t key;
+    try
+    {
+      key = std::stoull(file.path().stem().string(), nullptr, 16);
+    }
+    catch (const std::exception&)
+    {
+      continue;
+    }
+
+    FileInfo info;
+    info.size = file.file_size(ec);
+    info.lastUsed = file.last_write_time(ec);
+
+    m_files[key] = info;
+    m_totalBytes += info.size;
+  }
+
+  spdlog::info("Shader cache: {} shaders, {} bytes in {}", m_files.size(), m_totalBytes, m_directory.string());
+
+  EvictLocked();
+}
+
+BG::ShaderCache::~ShaderCache()
+{
+  if (m_enabled) spdlog::info("Shader cache: {} hits, {} misses", m_hits.load(), m_misses.load());
+}
+
+BG::ShaderCache::Key BG::ShaderCache::MakeKey(const std::string& source, int shaderType, const std::string& compilerOptions)
+{
+  Key key;
+  key.text = fmt::format("{}\nstage={}\n{}", compilerOptions, shaderType, source);
+  key.hash = std::hash<std::string>()(key.text);
+  DescriptorAllocator::HashCombine(key.hash, FORMAT_VERSION);
+  return key;
+}
+
+std::filesystem::path BG::ShaderCache::GetPath(uint64_t key)
+{
+  return m_directory / fmt::format("{:016x}.spv", key);
+}
+
+void BG::ShaderCache::RemoveLocked(uint64_t key)
+{
+  auto it = m_files.find(key);
+  if (it != m_files.end())
+  {
+    m_totalBytes -= it->second.size;
+    m_files.erase(it);
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(GetPath(key), ec);
+}
+
+void BG::ShaderCache::EvictLocked()
+{
+  if (m_totalBytes <= m_maxBytes) return;
+
+  std::vector<std::pair<uint64_t, std::filesystem::file_time_type>> byAge;
+  for (auto& file : m_files) byAge.push_back({ file.first, file.second.lastUsed });
+
+  std::sort(byAge.begin(), byAge.end(), [](auto& a, auto& b) { return a.second < b.second; });
+
+  size_t evicted = 0;
+  for (auto& file : byAge)
+  {
+    if (m_totalBytes <= m_maxBytes) break;
+
+    RemoveLocked(file.first);
+    evicted++;
+  }
+
+  spdlog::debug("Shader cache: evicted {} shaders, {} bytes left", evicted, m_totalBytes);
+}
+
+bool BG::ShaderCache::Load(const Key& key, Entry& entry)
+{
+  if (!m_enabled) return false;
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto it = m_files.find(key.hash);
+  if (it == m_files.end())
+  {
+    m_misses++;
+    return false;
+  }
+
+  auto path = GetPath(key.hash);
+
+  std::ifstream f(path, std::ios::binary);
+  std::vector<char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+  f.close();
+
+  FileHeader header;
+  bool valid = data.size() >= sizeof(FileHeader);
+
+  if (valid)
+  {
+    std::memcpy(&header, data.data(), sizeof(FileHeader));
+
+    valid = header.magic == FILE_MAGIC && header.version == FORMAT_VERSION && header.key == key.hash
+      && data.size() == sizeof(FileHeader) + header.keyBytes + size_t(header.spirvWords) * sizeof(uint32_t) + header.reflectionBytes;
+  }
+
+  const char* keyData = valid ? data.data() + sizeof(FileHeader) : nullptr;
+
+  // Another shader with the same hash, it stays until this one is stored over it
+  if (valid && key.text.compare(0, std::string::npos, keyData, header.keyBytes) != 0)
+  {
+    spdlog::debug("Shader cache: hash collision on {}", path.string());
+    m_misses++;
+    return false;
+  }
+
+  if (valid)
+  {
+    try
+    {
+      const char* spirvData = keyData + header.keyBytes;
+      const char* reflectionData = spirvData + size_t(header.spirvWords) * sizeof(uint32_t);
+
+      entry.spirv.resize(header.spirvWords);
+      std::memcpy(entry.spirv.data(), spirvData, size_t(header.spirvWords) * sizeof(uint32_t));
+      entry.reflection = ReflectionFromJson(json::parse(reflectionData, reflectionData + header.reflectionBytes));
+    }
+    catch (const std::exception& e)
+    {
+      spdlog::warn("Shader cache: can't read reflection of {}: {}", path.string(), e.what());
+      valid = false;
+    }
+  }
+
+  if (!valid)
+  {
+    spdlog::warn("Shader cache: dropping invalid entry {}", path.string());
+    RemoveLocked(key.hash);
+    m_misses++;
+    return false;
+  }
+
+  // Modification time is the LRU stamp
+  std::error_code ec;
+  it->second.lastUsed = std::filesystem::file_time_type::clock::now();
+  std::filesystem::last_write_time(path, it->second.lastUsed, ec);
+
+  m_hits++;
+  return true;
+}
+
+void BG::ShaderCache::Store(const Key& key, const Entry& entry)
+{
+  if (!m_enabled) return;
+
+  std::string reflection = ReflectionToJson(entry.reflection).dump();
+
+  FileHeader header;
+  header.magic = FILE_MAGIC;
+  header.version = FORMAT_VERSION;
+  header.key = key.hash;
+  header.keyBytes = uint32_t(key.text.size());
+  header.spirvWords = uint32_t(entry.spirv.size());
+  header.reflectionBytes = uint32_t(reflection.size());
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto path = GetPath(key.hash);
+
+  // Write to a temporary file first, so a crash never leaves a truncated shader behind
+  auto tmpPath = path;
+  tmpPath += ".tmp";
+
+  {
+    std::ofstream f(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!f.is_open())
+    {
+      spdlog::error("Failed to open {} for the shader cache", tmpPath.string());
+      return;
+    }
+
+    f.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+    f.write(key.text.data(), key.text.size());
+    f.write(reinterpret_cast<const char*>(entry.spirv.data()), entry.spirv.size() * sizeof(uint32_t));
+    f.write(reflection.data(), reflection.size());
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmpPath, path, ec);
+
+  if (ec)
+  {
+    spdlog::error("Failed to write shader cache {}: {}", path.string(), ec.message());
+    return;
+  }
+
+  if (m_files.count(key.hash)) m_totalBytes -= m_files[key.hash].size;
+
+  FileInfo info;
+  info.size = sizeof(FileHeader) + key.text.size() + entry.spirv.size() * sizeof(uint32_t) + reflection.size();
+  info.lastUsed = std::filesystem::file_time_type::clock::now();
+
+  m_files[key.hash] = info;
+  m_totalBytes += info.size;
+
+  EvictLocked();
+}
+
+void BG::ShaderCache::Clear()
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  while (!m_files.empty()) RemoveLocked(m_files.begin()->first);
+
+  spdlog::info("Shader cache cleared");
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
+namespace BG
+{
+
+  // What Pipeline takes from SPIRV-Reflect, stored next to the SPIR-V so a cached shader needs no reflection
+  struct ShaderReflection
+  {
+    struct Member
+    {
+      std::string name;
+      uint32_t offset;
+    };
+
+    struct Descriptor
+    {
+      std::string name;
+      uint32_t binding;
+      vk::DescriptorType type;
+      bool unbounded;
+      // Uniform / storage blocks
+      std::vector<Member> members;
+      uint32_t blockSize;
+      bool isBlock;
+    };
+
+    struct PushConstant
+    {
+      uint32_t offset;
+      uint32_t size;
+      std::vector<Member> members;
+    };
+
+    vk::ShaderStageFlags stage;
+    glm::uvec3 workgroupSize = glm::uvec3(1);
+    std::vector<Descriptor> descriptors;
+    std::vector<PushConstant> pushConstants;
+  };
+
+  // Content addressed on-disk cache of compiled shaders, one file per key in <cache directory>/shaders.
+  // The key covers the source, the stage, the compiler version and options, so any change there is a miss.
+  // Each file also holds the full key text, compared on load so a hash collision is a miss as well.
+  // Files with a different format version or that fail to parse are deleted when read.
+  // Once the files add up to more than maxBytes the least recently used ones are evicted.
+  class ShaderCache
+  {
+  public:
+    struct Key
+    {
+      uint64_t hash;
+      // Compiler options, stage and source
+      std::string text;
+    };
+
+    struct Entry
+    {
+      std::vector<uint32_t> spirv;
+      ShaderReflection reflection;
+    };
+
+  private:
+    static const uint32_t FORMAT_VERSION = 2;
+
+    struct FileInfo
+    {
+      uint64_t size;
+      std::filesystem::file_time_type lastUsed;
+    };
+
+    std::mutex m_mutex;
+
+    std::filesystem::path m_directory;
+    size_t m_maxBytes;
+    bool m_enabled = true;
+
+    std::unordered_map<uint64_t, FileInfo> m_files;
+    uint64_t m_totalBytes = 0;
+
+    // Read without the lock by GetHits / GetMisses
+    std::atomic<uint32_t> m_hits{ 0 };
+    std::atomic<uint32_t> m_misses{ 0 };
+
+    std::filesystem::path GetPath(uint64_t key);
+    void RemoveLocked(uint64_t key);
+    void EvictLocked();
+
+  public:
+    // $BG_SHADER_CACHE=0 disables the cache
+    ShaderCache(size_t maxBytes = 64 * 1024 * 1024);
+    ~ShaderCache();
+
+    static Key MakeKey(const std::string& source, int shaderType, const std::string& compilerOptions);
+
+    // False on a miss, compile and Store
+    bool Load(const Key& key, Entry& entry);
+    void Store(const Key& key, const Entry& entry);
+
+    // Deletes every cached shader
+    void Clear();
+
+    inline uint32_t GetHits() { return m_hits; }
+    inline uint32_t GetMisses() { return m_misses; }
+  };
+
+}
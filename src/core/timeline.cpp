@@ -0,0 +1,113 @@
+#include "timeline.hpp"
+
+#include <algorithm>
+
+BG::Timeline::Timeline(vk::Device device, vk::Queue queue)
+  : m_device(device), m_queue(queue)
+{
+  vk::SemaphoreTypeCreateInfo typeInfo;
+  typeInfo.semaphoreType = vk::SemaphoreType::eTimeline;
+  typeInfo.initialValue = 0;
+
+  vk::SemaphoreCreateInfo info;
+  info.pNext = &typeInfo;
+
+  m_semaphore = m_device.createSemaphoreUnique(info);
+}
+
+uint64_t BG::Timeline::Submit(const std::vector<vk::CommandBuffer>& cmdBufs, const std::vector<Wait>& waits, const std::vector<vk::Semaphore>& binarySignals)
+{
+  // Values have to reach the queue in increasing order, so the increment and the submit happen under one lock
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  uint64_t value = m_lastSubmitted + 1;
+
+  std::vector<vk::Semaphore> waitSemaphores;
+  std::vector<uint64_t> waitValues;
+  std::vector<vk::PipelineStageFlags> waitStages;
+
+  for (auto& wait : waits)
+  {
+    waitSemaphores.push_back(wait.semaphore);
+    waitValues.push_back(wait.value);
+    waitStages.push_back(wait.stage);
+  }
+
+  std::vector<vk::Semaphore> signalSemaphores = binarySignals;
+  std::vector<uint64_t> signalValues(binarySignals.size(), 0);
+
+  signalSemaphores.push_back(m_semaphore.get());
+  signalValues.push_back(value);
+
+  vk::TimelineSemaphoreSubmitInfo timelineInfo;
+  timelineInfo.setWaitSemaphoreValues(waitValues);
+  timelineInfo.setSignalSemaphoreValues(signalValues);
+
+  vk::SubmitInfo submitInfo;
+  submitInfo.setWaitSemaphores(waitSemaphores);
+  submitInfo.setWaitDstStageMask(waitStages);
+  submitInfo.setCommandBuffers(cmdBufs);
+  submitInfo.setSignalSemaphores(signalSemaphores);
+  submitInfo.pNext = &timelineInfo;
+
+  auto result = m_queue.submit(1, &submitInfo, nullptr);
+
+  if (result != vk::Result::eSuccess)
+  {
+    spdlog::error("Queue submit failed: {}", vk::to_string(result));
+    throw std::runtime_error("Queue submit failed");
+  }
+
+  m_lastSubmitted = value;
+
+  return value;
+}
+
+vk::Result BG::Timeline::Present(const vk::PresentInfoKHR& presentInfo)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_queue.presentKHR(presentInfo);
+}
+
+uint64_t BG::Timeline::GetLastSubmitted()
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_lastSubmitted;
+}
+
+uint64_t BG::Timeline::GetCompleted()
+{
+  uint64_t completed = m_device.getSemaphoreCounterValue(m_semaphore.get());
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_completed = std::max(m_completed, completed);
+
+  return m_completed;
+}
+
+bool BG::Timeline::IsComplete(uint64_t value)
+{
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (value <= m_completed) return true;
+  }
+
+  return value <= GetCompleted();
+}
+
+void BG::Timeline::Wait(uint64_t value)
+{
+  if (IsComplete(value)) return;
+
+  vk::Semaphore semaphore = m_semaphore.get();
+
+  vk::SemaphoreWaitInfo waitInfo;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &semaphore;
+  waitInfo.pValues = &value;
+
+  if (m_device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) throw std::runtime_error("Wait for timeline semaphore failed");
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_completed = std::max(m_completed, value);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <mutex>
+
+namespace BG
+{
+
+  // Timeline semaphore owned by one queue. Every submit through it signals the next value,
+  // so "is this work done" is a comparison against the semaphore's counter.
+  class Timeline
+  {
+  public:
+    struct Wait
+    {
+      vk::Semaphore semaphore;
+      uint64_t value; // ignored for binary semaphores
+      vk::PipelineStageFlags stage;
+    };
+
+  private:
+    vk::Device m_device;
+    vk::Queue m_queue;
+    vk::UniqueSemaphore m_semaphore;
+
+    std::mutex m_mutex;
+    uint64_t m_lastSubmitted = 0;
+    uint64_t m_completed = 0;
+
+  public:
+    Timeline(vk::Device device, vk::Queue queue);
+
+    inline vk::Semaphore GetSemaphore() { return m_semaphore.get(); }
+
+    // Returns the value signaled when the command buffers are done
+    uint64_t Submit(
+      const std::vector<vk::CommandBuffer>& cmdBufs,
+      const std::vector<Wait>& waits = {},
+      const std::vector<vk::Semaphore>& binarySignals = {});
+
+    // The queue is externally synchronized, so presenting on it takes the same lock as Submit
+    vk::Result Present(const vk::PresentInfoKHR& presentInfo);
+
+    uint64_t GetLastSubmitted();
+    uint64_t GetCompleted();
+
+    bool IsComplete(uint64_t value);
+    void Wait(uint64_t value);
+  };
+
+}
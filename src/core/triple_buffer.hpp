@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace BG
+{
+
+  // Single producer / single consumer triple buffer.
+  // The producer fills GetBack() and Publish()es it, the consumer Acquire()s the most recently
+  // published slot and reads GetFront(). Neither side ever blocks on the other.
+  template <class T> class TripleBuffer
+  {
+  private:
+    static const uint8_t INDEX_MASK = 0x3;
+    static const uint8_t DIRTY_BIT = 0x4;
+
+    T m_slots[3];
+
+    // Index of the slot in the middle, DIRTY_BIT is set when it holds data the consumer hasn't seen
+    std::atomic<uint8_t> m_middle{ 0 };
+
+    uint8_t m_back = 1;  // owned by the producer
+    uint8_t m_front = 2; // owned by the consumer
+
+    bool m_hasFront = false;
+
+  public:
+    inline T& GetBack() { return m_slots[m_back]; }
+
+    inline void Publish()
+    {
+      uint8_t previous = m_middle.exchange(m_back | DIRTY_BIT, std::memory_order_acq_rel);
+      m_back = previous & INDEX_MASK;
+    }
+
+    // Returns true if a new slot was published since the last call
+    inline bool Acquire()
+    {
+      if ((m_middle.load(std::memory_order_relaxed) & DIRTY_BIT) == 0) return false;
+
+      uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+      m_front = previous & INDEX_MASK;
+      m_hasFront = true;
+
+      return true;
+    }
+
+    // False until the producer published at least once
+    inline bool HasFront() { return m_hasFront; }
+
+    inline T& GetFront() { return m_slots[m_front]; }
+  };
+
+}
@@ -0,0 +1,129 @@
+#include "uniform_ring.hpp"
+#include "buffer.hpp"
+
+#include <algorithm>
+
+BG::UniformRing::UniformRing(MemoryAllocator& allocator, vk::PhysicalDevice physicalDevice, uint32_t numFrames, size_t frameSize)
+  : m_allocator(allocator)
+{
+  auto limits = physicalDevice.getProperties().limits;
+  m_alignment = size_t(std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment));
+
+  m_frames.resize(numFrames);
+
+  for (auto& frame : m_frames)
+  {
+    frame.chunks.push_back(CreateChunk(frameSize));
+  }
+}
+
+BG::UniformRing::~UniformRing()
+{
+  for (auto& frame : m_frames)
+  {
+    for (auto& chunk : frame.chunks) chunk.buffer->UnMap();
+  }
+
+  for (auto& chunk : m_frameRetired) chunk.buffer->UnMap();
+
+  for (auto& retired : m_retired)
+  {
+    for (auto& chunk : retired.second) chunk.buffer->UnMap();
+  }
+}
+
+BG::UniformRing::Chunk BG::UniformRing::CreateChunk(size_t size)
+{
+  Chunk chunk;
+  chunk.buffer = m_allocator.AllocCPU2GPU(size, vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer);
+  chunk.mapped = chunk.buffer->Map<uint8_t>();
+  chunk.size = size;
+  chunk.coherent = chunk.buffer->IsCoherent();
+
+  return chunk;
+}
+
+void BG::UniformRing::NewFrame(uint32_t frameIndex, uint64_t completedValue)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  while (!m_retired.empty() && m_retired.front().first <= completedValue)
+  {
+    for (auto& chunk : m_retired.front().second) chunk.buffer->UnMap();
+    m_retired.pop_front();
+  }
+
+  m_currentFrame = frameIndex;
+
+  auto& frame = m_frames[m_currentFrame];
+
+  if (frame.chunks.size() > 1)
+  {
+    size_t total = 0;
+    for (auto& chunk : frame.chunks)
+    {
+      total += chunk.size;
+      m_frameRetired.push_back(std::move(chunk));
+    }
+
+    frame.chunks.clear();
+    frame.chunks.push_back(CreateChunk(total));
+
+    spdlog::info("Uniform ring frame {} grown to {} KiB (high watermark {} KiB)", m_currentFrame, total / 1024, m_highWatermark / 1024);
+  }
+
+  frame.head = 0;
+  frame.used = 0;
+}
+
+void BG::UniformRing::Flush()
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto& frame = m_frames[m_currentFrame];
+
+  for (size_t i = 0; i < frame.chunks.size(); i++)
+  {
+    auto& chunk = frame.chunks[i];
+    if (chunk.coherent) continue;
+
+    // Only the last chunk is partially used
+    bool last = i + 1 == frame.chunks.size();
+    chunk.buffer->Flush(0, last ? frame.head : VK_WHOLE_SIZE);
+  }
+}
+
+void BG::UniformRing::EndFrame(uint64_t submitValue)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  if (!m_frameRetired.empty())
+  {
+    m_retired.emplace_back(submitValue, std::move(m_frameRetired));
+    m_frameRetired.clear();
+  }
+}
+
+BG::UniformRing::Allocation BG::UniformRing::Alloc(size_t size)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto& frame = m_frames[m_currentFrame];
+
+  size_t offset = (frame.head + m_alignment - 1) / m_alignment * m_alignment;
+
+  if (offset + size > frame.chunks.back().size)
+  {
+    // Overflow: chain a bigger buffer for the rest of the frame
+    frame.chunks.push_back(CreateChunk(std::max(frame.chunks.back().size * 2, size)));
+    offset = 0;
+  }
+
+  auto& chunk = frame.chunks.back();
+
+  frame.used += offset + size - frame.head;
+  frame.head = offset + size;
+  m_highWatermark = std::max(m_highWatermark, frame.used);
+
+  return Allocation{ chunk.buffer.get(), uint32_t(offset), chunk.mapped + offset };
+}
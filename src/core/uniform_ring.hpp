@@ -0,0 +1,88 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <mutex>
+
+namespace BG
+{
+
+  // Per-frame linear allocator for small uniform / storage data.
+  // One persistently mapped buffer per frame in flight, bump allocated at the device's offset alignment.
+  // Bind the buffer once as a dynamic uniform buffer (Pipeline::SetDynamicUniform) and pass the offset
+  // of each allocation as a dynamic offset, so the descriptor set can be cached across frames.
+  class UniformRing
+  {
+  public:
+    struct Allocation
+    {
+      Buffer* buffer;
+      uint32_t offset;
+      void* data;
+    };
+
+  private:
+    struct Chunk
+    {
+      std::unique_ptr<Buffer> buffer;
+      uint8_t* mapped = nullptr;
+      size_t size = 0;
+      bool coherent = true;
+    };
+
+    struct FrameRing
+    {
+      // Usually one, more when the frame overflowed
+      std::vector<Chunk> chunks;
+      size_t head = 0;
+      size_t used = 0;
+    };
+
+    MemoryAllocator& m_allocator;
+    size_t m_alignment;
+
+    std::mutex m_mutex;
+
+    std::vector<FrameRing> m_frames;
+    uint32_t m_currentFrame = 0;
+
+    // Outgrown buffers are freed once the graphics timeline passed the frame that retired them,
+    // by then cached descriptor sets referencing them are no longer in use
+    std::vector<Chunk> m_frameRetired;
+    std::deque<std::pair<uint64_t, std::vector<Chunk>>> m_retired;
+
+    size_t m_highWatermark = 0;
+
+    Chunk CreateChunk(size_t size);
+
+  public:
+    UniformRing(MemoryAllocator& allocator, vk::PhysicalDevice physicalDevice, uint32_t numFrames, size_t frameSize = 1024 * 1024);
+    ~UniformRing();
+
+    // Starts over in this frame slot's buffer, the GPU must be done with it.
+    // A slot that overflowed last time is replaced by one buffer big enough for all of it
+    void NewFrame(uint32_t frameIndex, uint64_t completedValue);
+
+    // Flushes this frame's writes where the memory isn't coherent, call before submitting
+    void Flush();
+
+    // Tags the buffers retired this frame with the value the frame's submit signals
+    void EndFrame(uint64_t submitValue);
+
+    Allocation Alloc(size_t size);
+
+    template <class T> Allocation Push(const T& data)
+    {
+      auto allocation = Alloc(sizeof(T));
+      *reinterpret_cast<T*>(allocation.data) = data;
+      return allocation;
+    }
+
+    // Most bytes used by a single frame so far
+    inline size_t GetHighWatermark() { return m_highWatermark; }
+  };
+
+}
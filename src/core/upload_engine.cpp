@@ -0,0 +1,334 @@
+#include "upload_engine.hpp"
+#include "buffer.hpp"
+#include "timeline.hpp"
+
+#include <cstring>
+
+using namespace BG;
+
+// Staging offsets must be a multiple of 4 and of the texel size, 48 covers every format up to 16 bytes per texel
+static const uint64_t STAGING_ALIGNMENT = 48;
+
+static const vk::PipelineStageFlags consumerStages =
+  vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader |
+  vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader;
+
+BG::UploadEngine::UploadEngine(vk::Device device, MemoryAllocator& allocator, Timeline& transferTimeline, uint32_t transferFamily, Timeline& graphicsTimeline, uint32_t graphicsFamily, size_t ringSize)
+  : m_device(device), m_allocator(allocator),
+    m_transferTimeline(transferTimeline), m_graphicsTimeline(graphicsTimeline),
+    m_transferFamily(transferFamily), m_graphicsFamily(graphicsFamily)
+{
+  m_ownershipTransfer = m_transferFamily != m_graphicsFamily;
+
+  m_transferCmdPool = m_device.createCommandPoolUnique({ vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient, m_transferFamily });
+
+  if (m_ownershipTransfer)
+  {
+    m_acquireCmdPool = m_device.createCommandPoolUnique({ vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient, m_graphicsFamily });
+  }
+
+  m_ringSize = ringSize / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+  m_ring = m_allocator.AllocCPU2GPU(m_ringSize, vk::BufferUsageFlagBits::eTransferSrc);
+
+  // Stays mapped for the lifetime of the engine
+  m_ringMapped = m_ring->Map<uint8_t>();
+
+  spdlog::info("Upload engine: {} MB staging ring, transfer queue family {}{}", m_ringSize >> 20, m_transferFamily, m_ownershipTransfer ? " (dedicated)" : "");
+}
+
+BG::UploadEngine::~UploadEngine()
+{
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    FlushLocked();
+    while (!m_inFlight.empty()) RetireLocked(true);
+  }
+
+  m_ring->UnMap();
+}
+
+UploadEngine::Batch& BG::UploadEngine::CurrentBatch()
+{
+  if (m_current) return *m_current;
+
+  if (!m_freeBatches.empty())
+  {
+    m_current = std::move(m_freeBatches.back());
+    m_freeBatches.pop_back();
+  }
+  else
+  {
+    m_current = std::make_unique<Batch>();
+    m_current->transferCmd = std::move(m_device.allocateCommandBuffersUnique({ m_transferCmdPool.get(), vk::CommandBufferLevel::ePrimary, 1 })[0]);
+
+    if (m_ownershipTransfer)
+    {
+      m_current->acquireCmd = std::move(m_device.allocateCommandBuffersUnique({ m_acquireCmdPool.get(), vk::CommandBufferLevel::ePrimary, 1 })[0]);
+    }
+  }
+
+  m_current->id = m_nextBatchId++;
+
+  m_current->transferCmd->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr });
+  if (m_ownershipTransfer) m_current->acquireCmd->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr });
+
+  return *m_current;
+}
+
+void BG::UploadEngine::FlushLocked()
+{
+  if (!m_current) return;
+
+  auto batch = std::move(m_current);
+
+  batch->transferCmd->end();
+  batch->ringEnd = m_ringHead;
+
+  uint64_t transferValue = m_transferTimeline.Submit({ batch->transferCmd.get() });
+
+  if (m_ownershipTransfer)
+  {
+    batch->acquireCmd->end();
+
+    // The acquire barriers are ordered before everything submitted to the graphics queue afterwards
+    batch->timeline = &m_graphicsTimeline;
+    batch->timelineValue = m_graphicsTimeline.Submit(
+      { batch->acquireCmd.get() },
+      { { m_transferTimeline.GetSemaphore(), transferValue, vk::PipelineStageFlagBits::eAllCommands } });
+  }
+  else
+  {
+    batch->timeline = &m_transferTimeline;
+    batch->timelineValue = transferValue;
+  }
+
+  m_inFlight.push_back(std::move(batch));
+}
+
+void BG::UploadEngine::RetireLocked(bool wait)
+{
+  while (!m_inFlight.empty())
+  {
+    auto& batch = *m_inFlight.front();
+
+    if (wait)
+    {
+      batch.timeline->Wait(batch.timelineValue);
+    }
+    else if (!batch.timeline->IsComplete(batch.timelineValue))
+    {
+      break;
+    }
+
+    m_completedBatchId = batch.id;
+    m_ringTail = batch.ringEnd;
+
+    batch.dedicatedStaging.clear();
+    batch.transferCmd->reset();
+    if (m_ownershipTransfer) batch.acquireCmd->reset();
+
+    m_freeBatches.push_back(std::move(m_inFlight.front()));
+    m_inFlight.pop_front();
+
+    // Only block for the oldest batch
+    if (wait) break;
+  }
+}
+
+std::pair<vk::Buffer, uint64_t> BG::UploadEngine::AllocStagingLocked(const void* data, size_t size)
+{
+  if (size > m_ringSize)
+  {
+    auto staging = m_allocator.AllocCPU2GPU(size, vk::BufferUsageFlagBits::eTransferSrc);
+    std::memcpy(staging->Map<uint8_t>(), data, size);
+    staging->UnMap();
+
+    vk::Buffer buffer = staging->buffer;
+    CurrentBatch().dedicatedStaging.push_back(std::move(staging));
+
+    return { buffer, 0 };
+  }
+
+  while (true)
+  {
+    RetireLocked(false);
+
+    // Nothing outstanding, start over at the beginning of the ring
+    if (!m_current && m_inFlight.empty()) m_ringHead = m_ringTail = 0;
+
+    // Ring positions are virtual and only wrapped when addressing the buffer
+    uint64_t offset = (m_ringHead + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+
+    // Allocations never straddle the end of the ring
+    if (offset % m_ringSize + size > m_ringSize) offset = (offset / m_ringSize + 1) * m_ringSize;
+
+    if (offset + size - m_ringTail <= m_ringSize)
+    {
+      m_ringHead = offset + size;
+      std::memcpy(m_ringMapped + offset % m_ringSize, data, size);
+
+      return { m_ring->buffer, offset % m_ringSize };
+    }
+
+    // Ring is full, submit what we have and wait for the oldest batch to free its space
+    FlushLocked();
+    RetireLocked(true);
+  }
+}
+
+UploadEngine::Ticket BG::UploadEngine::UploadImage(const Image& image, const void* data, size_t size, glm::uvec2 extent, vk::ImageLayout finalLayout)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto staging = AllocStagingLocked(data, size);
+
+  auto& batch = CurrentBatch();
+  vk::CommandBuffer cmd = batch.transferCmd.get();
+
+  vk::ImageSubresourceRange range;
+  range.aspectMask = vk::ImageAspectFlagBits::eColor;
+  range.baseMipLevel = 0;
+  range.levelCount = 1;
+  range.baseArrayLayer = 0;
+  range.layerCount = 1;
+
+  vk::ImageMemoryBarrier toTransfer;
+  toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+  toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+  toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.image = image.image;
+  toTransfer.subresourceRange = range;
+  toTransfer.srcAccessMask = vk::AccessFlags(0);
+  toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(0), 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+  vk::BufferImageCopy copy;
+  copy.bufferOffset = staging.second;
+  copy.bufferRowLength = extent.x;
+  copy.bufferImageHeight = extent.y;
+  copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+  copy.imageSubresource.mipLevel = 0;
+  copy.imageSubresource.baseArrayLayer = 0;
+  copy.imageSubresource.layerCount = 1;
+  copy.imageExtent = vk::Extent3D{ extent.x, extent.y, 1 };
+  copy.imageOffset = vk::Offset3D{ 0, 0, 0 };
+
+  cmd.copyBufferToImage(staging.first, image.image, vk::ImageLayout::eTransferDstOptimal, 1, &copy);
+
+  vk::ImageMemoryBarrier toFinal;
+  toFinal.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+  toFinal.newLayout = finalLayout;
+  toFinal.image = image.image;
+  toFinal.subresourceRange = range;
+
+  if (m_ownershipTransfer)
+  {
+    // Release on the transfer queue, then the matching acquire on the graphics queue
+    toFinal.srcQueueFamilyIndex = m_transferFamily;
+    toFinal.dstQueueFamilyIndex = m_graphicsFamily;
+    toFinal.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toFinal.dstAccessMask = vk::AccessFlags(0);
+
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(0), 0, nullptr, 0, nullptr, 1, &toFinal);
+
+    toFinal.srcAccessMask = vk::AccessFlags(0);
+    toFinal.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    batch.acquireCmd->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, consumerStages, vk::DependencyFlags(0), 0, nullptr, 0, nullptr, 1, &toFinal);
+  }
+  else
+  {
+    toFinal.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toFinal.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toFinal.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toFinal.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, consumerStages, vk::DependencyFlags(0), 0, nullptr, 0, nullptr, 1, &toFinal);
+  }
+
+  return Ticket{ batch.id };
+}
+
+UploadEngine::Ticket BG::UploadEngine::UploadBuffer(const Buffer& buffer, const void* data, size_t size, size_t dstOffset)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  auto staging = AllocStagingLocked(data, size);
+
+  auto& batch = CurrentBatch();
+  vk::CommandBuffer cmd = batch.transferCmd.get();
+
+  vk::BufferCopy copy;
+  copy.srcOffset = staging.second;
+  copy.dstOffset = dstOffset;
+  copy.size = size;
+
+  cmd.copyBuffer(staging.first, buffer.buffer, 1, &copy);
+
+  const vk::AccessFlags consumerAccess =
+    vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+    vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead;
+
+  vk::BufferMemoryBarrier barrier;
+  barrier.buffer = buffer.buffer;
+  barrier.offset = dstOffset;
+  barrier.size = size;
+
+  if (m_ownershipTransfer)
+  {
+    barrier.srcQueueFamilyIndex = m_transferFamily;
+    barrier.dstQueueFamilyIndex = m_graphicsFamily;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlags(0);
+
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(0), 0, nullptr, 1, &barrier, 0, nullptr);
+
+    barrier.srcAccessMask = vk::AccessFlags(0);
+    barrier.dstAccessMask = consumerAccess;
+
+    batch.acquireCmd->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, consumerStages, vk::DependencyFlags(0), 0, nullptr, 1, &barrier, 0, nullptr);
+  }
+  else
+  {
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = consumerAccess;
+
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, consumerStages, vk::DependencyFlags(0), 0, nullptr, 1, &barrier, 0, nullptr);
+  }
+
+  return Ticket{ batch.id };
+}
+
+void BG::UploadEngine::Flush()
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  FlushLocked();
+  RetireLocked(false);
+}
+
+bool BG::UploadEngine::IsComplete(Ticket ticket)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  RetireLocked(false);
+
+  return ticket.batch <= m_completedBatchId;
+}
+
+void BG::UploadEngine::Wait(Ticket ticket)
+{
+  std::lock_guard<std::mutex> lk(m_mutex);
+
+  if (m_current && ticket.batch >= m_current->id) FlushLocked();
+
+  while (ticket.batch > m_completedBatchId && !m_inFlight.empty())
+  {
+    RetireLocked(true);
+  }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "berkeley_gfx.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <mutex>
+
+namespace BG
+{
+
+  // Streams data to the GPU through a persistently mapped staging ring.
+  // Copies are batched into one command buffer on the transfer queue and submitted by Flush().
+  // When the transfer queue is a separate family, ownership is released on the transfer queue
+  // and acquired on the graphics queue, so uploaded resources are ready for the next frame submit.
+  // Uploads may be queued from any thread. A full ring flushes from the caller's thread, which is safe
+  // because every submit and present goes through the queue's Timeline lock.
+  class UploadEngine
+  {
+  public:
+    struct Ticket
+    {
+      uint64_t batch = 0;
+    };
+
+  private:
+    struct Batch
+    {
+      uint64_t id = 0;
+      vk::UniqueCommandBuffer transferCmd;
+      vk::UniqueCommandBuffer acquireCmd;
+
+      // The batch is done once this timeline reaches the value (graphics when ownership is acquired there)
+      Timeline* timeline = nullptr;
+      uint64_t timelineValue = 0;
+
+      // Virtual ring position after the last staging allocation of this batch
+      uint64_t ringEnd = 0;
+
+      // Uploads bigger than the ring get their own staging buffer
+      std::vector<std::unique_ptr<Buffer>> dedicatedStaging;
+    };
+
+    vk::Device m_device;
+    MemoryAllocator& m_allocator;
+
+    Timeline& m_transferTimeline;
+    Timeline& m_graphicsTimeline;
+    uint32_t m_transferFamily, m_graphicsFamily;
+    bool m_ownershipTransfer;
+
+    vk::UniqueCommandPool m_transferCmdPool;
+    vk::UniqueCommandPool m_acquireCmdPool;
+
+    std::unique_ptr<Buffer> m_ring;
+    uint8_t* m_ringMapped = nullptr;
+    uint64_t m_ringSize;
+    uint64_t m_ringHead = 0, m_ringTail = 0;
+
+    std::mutex m_mutex;
+
+    uint64_t m_nextBatchId = 1;
+    uint64_t m_completedBatchId = 0;
+    std::unique_ptr<Batch> m_current;
+    std::deque<std::unique_ptr<Batch>> m_inFlight;
+    std::vector<std::unique_ptr<Batch>> m_freeBatches;
+
+    Batch& CurrentBatch();
+    void FlushLocked();
+    void RetireLocked(bool wait);
+    // Returns the staging buffer and offset for size bytes, flushing / waiting when the ring is full
+    std::pair<vk::Buffer, uint64_t> AllocStagingLocked(const void* data, size_t size);
+
+  public:
+    UploadEngine(
+      vk::Device device, MemoryAllocator& allocator,
+      Timeline& transferTimeline, uint32_t transferFamily,
+      Timeline& graphicsTimeline, uint32_t graphicsFamily,
+      size_t ringSize = 48ull * 1024 * 1024);
+    ~UploadEngine();
+
+    // Leaves the image in finalLayout, owned by the graphics queue family
+    Ticket UploadImage(
+      const Image& image, const void* data, size_t size, glm::uvec2 extent,
+      vk::ImageLayout finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    Ticket UploadBuffer(const Buffer& buffer, const void* data, size_t size, size_t dstOffset = 0);
+
+    // Submits everything queued so far
+    void Flush();
+
+    bool IsComplete(Ticket ticket);
+    void Wait(Ticket ticket);
+  };
+
+}
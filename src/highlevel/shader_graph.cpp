@@ -4,11 +4,19 @@
 #include "command_buffer.hpp"
 #include "pipelines.hpp"
 #include "buffer.hpp"
+#include "descriptor_writer.hpp"
+#include "uniform_ring.hpp"
+#include "framebuffer_cache.hpp"
 
 #include <json.hpp>
 #include <imgui/imgui.h>
+#include <algorithm>
+#include <climits>
 #include <fstream>
 #include <filesystem>
+#include <functional>
+#include <regex>
+#include <tuple>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
@@ -38,7 +46,7 @@ void FloatParameter::RenderGUI()
 
 void FloatParameter::PushParameter(CommandBuffer& cmdBuf, Pipeline& p)
 {
-  cmdBuf.PushConstants(p, vk::ShaderStageFlagBits::eFragment, p.GetMemberOffset(name), value);
+  cmdBuf.PushConstants(p, p.IsCompute() ? vk::ShaderStageFlagBits::eCompute : vk::ShaderStageFlagBits::eFragment, p.GetMemberOffset(name), value);
 }
 
 void Vec3Parameter::RenderGUI()
@@ -54,7 +62,7 @@ void Vec3Parameter::RenderGUI()
 
 void Vec3Parameter::PushParameter(CommandBuffer& cmdBuf, Pipeline& p)
 {
-  cmdBuf.PushConstants(p, vk::ShaderStageFlagBits::eFragment, p.GetMemberOffset(name), value);
+  cmdBuf.PushConstants(p, p.IsCompute() ? vk::ShaderStageFlagBits::eCompute : vk::ShaderStageFlagBits::eFragment, p.GetMemberOffset(name), value);
 }
 
 std::string fullscreenVertexShader = R"V0G0N(
@@ -76,41 +84,269 @@ void main() {
 
 )V0G0N";
 
-void BG::ShaderGraph::Graph::CreateTexture(glm::uvec2 extent, vk::Format format, Renderer& r, std::string name)
+// Where graph textures are read or written. Transient textures are shared by the frames in flight and alias
+// each other's memory, so a write has to wait for every earlier access to the image, the previous frame's included
+static const vk::PipelineStageFlags TextureAccessStages =
+  vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader;
+
+static glm::uvec2 ScaleExtent(glm::uvec2 extent, float scale)
+{
+  return glm::max(glm::uvec2(glm::vec2(extent) * scale), glm::uvec2(1));
+}
+
+// Mip 0 shares the key of the texture itself
+static std::string DependencyKey(const std::string& name, int mip)
+{
+  return mip > 0 ? fmt::format("{}@mip{}", name, mip) : name;
+}
+
+// Either the texture name or { "name": ..., "mip": ..., "uniform": ... }
+static TextureBinding ParseTextureBinding(const nlohmann::json& j)
+{
+  TextureBinding textureBinding;
+  textureBinding.binding = 0;
+
+  if (j.is_string())
+  {
+    textureBinding.name = j.get<std::string>();
+    textureBinding.uniformName = textureBinding.name;
+  }
+  else
+  {
+    j.at("name").get_to(textureBinding.name);
+    textureBinding.mip = j.value("mip", -1);
+    textureBinding.uniformName = j.value("uniform", textureBinding.name);
+  }
+
+  return textureBinding;
+}
+
+void BG::ShaderGraph::Graph::CreateTexture(glm::uvec2 extent, vk::Format format, Renderer& r, std::string name, float scale, uint32_t mipLevels)
 {
+  // Images are allocated once the plan is known, see AllocateTextures
   auto texture = std::make_shared<Texture>();
+  texture->extent = scale > 0.0f ? ScaleExtent(swapchainExtent, scale) : extent;
+  texture->format = format;
+  texture->name = name;
+  texture->scale = scale;
+  texture->mipLevels = mipLevels;
+
+  this->textures[name] = texture;
+}
+
+void Graph::AllocateTextures()
+{
+  auto& allocator = r.getMemoryAllocator();
+
+  auto getUsage = [](Texture* texture) {
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled;
+    if (texture->isStorage) usage |= vk::ImageUsageFlagBits::eStorage;
+    if (texture->isInputAttachment) usage |= vk::ImageUsageFlagBits::eInputAttachment;
+    return usage;
+  };
+
+  // Lifetimes in plan order, from the pass writing a texture to the last pass reading it in the same frame
+  struct Lifetime
+  {
+    int first = INT_MAX;
+    int last = -1;
+  };
+
+  std::unordered_map<Texture*, Lifetime> lifetimes;
+
+  for (int i = 0; i < int(plan.size()); i++)
+  {
+    for (auto& output : plan[i].outputs)
+    {
+      if (!output.texture) continue;
+      lifetimes[output.texture].first = std::min(lifetimes[output.texture].first, i);
+      lifetimes[output.texture].last = std::max(lifetimes[output.texture].last, i);
+    }
 
-  for (int i = 0; i < r.getSwapchainImages().size(); i++)
+    for (auto& input : plan[i].inputs)
+    {
+      if (!input.texture->isInternal) continue;
+
+      if (input.previous)
+        input.texture->isHistory = true;
+      else
+        lifetimes[input.texture].last = std::max(lifetimes[input.texture].last, i);
+    }
+  }
+
+  // A subpass group is a single render pass, its attachments are all bound from its first subpass to its last
+  for (auto& group : groups)
   {
-    auto image = r.getMemoryAllocator().AllocImage2D(extent, 1, format, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled, vk::ImageLayout::eUndefined);
+    for (auto& attachment : group.attachments)
+    {
+      auto it = lifetimes.find(attachment.texture);
+      if (it == lifetimes.end()) continue;
 
-    auto _cmdBuf = r.AllocCmdBuffer();
-    CommandBuffer cmdBuf(r.getDevice(), _cmdBuf.get(), r.getTracker());
+      it->second.first = std::min(it->second.first, int(group.first));
+      it->second.last = std::max(it->second.last, int(group.first + group.count) - 1);
+    }
+  }
 
-    cmdBuf.Begin();
-    cmdBuf.ImageTransition(*image, vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eTopOfPipe, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal);
-    cmdBuf.End();
+  std::vector<Texture*> transient;
+  size_t historyBytes = 0;
 
-    r.SubmitCmdBufferNow(cmdBuf.GetVkCmdBuf());
+  for (auto& pair : textures)
+  {
+    Texture* texture = pair.second.get();
 
-    vk::ImageViewCreateInfo viewInfo;
-    viewInfo.image = image->image;
-    viewInfo.viewType = vk::ImageViewType::e2D;
-    viewInfo.format = format;
-    viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
+    if (!texture->isInternal) continue;
 
-    texture->image.push_back(std::move(image));
-    texture->imageView.push_back(r.getDevice().createImageView(viewInfo));
-    texture->extent = extent;
-    texture->format = format;
-    texture->name = name;
+    if (texture->isHistory)
+    {
+      for (int i = 0; i < 2; i++)
+      {
+        texture->image.push_back(allocator.AllocImage2D(texture->extent, texture->mipLevels, texture->format, getUsage(texture)));
+        historyBytes += allocator.GetMemoryRequirements(*texture->image.back()).size;
+      }
+    }
+    else if (lifetimes.find(texture) != lifetimes.end())
+    {
+      transient.push_back(texture);
+    }
   }
 
-  this->textures[name] = texture;
+  std::sort(transient.begin(), transient.end(), [&](Texture* a, Texture* b) { return lifetimes[a].first < lifetimes[b].first; });
+
+  // Greedy interval assignment: a texture takes over the memory of one whose last read is before its first write.
+  // Best fit by size, the slot grows when none is large enough
+  struct Slot
+  {
+    vk::MemoryRequirements requirements;
+    int last;
+    std::vector<BG::Image*> images;
+  };
+
+  std::vector<Slot> slots;
+  size_t unaliasedBytes = 0;
+
+  for (auto texture : transient)
+  {
+    auto& lifetime = lifetimes[texture];
+
+    texture->image.push_back(allocator.CreateUnboundImage2D(texture->extent, texture->mipLevels, texture->format, getUsage(texture)));
+    auto requirements = allocator.GetMemoryRequirements(*texture->image.back());
+    unaliasedBytes += requirements.size;
+
+    auto better = [&](const Slot& a, const Slot& b) {
+      bool aFits = a.requirements.size >= requirements.size;
+      bool bFits = b.requirements.size >= requirements.size;
+      if (aFits != bFits) return aFits;
+      return aFits ? a.requirements.size < b.requirements.size : a.requirements.size > b.requirements.size;
+    };
+
+    int best = -1;
+    for (int i = 0; i < int(slots.size()); i++)
+    {
+      if (slots[i].last >= lifetime.first) continue;
+      if ((slots[i].requirements.memoryTypeBits & requirements.memoryTypeBits) == 0) continue;
+      if (best < 0 || better(slots[i], slots[best])) best = i;
+    }
+
+    if (best < 0)
+    {
+      slots.push_back({ requirements, lifetime.last, {} });
+      best = int(slots.size()) - 1;
+    }
+    else
+    {
+      auto& slot = slots[best];
+      slot.requirements.size = std::max(slot.requirements.size, requirements.size);
+      slot.requirements.alignment = std::max(slot.requirements.alignment, requirements.alignment);
+      slot.requirements.memoryTypeBits &= requirements.memoryTypeBits;
+      slot.last = lifetime.last;
+    }
+
+    slots[best].images.push_back(texture->image.back().get());
+  }
+
+  size_t aliasedBytes = 0;
+
+  for (auto& slot : slots)
+  {
+    VmaAllocation memory = allocator.AllocMemory(slot.requirements);
+    aliasedMemory.push_back(memory);
+    aliasedBytes += slot.requirements.size;
+
+    for (auto image : slot.images)
+    {
+      allocator.BindImageMemory(*image, memory);
+    }
+  }
+
+  spdlog::info("Shader graph: {} transient textures in {} KB ({} KB without aliasing), {} history textures in {} KB",
+    transient.size(), aliasedBytes / 1024, unaliasedBytes / 1024,
+    std::count_if(textures.begin(), textures.end(), [](auto& pair) { return pair.second->isHistory; }), historyBytes / 1024);
+
+  // Views & initial layout
+  auto _cmdBuf = r.AllocCmdBuffer();
+  CommandBuffer cmdBuf(r.getDevice(), _cmdBuf.get(), r.getTracker());
+
+  cmdBuf.Begin();
+
+  for (auto& pair : textures)
+  {
+    auto& texture = pair.second;
+
+    if (!texture->isInternal) continue;
+
+    for (auto& image : texture->image)
+    {
+      cmdBuf.ImageTransition(*image, vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eTopOfPipe, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal, 0, texture->mipLevels);
+
+      // The whole chain for sampling, then one view per mip to render into, see Texture::GetView
+      for (int mip = -1; mip < int(texture->mipLevels); mip++)
+      {
+        if (mip >= 0 && texture->mipLevels == 1) break;
+
+        vk::ImageViewCreateInfo viewInfo;
+        viewInfo.image = image->image;
+        viewInfo.viewType = vk::ImageViewType::e2D;
+        viewInfo.format = texture->format;
+        viewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+        viewInfo.subresourceRange.baseMipLevel = mip < 0 ? 0 : mip;
+        viewInfo.subresourceRange.levelCount = mip < 0 ? texture->mipLevels : 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        texture->imageView.push_back(r.getDevice().createImageView(viewInfo));
+      }
+    }
+  }
+
+  cmdBuf.End();
+
+  r.SubmitCmdBufferNow(cmdBuf.GetVkCmdBuf());
+}
+
+void Graph::ReleaseTextures()
+{
+  for (auto pair : textures)
+  {
+    if (pair.second->isInternal)
+    {
+      for (auto imageView : pair.second->imageView)
+      {
+        r.getFramebufferCache().InvalidateView(imageView);
+        r.getDevice().destroyImageView(imageView);
+      }
+
+      pair.second->imageView.clear();
+      pair.second->image.clear();
+    }
+  }
+
+  // After every image bound to it
+  for (auto memory : aliasedMemory)
+  {
+    r.getMemoryAllocator().FreeMemory(memory);
+  }
+
+  aliasedMemory.clear();
 }
 
 Graph::Graph(std::string jsonFile, Renderer& r)
@@ -135,6 +371,8 @@ Graph::Graph(std::string jsonFile, Renderer& r)
   std::filesystem::path jsonPath = jsonFile;
   jsonPath.remove_filename();
 
+  swapchainExtent = glm::uvec2(r.getWidth(), r.getHeight());
+
   // Load custom textures
   for (auto jsonPairTexture : j["images"].items())
   {
@@ -157,23 +395,23 @@ Graph::Graph(std::string jsonFile, Renderer& r)
       texture->extent = glm::uvec2(imageWidth, imageHeight);
       texture->isInternal = false;
 
-      for (int i = 0; i < r.getSwapchainImages().size(); i++)
-      {
-        texture->imageView.push_back(r.getTextureSystem().GetImageView(handle));
-      }
+      texture->imageView.push_back(r.getTextureSystem().GetImageView(handle));
 
       textures[name] = texture;
 
       continue;
     }
 
-    glm::uvec2 extent = glm::uvec2(r.getWidth(), r.getHeight());
+    glm::uvec2 extent = swapchainExtent;
     vk::Format format = r.getSwapChainFormat();
+    float scale = image.value("scale", 1.0f);
+    uint32_t mipLevels = image.value("mips", 1u);
 
     if (image.find("resolution") != image.end())
     {
       image.at("resolution")[0].get_to(extent.x);
       image.at("resolution")[1].get_to(extent.y);
+      scale = 0.0f;
     }
 
     if (image.find("format") != image.end())
@@ -230,9 +468,10 @@ Graph::Graph(std::string jsonFile, Renderer& r)
       }
     }
 
-    spdlog::debug("Texture image {}, resolution={}x{}, format={}", name, extent.x, extent.y, format);
+    CreateTexture(extent, format, r, name, scale, std::max(mipLevels, 1u));
 
-    CreateTexture(extent, format, r, name);
+    extent = textures[name]->extent;
+    spdlog::debug("Texture image {}, resolution={}x{}, scale={}, mips={}, format={}", name, extent.x, extent.y, scale, mipLevels, format);
   }
 
   // Load in stages
@@ -243,6 +482,7 @@ Graph::Graph(std::string jsonFile, Renderer& r)
 
     auto jsonStage = jsonPairStage.value();
     jsonStage.at("shader").get_to(stage->shaderFile);
+    stage->isCompute = jsonStage.value("type", std::string("fragment")) == "compute";
 
     stages[stage->name] = stage;
 
@@ -288,9 +528,9 @@ Graph::Graph(std::string jsonFile, Renderer& r)
     }
 
     // Load in textures (sampled)
-    for (std::string texture : jsonStage["textures"])
+    for (auto& texture : jsonStage["textures"])
     {
-      stage->texture.push_back(TextureBinding{ texture, 0 });
+      stage->texture.push_back(ParseTextureBinding(texture));
     }
 
     // Load in shader text & construct pipeline & ouput texture/view
@@ -303,185 +543,759 @@ Graph::Graph(std::string jsonFile, Renderer& r)
 
       spdlog::debug("Shader stage {}", stage->name);
 
-      glm::uvec2 extent = glm::uvec2(r.getWidth(), r.getHeight());
+      // Found before the pipeline is built, stages reading their inputs at the same pixel may share a render pass
+      static const std::regex subpassInputPattern(R"(input_attachment_index\s*=\s*(\d+)[^)]*\)\s*uniform\s+subpassInput\s+(\w+))");
+      for (std::sregex_iterator it(shaderText.begin(), shaderText.end(), subpassInputPattern); it != std::sregex_iterator(); ++it)
+      {
+        stage->inputAttachments[(*it)[2].str()] = uint32_t(std::stoul((*it)[1].str()));
+      }
+
+      // Outputs the images section doesn't declare are created at the stage's scale
+      float scale = jsonStage.value("scale", 1.0f);
 
       stage->pipeline = r.CreatePipeline();
-      stage->pipeline->AddFragmentShaders(shaderText);
-      stage->pipeline->AddVertexShaders(fullscreenVertexShader);
 
-      for (std::string outputName : jsonStage["output"])
+      if (stage->isCompute)
+      {
+        stage->pipeline->AddComputeShaders(shaderText, true);
+      }
+      else
+      {
+        stage->pipeline->AddFragmentShaders(shaderText, true);
+        stage->pipeline->AddVertexShaders(fullscreenVertexShader, true);
+      }
+
+      for (auto& jsonOutput : jsonStage["output"])
       {
-        vk::Format format = r.getSwapChainFormat();
+        auto output = ParseTextureBinding(jsonOutput);
+        auto& outputName = output.name;
+        output.mip = std::max(output.mip, 0);
+
+        // The swapchain formats usually can't be storage images
+        vk::Format format = stage->isCompute ? vk::Format::eR8G8B8A8Unorm : r.getSwapChainFormat();
         
         if (this->textures.find(outputName) == this->textures.end())
         {
-          CreateTexture(extent, format, r, outputName);
+          CreateTexture(swapchainExtent, format, r, outputName, outputName == "framebuffer" ? 1.0f : scale);
         }
         else
         {
-          extent = this->textures[outputName]->extent;
           format = this->textures[outputName]->format;
         }
 
-        this->dependency[outputName] = stage->name;
+        if (uint32_t(output.mip) >= this->textures[outputName]->mipLevels)
+        {
+          spdlog::error("Stage {} renders to mip {} of {}, which has {} mips", stage->name, output.mip, outputName, this->textures[outputName]->mipLevels);
+          throw std::runtime_error("Bad output mip");
+        }
+
+        this->dependency[DependencyKey(outputName, output.mip)] = stage->name;
+        stage->outputs.push_back(output);
 
-        if (outputName == "framebuffer")
+        if (stage->isCompute)
+        {
+          if (outputName == "framebuffer")
+          {
+            spdlog::error("Compute stage {} can't write to the framebuffer", stage->name);
+            throw std::runtime_error("Compute stage writing to the framebuffer");
+          }
+
+          this->textures[outputName]->isStorage = true;
+        }
+        else if (outputName == "framebuffer")
           stage->pipeline->AddAttachment(format, vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR);
         else
           stage->pipeline->AddAttachment(format, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal);
       }
 
-      stage->pipeline->SetViewport(float(extent.x), float(extent.y));
-      stage->pipeline->BuildPipeline();
+      stage->pipeline->UsePushDescriptors();
+
+      // Set per pass, so one pipeline can render at several sizes
+      if (!stage->isCompute) stage->pipeline->UseDynamicViewport();
+    }
+  }
+
+  CompilePlan();
+  MergeSubpasses();
+
+  for (auto& pair : stages)
+  {
+    auto& stage = pair.second;
+
+    // Stages only need the attachment formats, no render pass per stage when supported.
+    // Input attachments need a render pass
+    if (!stage->isCompute && !stage->pipeline->HasExternalRenderPass() && stage->inputAttachments.empty())
+      stage->pipeline->UseDynamicRendering();
+
+    // All stages compile in parallel, see IsReady
+    stage->pipeline->BuildPipelineAsync();
+  }
+
+  AllocateTextures();
+  
+  startTime = std::chrono::steady_clock::now();
+}
+
+void Graph::CompilePlan()
+{
+  // Depth first from the framebuffer, a stage is appended after every stage it reads from
+  enum class Mark { None, Visiting, Done };
+  std::unordered_map<Stage*, Mark> marks;
+
+  std::function<void(const std::string&, int)> visit = [&](const std::string& output, int mip) {
+    auto producer = dependency.find(DependencyKey(output, mip));
+    if (producer == dependency.end())
+    {
+      spdlog::error("No stage renders to {} (mip {})", output, mip);
+      throw std::runtime_error("Missing shader graph output");
+    }
+
+    Stage* stage = stages[producer->second].get();
+
+    if (marks[stage] == Mark::Done) return;
+    if (marks[stage] == Mark::Visiting)
+    {
+      spdlog::error("Shader graph has a cycle through stage {}", stage->name);
+      throw std::runtime_error("Shader graph cycle");
+    }
+
+    marks[stage] = Mark::Visiting;
+
+    Pass pass;
+    pass.stage = stage;
+    pass.pipeline = stage->pipeline.get();
+    pass.extent = textures[stage->outputs[0].name]->GetMipExtent(stage->outputs[0].mip);
+
+    for (auto& output : stage->outputs)
+    {
+      pass.outputs.push_back({ output.name == "framebuffer" ? nullptr : textures[output.name].get(), output.mip });
+    }
+
+    for (auto& textureBinding : stage->texture)
+    {
+      bool previous = textureBinding.name.rfind("previous_", 0) == 0;
+      std::string textureName = previous ? textureBinding.name.substr(9) : textureBinding.name;
+
+      auto texture = textures.find(textureName);
+      if (texture == textures.end())
+      {
+        spdlog::error("Stage {} reads unknown texture {}", stage->name, textureBinding.name);
+        throw std::runtime_error("Unknown texture");
+      }
+
+      if (textureBinding.mip >= int(texture->second->mipLevels))
+      {
+        spdlog::error("Stage {} reads mip {} of {}, which has {} mips", stage->name, textureBinding.mip, textureName, texture->second->mipLevels);
+        throw std::runtime_error("Bad input mip");
+      }
+
+      int attachmentIndex = -1;
+      int inputMip = textureBinding.mip;
+
+      auto inputAttachment = stage->inputAttachments.find(textureBinding.uniformName);
+      if (inputAttachment != stage->inputAttachments.end())
+      {
+        if (previous || !texture->second->isInternal || (inputMip < 0 && texture->second->mipLevels > 1))
+        {
+          spdlog::error("Stage {} reads {} as a subpassInput, only a single mip rendered in the same frame can be", stage->name, textureBinding.name);
+          throw std::runtime_error("Bad input attachment");
+        }
+
+        attachmentIndex = int(inputAttachment->second);
+        inputMip = std::max(inputMip, 0);
+        texture->second->isInputAttachment = true;
+      }
 
-      // Map bindings
-      for (auto& textureBinding : stage->texture)
+      // Last frame's contents need no ordering. Reading the whole chain waits for every mip
+      if (!previous && texture->second->isInternal)
       {
-        textureBinding.binding = stage->pipeline->GetBindingByName(textureBinding.name);
+        if (textureBinding.mip >= 0)
+          visit(textureName, textureBinding.mip);
+        else
+          for (int level = 0; level < int(texture->second->mipLevels); level++) visit(textureName, level);
       }
 
-      stage->builtinParamBindPoint = stage->pipeline->GetBindingByName("iTime");
+      // Bindings are filled in once the pipeline is built, see IsReady
+      pass.inputs.push_back({ texture->second.get(), 0, previous, inputMip, attachmentIndex });
     }
-  
-    // Verify all bindings
-    for (auto textureBinding : stage->texture)
+
+    for (auto& inputAttachment : stage->inputAttachments)
     {
-      if (textureBinding.binding > 1024)
+      if (std::none_of(stage->texture.begin(), stage->texture.end(), [&](auto& t) { return t.uniformName == inputAttachment.first; }))
       {
-        spdlog::error("Bad texture binding! Check whether the uniform name matches the name in the JSON file ({} in stage {})", textureBinding.name, stage->name);
-        throw std::runtime_error("Bad binding");
+        spdlog::error("Stage {} declares the subpassInput {}, which is not in its textures", stage->name, inputAttachment.first);
+        throw std::runtime_error("Unknown input attachment");
       }
     }
 
-  }
-  
-  startTime = std::chrono::steady_clock::now();
+    marks[stage] = Mark::Done;
+    plan.push_back(pass);
+  };
+
+  visit("framebuffer", 0);
+
+  spdlog::debug("Shader graph plan: {} of {} stages", plan.size(), stages.size());
 }
 
-BG::ShaderGraph::Graph::~Graph()
+// Render target size as it is derived, equal keys are the same size for any swapchain size
+static std::tuple<float, int, glm::uvec2> GetSizeKey(const Pass& pass)
 {
-  for (auto pair : textures)
+  auto& output = pass.outputs[0];
+  if (!output.texture) return { 1.0f, 0, glm::uvec2(0) };
+  return { output.texture->scale, output.mip, output.texture->scale > 0.0f ? glm::uvec2(0) : pass.extent };
+}
+
+bool Graph::CanJoinGroup(size_t first, size_t index)
+{
+  auto& pass = plan[index];
+
+  if (pass.pipeline->IsCompute() || GetSizeKey(pass) != GetSizeKey(plan[first])) return false;
+
+  auto writtenInGroup = [&](Texture* texture, int mip) {
+    for (size_t i = first; i < index; i++)
+    {
+      for (auto& output : plan[i].outputs)
+      {
+        if (output.texture == texture && (mip < 0 || output.mip == mip)) return true;
+      }
+    }
+    return false;
+  };
+
+  // Only chains: the pass has to read an earlier subpass at the same pixel, and may sample nothing the group renders
+  bool readsGroup = false;
+
+  for (auto& input : pass.inputs)
   {
-    if (pair.second->isInternal)
+    if (input.previous || !writtenInGroup(input.texture, input.attachmentIndex >= 0 ? input.mip : -1)) continue;
+    if (input.attachmentIndex < 0) return false;
+    readsGroup = true;
+  }
+
+  if (!readsGroup) return false;
+
+  // Nothing in the group may touch what the pass renders to
+  for (auto& output : pass.outputs)
+  {
+    if (!output.texture) continue;
+    if (writtenInGroup(output.texture, -1)) return false;
+
+    for (size_t i = first; i < index; i++)
     {
-      for (auto imageView : pair.second->imageView)
+      for (auto& input : plan[i].inputs)
       {
-        r.getDevice().destroyImageView(imageView);
+        if (input.texture == output.texture && !input.previous) return false;
       }
     }
   }
+
+  return true;
 }
 
-void Graph::Render(Renderer& r, Renderer::Context& ctx, std::string target)
+void Graph::CreateSubpassGroup(size_t first, size_t end)
 {
-  std::vector<vk::ImageView> renderTarget;
+  SubpassGroup group;
+  group.first = first;
+  group.count = end - first;
+
+  std::vector<vk::AttachmentDescription> descriptions;
 
-  auto texture = this->textures[target];
+  auto findAttachment = [&](Texture* texture, int mip) {
+    for (size_t i = 0; i < group.attachments.size(); i++)
+    {
+      if (group.attachments[i].texture == texture && group.attachments[i].mip == mip) return int(i);
+    }
+    return -1;
+  };
+
+  // Stored when the framebuffer, a pass after the group or the next frame reads it
+  auto readOutside = [&](Texture* texture) {
+    if (!texture) return true;
+
+    for (size_t i = 0; i < plan.size(); i++)
+    {
+      for (auto& input : plan[i].inputs)
+      {
+        if (input.texture == texture && (input.previous || i < first || i >= end)) return true;
+      }
+    }
+    return false;
+  };
 
-  if (target == "framebuffer")
+  for (size_t i = first; i < end; i++)
   {
-    renderTarget.push_back(ctx.imageView);
+    group.name += (i > first ? "+" : "") + plan[i].stage->name;
+
+    for (auto& output : plan[i].outputs)
+    {
+      vk::AttachmentDescription attachment;
+      attachment.format = output.texture ? output.texture->format : r.getSwapChainFormat();
+      attachment.samples = vk::SampleCountFlagBits::e1;
+      attachment.loadOp = vk::AttachmentLoadOp::eClear;
+      attachment.storeOp = readOutside(output.texture) ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+      attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+      attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+      attachment.initialLayout = vk::ImageLayout::eUndefined;
+      attachment.finalLayout = output.texture ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::ePresentSrcKHR;
+
+      descriptions.push_back(attachment);
+      group.attachments.push_back(output);
+    }
   }
-  else
+
+  size_t outputCount = group.attachments.size();
+
+  // Input attachments rendered before the group are loaded, and stay in eShaderReadOnlyOptimal
+  for (size_t i = first; i < end; i++)
   {
-    renderTarget.push_back(texture->imageView[ctx.imageIndex]);
+    for (auto& input : plan[i].inputs)
+    {
+      if (input.attachmentIndex < 0 || findAttachment(input.texture, input.mip) >= 0) continue;
+
+      vk::AttachmentDescription attachment;
+      attachment.format = input.texture->format;
+      attachment.samples = vk::SampleCountFlagBits::e1;
+      attachment.loadOp = vk::AttachmentLoadOp::eLoad;
+      attachment.storeOp = vk::AttachmentStoreOp::eStore;
+      attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+      attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+      attachment.initialLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+      attachment.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+      descriptions.push_back(attachment);
+      group.attachments.push_back({ input.texture, input.mip });
+    }
   }
 
-  std::string stageName = this->dependency[target];
-  auto stage = this->stages[stageName];
+  std::vector<std::vector<vk::AttachmentReference>> colorRefs(group.count), inputRefs(group.count);
+  std::vector<std::vector<uint32_t>> preserveRefs(group.count);
+  std::vector<std::vector<bool>> uses(group.count, std::vector<bool>(group.attachments.size(), false));
+  std::vector<vk::SubpassDependency> dependencies;
+
+  // Subpass that renders each attachment, -1 for loaded ones
+  std::vector<int> producers(group.attachments.size(), -1);
 
-  // Graph dependency
-  for (auto& textureBinding : stage->texture)
+  for (size_t s = 0; s < group.count; s++)
   {
-    if (textureBinding.name.rfind("previous_") != 0)
+    auto& pass = plan[first + s];
+
+    for (auto& output : pass.outputs)
     {
-      if (textures[textureBinding.name]->isInternal)
+      uint32_t index = uint32_t(findAttachment(output.texture, output.mip));
+      colorRefs[s].push_back({ index, vk::ImageLayout::eColorAttachmentOptimal });
+      producers[index] = int(s);
+      uses[s][index] = true;
+    }
+
+    for (auto& input : pass.inputs)
+    {
+      if (input.attachmentIndex < 0) continue;
+
+      if (input.texture->GetMipExtent(input.mip) != pass.extent)
+      {
+        spdlog::error("Stage {} reads {} as a subpassInput, but it is not the size of the stage's output", pass.stage->name, input.texture->name);
+        throw std::runtime_error("Bad input attachment");
+      }
+
+      uint32_t index = uint32_t(findAttachment(input.texture, input.mip));
+
+      if (inputRefs[s].size() <= size_t(input.attachmentIndex)) inputRefs[s].resize(input.attachmentIndex + 1, { VK_ATTACHMENT_UNUSED, vk::ImageLayout::eUndefined });
+      inputRefs[s][input.attachmentIndex] = { index, vk::ImageLayout::eShaderReadOnlyOptimal };
+      uses[s][index] = true;
+
+      if (producers[index] >= 0)
       {
-        Render(r, ctx, textureBinding.name);
+        dependencies.push_back({
+          uint32_t(producers[index]), uint32_t(s),
+          vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eFragmentShader,
+          vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eInputAttachmentRead,
+          vk::DependencyFlagBits::eByRegion });
       }
     }
   }
 
-  // Render current node
-  auto& pipeline = stage->pipeline;
+  // Subpasses between the first and last use of an attachment have to keep it
+  for (uint32_t index = 0; index < group.attachments.size(); index++)
+  {
+    int firstUse = std::max(producers[index], 0), lastUse = firstUse;
+    for (int s = 0; s < int(group.count); s++)
+    {
+      if (uses[s][index]) lastUse = s;
+    }
+
+    for (int s = firstUse + 1; s < lastUse; s++)
+    {
+      if (!uses[s][index]) preserveRefs[s].push_back(index);
+    }
+  }
+
+  std::vector<vk::SubpassDescription> subpasses(group.count);
+  for (size_t s = 0; s < group.count; s++)
+  {
+    subpasses[s].setPipelineBindPoint(vk::PipelineBindPoint::eGraphics);
+    subpasses[s].setColorAttachments(colorRefs[s]);
+    subpasses[s].setInputAttachments(inputRefs[s]);
+    subpasses[s].setPreserveAttachments(preserveRefs[s]);
+  }
 
-  // Allocate descriptor sets & bind uniforms
-  auto descSet = pipeline->AllocDescSet(ctx.descPool);
+  // Outputs are cleared after earlier accesses, loaded inputs read after the pass that rendered them,
+  // and whatever reads the outputs after the group waits for every subpass
+  for (size_t s = 0; s < group.count; s++)
+  {
+    dependencies.push_back({
+      VK_SUBPASS_EXTERNAL, uint32_t(s),
+      TextureAccessStages, vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eFragmentShader,
+      vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eInputAttachmentRead });
+
+    dependencies.push_back({
+      uint32_t(s), VK_SUBPASS_EXTERNAL,
+      vk::PipelineStageFlagBits::eColorAttachmentOutput, TextureAccessStages,
+      vk::AccessFlagBits::eColorAttachmentWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eColorAttachmentWrite });
+  }
 
-  if (stage->builtinParamBindPoint >= 0)
-    pipeline->BindGraphicsUniformBuffer(*pipeline, descSet, *uniformBuffer, 0, uint32_t(sizeof(ShaderUniform)), stage->builtinParamBindPoint);
+  group.renderPass = r.getDevice().createRenderPassUnique({ {}, descriptions, subpasses, dependencies });
 
-  for (auto& textureBinding : stage->texture)
+  for (size_t s = 0; s < group.count; s++)
   {
-    int imageIndex = ctx.imageIndex;
-    std::string textureName = textureBinding.name;
+    plan[first + s].group = int(groups.size());
+    plan[first + s].pipeline->SetRenderPass(group.renderPass.get(), uint32_t(s));
+  }
+
+  size_t discarded = std::count_if(descriptions.begin(), descriptions.begin() + outputCount, [](auto& d) { return d.storeOp == vk::AttachmentStoreOp::eDontCare; });
+  spdlog::info("Shader graph: {} in one render pass, {} of {} outputs not stored", group.name, discarded, outputCount);
 
-    if (textureName.rfind("previous_") == 0)
+  groups.push_back(std::move(group));
+}
+
+void Graph::MergeSubpasses()
+{
+  // Greedy along the plan: a group grows while the next pass reads it at the same pixel.
+  // Passes with input attachments need a group (of one) even when nothing merges
+  size_t first = 0;
+  while (first < plan.size())
+  {
+    size_t end = first + 1;
+
+    if (!plan[first].pipeline->IsCompute())
     {
-      textureName = textureName.substr(9);
-      int size = int(r.getSwapchainImages().size());
-      imageIndex = (imageIndex - 1 + size) % size;
+      while (end < plan.size() && CanJoinGroup(first, end)) end++;
     }
 
-    if (textures[textureName]->isInternal)
+    bool hasInputAttachments = false;
+    for (size_t i = first; i < end; i++)
     {
-      ctx.cmdBuffer.ImageTransition(
-        *textures[textureName]->image[imageIndex],
-        vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eFragmentShader,
-        vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+      hasInputAttachments |= std::any_of(plan[i].inputs.begin(), plan[i].inputs.end(), [](auto& input) { return input.attachmentIndex >= 0; });
     }
 
-    pipeline->BindGraphicsImageView(
-      *pipeline, descSet,
-      textures[textureName]->imageView[imageIndex],
-      vk::ImageLayout::eShaderReadOnlyOptimal, r.getTextureSystem().GetSampler(),
-      textureBinding.binding);
+    if (end - first > 1 || hasInputAttachments) CreateSubpassGroup(first, end);
+
+    first = end;
   }
+}
 
-  if (target != "framebuffer")
+void Graph::MapBindings(Stage& stage)
+{
+  for (auto& textureBinding : stage.texture)
   {
-    ctx.cmdBuffer.ImageTransition(
-      *texture->image[ctx.imageIndex],
-      vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eColorAttachmentOutput,
-      vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal);
+    textureBinding.binding = stage.pipeline->GetBindingByName(textureBinding.uniformName);
   }
 
-  ctx.cmdBuffer.WithRenderPass(*pipeline, renderTarget, texture->extent, [&]() {
-    // Bind the pipeline to use
-    ctx.cmdBuffer.BindPipeline(*pipeline);
-    // Bind the descriptor sets (uniform buffer, texture, etc.)
+  stage.builtinParamBindPoint = stage.pipeline->GetBindingByName("iTime");
+
+  // Verify all bindings
+  for (auto textureBinding : stage.texture)
+  {
+    if (textureBinding.binding > 1024)
+    {
+      spdlog::error("Bad texture binding! Check whether the uniform name matches the name in the JSON file ({} in stage {})", textureBinding.uniformName, stage.name);
+      throw std::runtime_error("Bad binding");
+    }
+  }
+
+  if (!stage.isCompute) return;
+
+  for (auto& output : stage.outputs)
+  {
+    output.binding = uint32_t(stage.pipeline->GetBindingByName(output.uniformName));
+
+    if (output.binding > 1024)
+    {
+      spdlog::error("Bad output binding! Compute stages need an image2D named after each output ({} in stage {})", output.uniformName, stage.name);
+      throw std::runtime_error("Bad binding");
+    }
+  }
+}
+
+bool Graph::IsReady()
+{
+  if (ready) return true;
+
+  for (auto& pair : stages)
+  {
+    auto build = pair.second->pipeline->GetBuildFuture();
+    if (build.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+  }
+
+  for (auto& pair : stages)
+  {
+    pair.second->pipeline->GetBuildFuture().get();
+    MapBindings(*pair.second);
+  }
+
+  for (auto& pass : plan)
+  {
+    for (size_t i = 0; i < pass.inputs.size(); i++)
+    {
+      pass.inputs[i].binding = pass.stage->texture[i].binding;
+    }
+  }
+
+  spdlog::info("Shader graph ready, {} stages", stages.size());
+
+  ready = true;
+  return true;
+}
+
+BG::ShaderGraph::Graph::~Graph()
+{
+  ReleaseTextures();
+
+  for (auto& group : groups)
+  {
+    r.getFramebufferCache().InvalidateRenderPass(group.renderPass.get());
+  }
+}
+
+void Graph::WriteInputs(Renderer& r, const Pass& pass, DescriptorWriter& writer)
+{
+  if (pass.stage->builtinParamBindPoint >= 0)
+    writer.WriteBuffer(pass.stage->builtinParamBindPoint, *uniformBuffer, uniformOffset, sizeof(ShaderUniform));
+
+  for (auto& input : pass.inputs)
+  {
+    vk::ImageView view = input.texture->GetView(input.texture->GetIndex(frameParity, input.previous), input.mip);
+
+    if (input.attachmentIndex >= 0)
+      writer.WriteImage(input.binding, view, vk::ImageLayout::eShaderReadOnlyOptimal, nullptr, vk::DescriptorType::eInputAttachment);
+    else
+      writer.WriteImage(input.binding, view, vk::ImageLayout::eShaderReadOnlyOptimal, r.getTextureSystem().GetSampler());
+  }
+}
+
+void Graph::DrawPass(Renderer::Context& ctx, const Pass& pass, DescriptorWriter& writer)
+{
+  auto pipeline = pass.pipeline;
+
+  // Bind the pipeline to use
+  ctx.cmdBuffer.BindPipeline(*pipeline);
+  ctx.cmdBuffer.SetViewport(pass.extent);
+  // Push or bind the descriptors (uniform buffer, texture, etc.)
+  if (pipeline->IsPushDescriptor())
+  {
+    ctx.cmdBuffer.PushDescriptors(*pipeline, writer);
+  }
+  else
+  {
+    vk::DescriptorSet descSet = pipeline->AllocDescSet(ctx.descAllocator);
+    writer.Flush(descSet);
     ctx.cmdBuffer.BindGraphicsDescSets(*pipeline, descSet);
-    // Push parameters as push constants
-    for (auto& p : stage->parameters)
+  }
+  // Push parameters as push constants
+  for (auto& p : pass.stage->parameters)
+  {
+    p->PushParameter(ctx.cmdBuffer, *pipeline);
+  }
+  // Draw full-screen
+  ctx.cmdBuffer.Draw(3);
+}
+
+void Graph::RenderPass(Renderer& r, Renderer::Context& ctx, const Pass& pass)
+{
+  auto pipeline = pass.pipeline;
+
+  // Consumers can be fragment or compute stages
+  vk::PipelineStageFlags consumerStages = vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader;
+
+  std::vector<vk::ImageView> renderTarget;
+
+  for (auto& output : pass.outputs)
+  {
+    renderTarget.push_back(output.texture ? output.texture->GetView(output.texture->GetIndex(frameParity, false), output.mip) : ctx.imageView);
+  }
+
+  ctx.cmdBuffer.BeginScope(pass.stage->name);
+
+  // Inputs rendered earlier are made visible by the barrier or external dependency after the pass rendering them
+
+  // Allocate descriptor sets & bind uniforms
+  DescriptorWriter writer(r.getDevice());
+  WriteInputs(r, pass, writer);
+
+  // Compute outputs are storage images in eGeneral
+  if (pipeline->IsCompute())
+  {
+    for (size_t i = 0; i < pass.outputs.size(); i++)
+    {
+      auto& output = pass.outputs[i];
+      size_t imageIndex = output.texture->GetIndex(frameParity, false);
+
+      ctx.cmdBuffer.ImageTransition(
+        *output.texture->image[imageIndex],
+        TextureAccessStages, vk::PipelineStageFlagBits::eComputeShader,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, output.mip);
+
+      writer.WriteImage(pass.stage->outputs[i].binding, output.texture->GetView(imageIndex, output.mip), vk::ImageLayout::eGeneral, nullptr, vk::DescriptorType::eStorageImage);
+    }
+
+    ctx.cmdBuffer.BindPipeline(*pipeline);
+    if (pipeline->IsPushDescriptor())
+    {
+      ctx.cmdBuffer.PushDescriptors(*pipeline, writer);
+    }
+    else
+    {
+      vk::DescriptorSet descSet = pipeline->AllocDescSet(ctx.descAllocator);
+      writer.Flush(descSet);
+      ctx.cmdBuffer.BindComputeDescSets(*pipeline, descSet);
+    }
+    for (auto& p : pass.stage->parameters)
     {
       p->PushParameter(ctx.cmdBuffer, *pipeline);
     }
-    // Draw full-screen
-    ctx.cmdBuffer.Draw(3);
+    // One invocation per output texel, the group count follows the shader's local_size
+    ctx.cmdBuffer.DispatchInvocations(*pipeline, glm::uvec3(pass.extent, 1));
+
+    ctx.cmdBuffer.GlobalBarrier(
+      vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+      vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+    for (auto& output : pass.outputs)
+    {
+      ctx.cmdBuffer.ImageTransition(
+        *output.texture->image[output.texture->GetIndex(frameParity, false)],
+        vk::PipelineStageFlagBits::eComputeShader, consumerStages,
+        vk::ImageLayout::eGeneral, vk::ImageLayout::eShaderReadOnlyOptimal, output.mip);
+    }
+
+    ctx.cmdBuffer.EndScope();
+    return;
+  }
+
+  for (auto& output : pass.outputs)
+  {
+    if (output.texture)
+    {
+      ctx.cmdBuffer.ImageTransition(
+        *output.texture->image[output.texture->GetIndex(frameParity, false)],
+        TextureAccessStages, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal, output.mip);
+    }
+    else if (pipeline->IsDynamicRendering())
+    {
+      // No render pass to take the swapchain image out of its previous layout
+      ctx.cmdBuffer.ImageTransition(
+        ctx.image,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal, vk::ImageAspectFlagBits::eColor);
+    }
+  }
+
+  ctx.cmdBuffer.WithRenderPass(*pipeline, renderTarget, pass.extent, [&]() {
+    DrawPass(ctx, pass, writer);
     });
 
-  if (target != "framebuffer")
+  // A render pass leaves the target in its final layout, dynamic rendering leaves it as an attachment
+  vk::ImageLayout renderedLayout = pipeline->IsDynamicRendering() ? vk::ImageLayout::eColorAttachmentOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
+
+  for (auto& output : pass.outputs)
   {
-    ctx.cmdBuffer.ImageTransition(*texture->image[ctx.imageIndex], vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eFragmentShader, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+    if (output.texture)
+    {
+      ctx.cmdBuffer.ImageTransition(*output.texture->image[output.texture->GetIndex(frameParity, false)], vk::PipelineStageFlagBits::eColorAttachmentOutput, consumerStages, renderedLayout, vk::ImageLayout::eShaderReadOnlyOptimal, output.mip);
+    }
+    else if (pipeline->IsDynamicRendering())
+    {
+      ctx.cmdBuffer.ImageTransition(
+        ctx.image,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::ImageLayout::eColorAttachmentOptimal, vk::ImageLayout::ePresentSrcKHR, vk::ImageAspectFlagBits::eColor);
+    }
   }
+
+  ctx.cmdBuffer.EndScope();
+}
+
+void Graph::RenderGroup(Renderer& r, Renderer::Context& ctx, const SubpassGroup& group)
+{
+  auto& firstPass = plan[group.first];
+
+  ctx.cmdBuffer.BeginScope(group.name);
+
+  // Layout transitions and the barriers around the group are the render pass's external dependencies
+
+  std::vector<vk::ImageView> views;
+  for (auto& attachment : group.attachments)
+  {
+    views.push_back(attachment.texture ? attachment.texture->GetView(attachment.texture->GetIndex(frameParity, false), attachment.mip) : ctx.imageView);
+  }
+
+  auto framebuffer = ctx.cmdBuffer.GetFramebuffer(*firstPass.pipeline, views, firstPass.extent);
+
+  ctx.cmdBuffer.BeginRenderPass(group.renderPass.get(), framebuffer, firstPass.extent, std::vector<vk::ClearValue>(views.size()));
+
+  for (size_t i = 0; i < group.count; i++)
+  {
+    if (i > 0) ctx.cmdBuffer.NextSubpass();
+
+    auto& pass = plan[group.first + i];
+
+    DescriptorWriter writer(r.getDevice());
+    WriteInputs(r, pass, writer);
+    DrawPass(ctx, pass, writer);
+  }
+
+  ctx.cmdBuffer.EndRenderPass();
+
+  ctx.cmdBuffer.EndScope();
 }
 
 void Graph::Render(Renderer& r, Renderer::Context& ctx)
 {
-  // Map & upload the constants
-  uniformBuffer = r.getMemoryAllocator().AllocTransient(sizeof(ShaderUniform), vk::BufferUsageFlagBits::eUniformBuffer);
+  if (!IsReady())
+  {
+    ctx.cmdBuffer.ImageTransition(ctx.image, vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eTopOfPipe, vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR, vk::ImageAspectFlagBits::eColor);
+    return;
+  }
+
+  // Write the constants into this frame's part of the uniform ring
+  auto uniforms = r.getUniformRing().Alloc(sizeof(ShaderUniform));
+  uniformBuffer = uniforms.buffer;
+  uniformOffset = uniforms.offset;
   auto now = std::chrono::steady_clock::now();
-  ShaderUniform* uniformBufferGPU = uniformBuffer->Map<ShaderUniform>();
+  ShaderUniform* uniformBufferGPU = reinterpret_cast<ShaderUniform*>(uniforms.data);
   uniformBufferGPU->iResolution = glm::vec3(r.getWidth(), r.getHeight(), 1.0f);
   uniformBufferGPU->iTime = float((now - startTime).count() * 1e-9);
   uniformBufferGPU->iMouse = glm::vec4(r.getCursorPos(), 0.0f, 0.0f);
   uniformBufferGPU->iTimeDelta = float((now - lastTime).count() * 1e-9);
   uniformBufferGPU->iFrame = int(frameCount);
-  uniformBuffer->UnMap();
   lastTime = now;
+  frameParity = frameCount & 1;
   frameCount++;
 
-  Render(r, ctx, "framebuffer");
+  for (size_t i = 0; i < plan.size();)
+  {
+    if (plan[i].group >= 0)
+    {
+      auto& group = groups[plan[i].group];
+      RenderGroup(r, ctx, group);
+      i += group.count;
+    }
+    else
+    {
+      RenderPass(r, ctx, plan[i]);
+      i++;
+    }
+  }
 }
 
 void Graph::RenderGUI()
@@ -4,6 +4,7 @@
 
 #include "renderer.hpp"
 
+#include <vk_mem_alloc.h>
 #include <vulkan/vulkan.hpp>
 
 namespace BG::ShaderGraph
@@ -56,17 +57,39 @@ namespace BG::ShaderGraph
 
     glm::uvec2 extent;
     vk::Format format;
+    // Extent relative to the swapchain. 0 for a fixed "resolution"
+    float scale = 1.0f;
+    uint32_t mipLevels = 1;
 
+    // One image, or two for history textures. Empty when no pass uses the texture
     std::vector<std::unique_ptr<BG::Image>> image;
+    // Per image the view of the whole mip chain, followed by one view per mip if there are several
     std::vector<vk::ImageView> imageView;
 
     bool isInternal = true;
+    // Written by a compute stage
+    bool isStorage = false;
+    // Read through previous_, alternates between its two images by frame parity and is never aliased
+    bool isHistory = false;
+    // Read as a subpassInput
+    bool isInputAttachment = false;
+
+    inline size_t GetIndex(uint32_t frameParity, bool previous) { return isHistory ? ((frameParity ^ (previous ? 1 : 0)) & 1) : 0; }
+
+    inline size_t GetViewsPerImage() { return mipLevels > 1 ? mipLevels + 1 : 1; }
+    // mip < 0 for the whole chain
+    inline vk::ImageView GetView(size_t imageIndex, int mip) { return imageView[imageIndex * GetViewsPerImage() + (mipLevels > 1 && mip >= 0 ? mip + 1 : 0)]; }
+    inline glm::uvec2 GetMipExtent(int mip) { return mip > 0 ? glm::max(extent >> uint32_t(mip), glm::uvec2(1)) : extent; }
   };
 
   struct TextureBinding
   {
     std::string name;
     uint32_t binding;
+    // -1 for the whole mip chain. Outputs always name a single mip
+    int mip = -1;
+    // Name of the sampler / image in the shader, the texture name unless set with "uniform"
+    std::string uniformName;
   };
 
   struct Stage
@@ -78,35 +101,114 @@ namespace BG::ShaderGraph
     int builtinParamBindPoint;
 
     std::weak_ptr<Texture> output;
+    // Bindings are only used by compute stages, which write their outputs as storage images
+    std::vector<TextureBinding> outputs;
     std::vector<TextureBinding> texture;
 
+    bool isCompute = false;
+
+    // Textures the shader reads at the same pixel (subpassInput), by uniform name to input_attachment_index
+    std::unordered_map<std::string, uint32_t> inputAttachments;
+
     std::unique_ptr<BG::Pipeline> pipeline;
   };
 
+  // A stage in execution order with everything Render needs resolved, built once at load
+  struct Pass
+  {
+    Stage* stage;
+    BG::Pipeline* pipeline;
+
+    struct Output
+    {
+      Texture* texture; // nullptr for the swapchain image
+      int mip;
+    };
+
+    std::vector<Output> outputs;
+    glm::uvec2 extent;
+
+    struct Input
+    {
+      Texture* texture;
+      uint32_t binding;
+      bool previous; // the texture as rendered in the last frame
+      int mip;
+      int attachmentIndex; // input_attachment_index of a subpassInput, -1 when sampled
+    };
+
+    std::vector<Input> inputs;
+
+    // Index into the graph's subpass groups, -1 when the pass renders on its own
+    int group = -1;
+  };
+
+  // Consecutive passes recorded as the subpasses of one render pass, built by Graph::MergeSubpasses.
+  // Attachments only read inside the group are never stored to memory
+  struct SubpassGroup
+  {
+    std::string name;
+    size_t first;
+    size_t count;
+
+    vk::UniqueRenderPass renderPass;
+    // The outputs of every pass, then input attachments rendered before the group
+    std::vector<Pass::Output> attachments;
+  };
+
   class Graph
   {
   private:
     std::unordered_map<std::string, std::shared_ptr<Texture>> textures;
+    // Before the stages, whose pipelines may still be building against the render passes
+    std::vector<SubpassGroup> groups;
     std::unordered_map<std::string, std::shared_ptr<Stage>> stages;
-    std::unordered_map<std::string, std::string> dependency; // key: output name, value: stage name
+    std::unordered_map<std::string, std::string> dependency; // key: output name (and mip, see DependencyKey), value: stage name
 
-    BG::Renderer& r;
+    // Stages reachable from the framebuffer, dependencies first
+    std::vector<Pass> plan;
 
-    std::string outputStage;
+    BG::Renderer& r;
 
+    // This frame's builtin uniforms, in the renderer's uniform ring
     BG::Buffer* uniformBuffer;
+    uint32_t uniformOffset = 0;
 
     std::chrono::steady_clock::time_point startTime, lastTime;
     uint32_t frameCount = 0;
-
-    void CreateTexture(glm::uvec2 extent, vk::Format format, Renderer& r, std::string name);
+    uint32_t frameParity = 0;
+
+    // Memory shared by the transient textures, see AllocateTextures
+    std::vector<VmaAllocation> aliasedMemory;
+
+    // Scaled textures are derived from this when the graph is loaded
+    glm::uvec2 swapchainExtent;
+
+    // Stage pipelines are built asynchronously, bindings are mapped once all of them are done
+    bool ready = false;
+
+    // scale > 0 derives the extent from the swapchain
+    void CreateTexture(glm::uvec2 extent, vk::Format format, Renderer& r, std::string name, float scale = 0.0f, uint32_t mipLevels = 1);
+    void MapBindings(Stage& stage);
+    void CompilePlan();
+    void MergeSubpasses();
+    bool CanJoinGroup(size_t first, size_t pass);
+    void CreateSubpassGroup(size_t first, size_t end);
+    void AllocateTextures();
+    void ReleaseTextures();
+    void WriteInputs(BG::Renderer& r, const Pass& pass, BG::DescriptorWriter& writer);
+    void DrawPass(BG::Renderer::Context& ctx, const Pass& pass, BG::DescriptorWriter& writer);
+    void RenderPass(BG::Renderer& r, BG::Renderer::Context& ctx, const Pass& pass);
+    void RenderGroup(BG::Renderer& r, BG::Renderer::Context& ctx, const SubpassGroup& group);
 
   public:
     Graph(std::string jsonFile, BG::Renderer& r);
     ~Graph();
 
-    void Render(BG::Renderer& r, BG::Renderer::Context& ctx, std::string target);
+    // True once every stage pipeline is built, rethrows the error of a failed build
+    bool IsReady();
 
+    // Until IsReady() only hands the swapchain image over to presentation
     void Render(BG::Renderer& r, BG::Renderer::Context& ctx);
 
     void RenderGUI();
@@ -3,14 +3,38 @@
 #include "buffer.hpp"
 #include "renderer.hpp"
 #include "command_buffer.hpp"
+#include "upload_engine.hpp"
+#include "timeline.hpp"
 
 using namespace BG;
 
 TextureSystem::Handle TextureSystem::AddTexture(uint8_t* imageBuffer, int width, int height, size_t size, vk::Format format)
 {
-  auto image = m_allocator.AllocImage2D(glm::uvec2(width, height), 1, format, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::ImageLayout::eUndefined);
+  ReclaimSlots();
+
+  int index;
+
+  if (!m_freeSlots.empty())
+  {
+    index = m_freeSlots.back();
+    m_freeSlots.pop_back();
+  }
+  else
+  {
+    index = int(m_images.size());
 
-  int index = int(m_images.size());
+    if (index >= int(MAX_BINDLESS_TEXTURES))
+    {
+      spdlog::error("Too many textures, the bindless table holds {}", MAX_BINDLESS_TEXTURES);
+      throw std::runtime_error("Too many textures");
+    }
+
+    m_images.emplace_back();
+    m_imageViews.emplace_back();
+    m_uploadTickets.emplace_back();
+  }
+
+  auto image = m_allocator.AllocImage2D(glm::uvec2(width, height), 1, format, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled, vk::ImageLayout::eUndefined);
 
   vk::ImageViewCreateInfo viewInfo;
   viewInfo.image = image->image;
@@ -22,43 +46,102 @@ TextureSystem::Handle TextureSystem::AddTexture(uint8_t* imageBuffer, int width,
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = 1;
 
-  auto stagingBuffer = m_allocator.AllocCPU2GPU(size, vk::BufferUsageFlagBits::eTransferSrc);
-  uint8_t* stagingBufferGPU = stagingBuffer->Map<uint8_t>();
-  std::copy(imageBuffer, imageBuffer + size, stagingBufferGPU);
-  stagingBuffer->UnMap();
-
-  vk::BufferImageCopy copy;
-  copy.bufferOffset = 0;
-  copy.bufferRowLength = width;
-  copy.bufferImageHeight = height;
-  copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
-  copy.imageSubresource.mipLevel = 0;
-  copy.imageSubresource.baseArrayLayer = 0;
-  copy.imageSubresource.layerCount = 1;
-  copy.imageExtent.width = width;
-  copy.imageExtent.height = height;
-  copy.imageExtent.depth = 1;
-  copy.imageOffset.x = 0;
-  copy.imageOffset.y = 0;
-  copy.imageOffset.z = 0;
-  
-  auto _cmdBuf = m_renderer.AllocCmdBuffer();
-  CommandBuffer cmdBuf(m_device, _cmdBuf.get(), m_renderer.getTracker());
-
-  cmdBuf.Begin();
-  cmdBuf.ImageTransition(*image, vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
-  cmdBuf.GetVkCmdBuf().copyBufferToImage(stagingBuffer->buffer, image->image, vk::ImageLayout::eTransferDstOptimal, 1, &copy);
-  cmdBuf.ImageTransition(*image, vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
-  cmdBuf.End();
-
-  m_images.push_back(std::move(image));
-  m_imageViews.push_back(m_device.createImageViewUnique(viewInfo));
-
-  m_renderer.SubmitCmdBufferNow(cmdBuf.GetVkCmdBuf());
+  // Queued on the upload engine, it is flushed before the next frame is submitted
+  auto ticket = m_renderer.getUploadEngine().UploadImage(*image, imageBuffer, size, glm::uvec2(width, height));
+
+  m_images[index] = std::move(image);
+  m_imageViews[index] = m_device.createImageViewUnique(viewInfo);
+  m_uploadTickets[index] = ticket;
+
+  if (!HasBindlessTable()) return Handle{ index };
+
+  // Update unused while pending: frames in flight never use a new or reclaimed slot, so it can be written under them
+  vk::DescriptorImageInfo imageInfo;
+  imageInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  imageInfo.imageView = m_imageViews[index].get();
+  imageInfo.sampler = m_samplerBilinear.get();
+
+  vk::WriteDescriptorSet descSetWrite;
+  descSetWrite.dstSet = m_bindlessSet;
+  descSetWrite.dstBinding = 0;
+  descSetWrite.dstArrayElement = index;
+  descSetWrite.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  descSetWrite.descriptorCount = 1;
+  descSetWrite.pImageInfo = &imageInfo;
+
+  m_device.updateDescriptorSets(1, &descSetWrite, 0, nullptr);
 
   return Handle{ index };
 }
 
+void TextureSystem::RemoveTexture(Handle id)
+{
+  if (id.index < 0 || id.index >= int(m_images.size()) || !m_images[id.index])
+  {
+    spdlog::error("Removing invalid texture {}", id.index);
+    throw std::runtime_error("Invalid texture handle");
+  }
+
+  m_renderer.getUploadEngine().Wait(m_uploadTickets[id.index]);
+
+  PendingRemoval removal;
+  removal.slot = id.index;
+  removal.image = std::move(m_images[id.index]);
+  removal.imageView = std::move(m_imageViews[id.index]);
+
+  m_frameRemovals.push_back(std::move(removal));
+}
+
+void TextureSystem::EndFrame(uint64_t submitValue)
+{
+  for (auto& removal : m_frameRemovals)
+  {
+    removal.timelineValue = submitValue;
+    m_pendingRemovals.push_back(std::move(removal));
+  }
+  m_frameRemovals.clear();
+
+  ReclaimSlots();
+}
+
+void TextureSystem::ReclaimSlots()
+{
+  auto& timeline = m_renderer.getGraphicsTimeline();
+
+  while (!m_pendingRemovals.empty() && timeline.IsComplete(m_pendingRemovals.front().timelineValue))
+  {
+    m_freeSlots.push_back(m_pendingRemovals.front().slot);
+    m_pendingRemovals.pop_front();
+  }
+}
+
+vk::DescriptorSetLayout TextureSystem::GetBindlessLayout()
+{
+  if (!HasBindlessTable())
+  {
+    spdlog::error("The device does not support the bindless texture table");
+    throw std::runtime_error("Bindless textures are not supported");
+  }
+
+  return m_bindlessLayout.get();
+}
+
+vk::DescriptorSet TextureSystem::GetBindlessSet()
+{
+  if (!HasBindlessTable())
+  {
+    spdlog::error("The device does not support the bindless texture table");
+    throw std::runtime_error("Bindless textures are not supported");
+  }
+
+  return m_bindlessSet;
+}
+
+bool TextureSystem::IsReady(Handle id)
+{
+  return m_renderer.getUploadEngine().IsComplete(m_uploadTickets[id.index]);
+}
+
 TextureSystem::TextureSystem(vk::Device device, MemoryAllocator& allocator, Renderer& renderer)
   : m_device(device), m_allocator(allocator), m_renderer(renderer)
 {
@@ -76,4 +159,43 @@ TextureSystem::TextureSystem(vk::Device device, MemoryAllocator& allocator, Rend
   samplerInfo.maxLod = 0.0;
 
   m_samplerBilinear = m_device.createSamplerUnique(samplerInfo);
+
+  if (!renderer.m_hasBindlessTextures) return;
+
+  // Bindless table: one update-after-bind set, slots that were never written are left unbound
+  vk::DescriptorSetLayoutBinding layoutBinding;
+  layoutBinding.binding = 0;
+  layoutBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  layoutBinding.descriptorCount = MAX_BINDLESS_TEXTURES;
+  layoutBinding.stageFlags = vk::ShaderStageFlagBits::eAll;
+
+  // Update after bind lets the set be written after it was bound, update unused while pending while frames using it are in flight
+  vk::DescriptorBindingFlags bindingFlags = vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eUpdateAfterBind
+    | vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+
+  vk::DescriptorSetLayoutBindingFlagsCreateInfo layoutFlagsInfo;
+  layoutFlagsInfo.setBindingFlags(bindingFlags);
+
+  vk::DescriptorSetLayoutCreateInfo layoutInfo;
+  layoutInfo.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool;
+  layoutInfo.setBindings(layoutBinding);
+  layoutInfo.setPNext(&layoutFlagsInfo);
+
+  m_bindlessLayout = m_device.createDescriptorSetLayoutUnique(layoutInfo);
+
+  vk::DescriptorPoolSize poolSize{ vk::DescriptorType::eCombinedImageSampler, MAX_BINDLESS_TEXTURES };
+
+  vk::DescriptorPoolCreateInfo poolInfo;
+  poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind;
+  poolInfo.maxSets = 1;
+  poolInfo.setPoolSizes(poolSize);
+
+  m_bindlessPool = m_device.createDescriptorPoolUnique(poolInfo);
+
+  vk::DescriptorSetAllocateInfo allocInfo;
+  allocInfo.descriptorPool = m_bindlessPool.get();
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &m_bindlessLayout.get();
+
+  m_bindlessSet = m_device.allocateDescriptorSets(allocInfo)[0];
 }
@@ -2,37 +2,87 @@
 
 #include "berkeley_gfx.hpp"
 
+#include "upload_engine.hpp"
+
 #include <vulkan/vulkan.hpp>
 
+#include <deque>
+
 namespace BG
 {
 
+  // Owns the textures and one long-lived bindless descriptor set with all of them.
+  // Shaders index it with the handle: layout(set = N, binding = 0) uniform sampler2D textures[];
+  // after Pipeline::SetDescriptorSetLayout(N, GetBindlessLayout()).
   class TextureSystem
   {
+  public:
+    static const uint32_t MAX_BINDLESS_TEXTURES = 4096;
+
   private:
     vk::Device m_device;
     MemoryAllocator& m_allocator;
     Renderer& m_renderer;
 
+    // Indexed by slot, empty slots hold nullptr
     std::vector<std::unique_ptr<Image>> m_images;
     std::vector<vk::UniqueImageView> m_imageViews;
+    std::vector<UploadEngine::Ticket> m_uploadTickets;
+
+    std::vector<int> m_freeSlots;
+
+    // Removed textures stay alive until the graphics timeline passed the last frame that could use them.
+    // Removals are tagged at EndFrame, the frame being recorded may still sample them.
+    struct PendingRemoval
+    {
+      int slot;
+      uint64_t timelineValue;
+      std::unique_ptr<Image> image;
+      vk::UniqueImageView imageView;
+    };
+    std::vector<PendingRemoval> m_frameRemovals;
+    std::deque<PendingRemoval> m_pendingRemovals;
 
     vk::UniqueSampler m_samplerBilinear;
 
+    vk::UniqueDescriptorSetLayout m_bindlessLayout;
+    vk::UniqueDescriptorPool m_bindlessPool;
+    vk::DescriptorSet m_bindlessSet;
+
+    void ReclaimSlots();
+
   public:
     struct Handle
     {
       int index;
     };
 
+    // The texture is written into the bindless set right away, its slot is the handle's index
     Handle AddTexture(uint8_t* imageBuffer, int width, int height, size_t size, vk::Format format = vk::Format::eR8G8B8Srgb);
 
+    // The slot is reused by a later AddTexture once frames using it are done on the GPU
+    void RemoveTexture(Handle id);
+
+    // Tags this frame's removals with the value its submit signals and frees completed ones
+    void EndFrame(uint64_t submitValue);
+
     TextureSystem(vk::Device device, MemoryAllocator& allocator, Renderer& renderer);
 
+    // True once the texture data reached the GPU, textures can be used by the next frame regardless
+    bool IsReady(Handle id);
+
+    // Number of slots, including removed ones
     inline int GetNumImageViews() { return m_imageViews.size(); }
 
     inline vk::ImageView GetImageView(Handle id) { return m_imageViews[id.index].get(); }
     inline vk::Sampler GetSampler() { return m_samplerBilinear.get(); }
+
+    // The table needs descriptor updates while frames are in flight, which not every device supports.
+    // Without it textures are still created, but GetBindlessLayout / GetBindlessSet throw
+    inline bool HasBindlessTable() { return bool(m_bindlessLayout); }
+
+    vk::DescriptorSetLayout GetBindlessLayout();
+    vk::DescriptorSet GetBindlessSet();
   };
 
-}
\ No newline at end of file
+}
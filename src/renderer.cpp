@@ -4,6 +4,19 @@
 #include "buffer.hpp"
 #include "texture_system.hpp"
 #include "lifetime_tracker.hpp"
+#include "gpu_profiler.hpp"
+#include "frame_telemetry.hpp"
+#include "triple_buffer.hpp"
+#include "job_system.hpp"
+#include "parallel_recorder.hpp"
+#include "upload_engine.hpp"
+#include "timeline.hpp"
+#include "pipeline_cache.hpp"
+#include "pipeline_state_cache.hpp"
+#include "shader_cache.hpp"
+#include "descriptor_allocator.hpp"
+#include "uniform_ring.hpp"
+#include "framebuffer_cache.hpp"
 
 #include "imgui.h"
 #include "backends/imgui_impl_glfw.h"
@@ -13,14 +26,66 @@
 
 using namespace BG;
 
+// Deep copy of ImGui's draw data, so the GUI thread can build the next frame while it is being recorded
+struct GuiDrawData
+{
+  ImDrawData drawData;
+  std::vector<std::unique_ptr<ImDrawList>> lists;
+  std::vector<ImDrawList*> listPointers;
+
+  void CopyFrom(ImDrawData* src)
+  {
+    drawData = *src;
+
+    for (int i = int(lists.size()); i < src->CmdListsCount; i++)
+    {
+      lists.push_back(std::make_unique<ImDrawList>(ImGui::GetDrawListSharedData()));
+    }
+
+    listPointers.resize(src->CmdListsCount);
+
+    for (int i = 0; i < src->CmdListsCount; i++)
+    {
+      // Buffers keep their capacity between frames, so this stops allocating after warm up
+      lists[i]->CmdBuffer = src->CmdLists[i]->CmdBuffer;
+      lists[i]->IdxBuffer = src->CmdLists[i]->IdxBuffer;
+      lists[i]->VtxBuffer = src->CmdLists[i]->VtxBuffer;
+      lists[i]->Flags = src->CmdLists[i]->Flags;
+      listPointers[i] = lists[i].get();
+    }
+
+    drawData.CmdLists = listPointers.data();
+  }
+};
+
 extern VKAPI_ATTR VkBool32 VKAPI_CALL STATIC_DebugCallback(
   VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
   VkDebugUtilsMessageTypeFlagsEXT messageType,
   const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
   void* pUserData);
 
+void BG::Renderer::SetFramePacing(FramePacing framePacing)
+{
+  m_framePacing = framePacing;
+
+  switch (framePacing)
+  {
+  case FramePacing::LowLatency: m_maxFramesInFlight = 1; break;
+  case FramePacing::Balanced: m_maxFramesInFlight = 2; break;
+  case FramePacing::MaxThroughput: m_maxFramesInFlight = 3; break;
+  case FramePacing::HeadlessBenchmark: m_maxFramesInFlight = 3; break;
+  }
+
+  if (framePacing == FramePacing::HeadlessBenchmark && !m_headless)
+  {
+    spdlog::warn("Headless benchmark frame pacing used with a window, presenting as max throughput");
+  }
+}
+
 void BG::Renderer::InitWindow()
 {
+  if (m_headless) return;
+
   glfwInit();
 
   // Use glfw to check for Vulkan support.
@@ -41,12 +106,41 @@ void BG::Renderer::InitVulkan()
   CreateInstance();
   PickPhysicalDevice();
   CreateDevice();
-  CreateSurface();
-  CreateSwapChain();
+
+  m_pipelineCache = std::make_unique<PipelineCache>(m_device.get(), m_physicalDevice);
+  m_pipelineStateCache = std::make_unique<PipelineStateCache>();
+  m_shaderCache = std::make_unique<ShaderCache>();
+
+  if (m_headless)
+  {
+    CreateHeadlessImages();
+  }
+  else
+  {
+    CreateSurface();
+    CreateSwapChain();
+  }
+  CreateDepthImages();
   CreateCmdPools();
   CreateCmdBuffers();
   CreateDescriptorPools();
   CreateSemaphore();
+
+  m_gpuProfiler = std::make_unique<GpuProfiler>(m_device.get(), m_physicalDevice, m_selectedPhyDeviceQueueIndices.graphics, m_maxFramesInFlight);
+  m_telemetry = std::make_unique<FrameTelemetry>();
+  m_uniformRing = std::make_unique<UniformRing>(*m_memoryAllocator, m_physicalDevice, uint32_t(m_maxFramesInFlight));
+  m_framebufferCache = std::make_unique<FramebufferCache>(m_device.get(), *m_tracker);
+  m_uploadEngine = std::make_unique<UploadEngine>(
+    m_device.get(), *m_memoryAllocator,
+    *m_transferTimeline, uint32_t(m_selectedPhyDeviceQueueIndices.transfer),
+    *m_graphicsTimeline, uint32_t(m_selectedPhyDeviceQueueIndices.graphics));
+
+  // Pipeline builds get their own workers, a long compile must not hold up ParallelFor during a frame
+  m_compileJobSystem = std::make_unique<JobSystem>(std::max(int(std::thread::hardware_concurrency()) / 2, 1));
+
+  // Secondary command pools follow the primary command buffers, one set per swapchain image
+  m_jobSystem = std::make_unique<JobSystem>();
+  m_parallelRecorder = std::make_unique<ParallelRecorder>(m_device.get(), *m_jobSystem, *m_tracker, m_selectedPhyDeviceQueueIndices.graphics, uint32_t(m_swapchainImages.size()));
 }
 
 #include "embed_font.cpp"
@@ -196,7 +290,7 @@ void BG::Renderer::InitImGui()
   init_info.Device = m_device.get();
   init_info.QueueFamily = m_selectedPhyDeviceQueueIndices.graphics;
   init_info.Queue = m_graphcisQueue;
-  init_info.PipelineCache = nullptr;
+  init_info.PipelineCache = m_pipelineCache->Get();
   init_info.DescriptorPool = m_ImGuiDescPool;
   init_info.Allocator = nullptr;
   init_info.MinImageCount = uint32_t(m_swapchainImages.size());
@@ -234,10 +328,13 @@ void BG::Renderer::CreateInstance()
   // Initialize a Vulkan instance with the validation layers enabled and extensions required by glfw.
   std::vector<const char*> glfwExtensionsVec;
 
-  uint32_t glfwExtensionCount = 0;
-  const char** glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-  for (uint32_t i = 0; i < glfwExtensionCount; i++) glfwExtensionsVec.push_back(glfwExtensions[i]);
+  if (!m_headless)
+  {
+    uint32_t glfwExtensionCount = 0;
+    const char** glfwExtensions;
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    for (uint32_t i = 0; i < glfwExtensionCount; i++) glfwExtensionsVec.push_back(glfwExtensions[i]);
+  }
 
   std::vector<const char*> instanceLayers;
   if (m_enableValidationLayers)
@@ -312,12 +409,16 @@ void BG::Renderer::PickPhysicalDevice()
       }
 
       if (queueFamily.queueFlags & vk::QueueFlagBits::eCompute) {
-        if (computeQueue == -1) computeQueue = i;
+        // Prefer a family without graphics so compute can run asynchronously
+        bool dedicated = !(queueFamily.queueFlags & vk::QueueFlagBits::eGraphics);
+        if (computeQueue == -1 || (dedicated && (queueFamilies[computeQueue].queueFlags & vk::QueueFlagBits::eGraphics))) computeQueue = i;
         spdlog::info("  - Compute");
       }
 
       if (queueFamily.queueFlags & vk::QueueFlagBits::eTransfer) {
-        if (transferQueue == -1) transferQueue = i;
+        // Prefer a transfer-only family (DMA engine), so uploads don't compete with rendering
+        bool dedicated = !(queueFamily.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute));
+        if (transferQueue == -1 || (dedicated && (queueFamilies[transferQueue].queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))) transferQueue = i;
         spdlog::info("  - Transfer");
       }
 
@@ -352,7 +453,9 @@ void BG::Renderer::CreateDevice()
     queueCreateInfo.push_back({ {}, uint32_t(m_selectedPhyDeviceQueueIndices.compute), 1, &computeQueuePriority });
   }
 
-  if (m_selectedPhyDeviceQueueIndices.transfer != m_selectedPhyDeviceQueueIndices.graphics)
+  // Each family may only be requested once
+  if (m_selectedPhyDeviceQueueIndices.transfer != m_selectedPhyDeviceQueueIndices.graphics &&
+      m_selectedPhyDeviceQueueIndices.transfer != m_selectedPhyDeviceQueueIndices.compute)
   {
     queueCreateInfo.push_back({ {}, uint32_t(m_selectedPhyDeviceQueueIndices.transfer), 1, &transferQueuePriority });
   }
@@ -364,11 +467,9 @@ void BG::Renderer::CreateDevice()
   auto deviceExtensionCapabilities = m_physicalDevice.enumerateDeviceExtensionProperties();
   auto deviceProperties = m_physicalDevice.getProperties();
 
-  deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
-
-  bool hasDescriptorIndexing = false;
-  bool hasPhysicalDeviceProperties2 = false;
-  bool hasMintenance3 = false;
+  bool hasSwapchain = false;
+  bool hasPushDescriptor = false;
+  bool hasDynamicRendering = false;
 
   for (auto& cap : deviceExtensionCapabilities)
   {
@@ -378,52 +479,98 @@ void BG::Renderer::CreateDevice()
       spdlog::debug("Potential non-conformant Vulkan implementation, enabling VK_KHR_portability_subset.");
       deviceExtensions.push_back(cap.extensionName);
     }
-    if (name == "VK_EXT_descriptor_indexing")
+    if (name == VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)
     {
-      hasDescriptorIndexing = true;
+      hasPushDescriptor = true;
     }
-    if (name == "VK_KHR_get_physical_device_properties2")
+    if (name == VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)
     {
-      hasPhysicalDeviceProperties2 = true;
+      hasDynamicRendering = true;
     }
-    if (name == "VK_KHR_maintenance3")
+    if (name == VK_KHR_SWAPCHAIN_EXTENSION_NAME)
     {
-      hasMintenance3 = true;
+      hasSwapchain = true;
     }
 
     spdlog::debug(cap.extensionName);
   }
 
-  if (deviceProperties.apiVersion >= VK_API_VERSION_1_2)
+  // Headless devices (e.g. lavapipe in CI) may not expose presentation at all.
+  // We still enable it when available so ePresentSrcKHR stays a known layout.
+  if (!m_headless || hasSwapchain)
+  {
+    deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+
+  if (hasPushDescriptor)
+  {
+    spdlog::info("Enabling push descriptors");
+    deviceExtensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+    m_hasPushDescriptor = true;
+  }
+
+  if (hasDynamicRendering)
   {
-    spdlog::info("Enabling descriptor indexing & Vulkan 1.2");
-    m_hasDescriptorIndexing = true;
+    spdlog::info("Enabling dynamic rendering");
+    deviceExtensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+    m_hasDynamicRendering = true;
   }
-  else if (hasDescriptorIndexing && hasPhysicalDeviceProperties2 && hasMintenance3)
+
+  // Frame, upload and async compute synchronization is built on timeline semaphores (core in 1.2)
+  if (deviceProperties.apiVersion < VK_API_VERSION_1_2)
   {
-    spdlog::info("Enabling descriptor indexing");
-    deviceExtensions.push_back("VK_EXT_descriptor_indexing");
-    deviceExtensions.push_back("VK_KHR_get_physical_device_properties2");
-    deviceExtensions.push_back("VK_KHR_maintenance3");
-    m_hasDescriptorIndexing = true;
+    spdlog::error("{} does not support Vulkan 1.2, timeline semaphores are required", deviceProperties.deviceName);
+    throw std::runtime_error("Vulkan 1.2 is required");
   }
 
+  // Descriptor indexing features are optional even on 1.2 devices, only enable what is supported
+  auto supportedFeatures = m_physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDescriptorIndexingFeatures>();
+  auto& supportedIndexing = supportedFeatures.get<vk::PhysicalDeviceDescriptorIndexingFeatures>();
+
+  m_hasDescriptorIndexing =
+    supportedIndexing.descriptorBindingPartiallyBound &&
+    supportedIndexing.descriptorBindingVariableDescriptorCount &&
+    supportedIndexing.shaderSampledImageArrayNonUniformIndexing &&
+    supportedIndexing.runtimeDescriptorArray;
+
+  // The texture system's bindless table is also written while frames using it are in flight
+  m_hasBindlessTextures = m_hasDescriptorIndexing &&
+    supportedIndexing.descriptorBindingSampledImageUpdateAfterBind &&
+    supportedIndexing.descriptorBindingUpdateUnusedWhilePending;
+
+  if (m_hasBindlessTextures)
+    spdlog::info("Enabling descriptor indexing & bindless textures");
+  else if (m_hasDescriptorIndexing)
+    spdlog::warn("Enabling descriptor indexing, {} can't update descriptors in use so bindless textures are not available", deviceProperties.deviceName);
+  else
+    spdlog::warn("{} does not support descriptor indexing, bindless textures are not available", deviceProperties.deviceName);
+
   vk::PhysicalDeviceFeatures deviceFeatures;
 
   vk::DeviceCreateInfo deviceCreateInfo = { {}, queueCreateInfo, deviceLayers, deviceExtensions, &deviceFeatures };
 
   vk::PhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeature;
-  if (m_hasDescriptorIndexing)
-  {
-    descriptorIndexingFeature.descriptorBindingPartiallyBound = true;
-    descriptorIndexingFeature.descriptorBindingVariableDescriptorCount = true;
-    descriptorIndexingFeature.shaderSampledImageArrayNonUniformIndexing = true;
-    descriptorIndexingFeature.runtimeDescriptorArray = true;
+  descriptorIndexingFeature.descriptorBindingPartiallyBound = m_hasDescriptorIndexing;
+  descriptorIndexingFeature.descriptorBindingVariableDescriptorCount = m_hasDescriptorIndexing;
+  descriptorIndexingFeature.shaderSampledImageArrayNonUniformIndexing = m_hasDescriptorIndexing;
+  descriptorIndexingFeature.runtimeDescriptorArray = m_hasDescriptorIndexing;
+  descriptorIndexingFeature.descriptorBindingSampledImageUpdateAfterBind = m_hasBindlessTextures;
+  descriptorIndexingFeature.descriptorBindingUpdateUnusedWhilePending = m_hasBindlessTextures;
 
-    deviceCreateInfo.setPNext(&descriptorIndexingFeature);
-  }
+  vk::PhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeature;
+  timelineSemaphoreFeature.timelineSemaphore = true;
+  timelineSemaphoreFeature.setPNext(&descriptorIndexingFeature);
+
+  vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeature;
+  dynamicRenderingFeature.dynamicRendering = true;
+  if (m_hasDynamicRendering) descriptorIndexingFeature.setPNext(&dynamicRenderingFeature);
+
+  deviceCreateInfo.setPNext(&timelineSemaphoreFeature);
 
   m_device = m_physicalDevice.createDeviceUnique(deviceCreateInfo, nullptr);
+
+  // Extension commands (push descriptors, dynamic rendering) go through the dynamic dispatcher
+  m_dispatcher.init(m_device.get());
   
   m_graphcisQueue = m_device->getQueue(m_selectedPhyDeviceQueueIndices.graphics, 0);
 
@@ -445,12 +592,39 @@ void BG::Renderer::CreateDevice()
     m_transferQueue = m_graphcisQueue;
   }
 
-  if (!glfwGetPhysicalDevicePresentationSupport(m_instance.get(), m_physicalDevice, m_selectedPhyDeviceQueueIndices.graphics))
+  m_timelines.push_back(std::make_unique<Timeline>(m_device.get(), m_graphcisQueue));
+  m_graphicsTimeline = m_timelines.back().get();
+
+  if (m_computeQueue != m_graphcisQueue)
+  {
+    m_timelines.push_back(std::make_unique<Timeline>(m_device.get(), m_computeQueue));
+  }
+  m_computeTimeline = m_timelines.back().get();
+
+  if (m_transferQueue == m_graphcisQueue)
+  {
+    m_transferTimeline = m_graphicsTimeline;
+  }
+  else if (m_transferQueue == m_computeQueue)
+  {
+    m_transferTimeline = m_computeTimeline;
+  }
+  else
+  {
+    m_timelines.push_back(std::make_unique<Timeline>(m_device.get(), m_transferQueue));
+    m_transferTimeline = m_timelines.back().get();
+  }
+
+  spdlog::info("Queue families: graphics={}, compute={}, transfer={}{}",
+    m_selectedPhyDeviceQueueIndices.graphics, m_selectedPhyDeviceQueueIndices.compute, m_selectedPhyDeviceQueueIndices.transfer,
+    hasAsyncCompute() ? " (async compute)" : "");
+
+  if (!m_headless && !glfwGetPhysicalDevicePresentationSupport(m_instance.get(), m_physicalDevice, m_selectedPhyDeviceQueueIndices.graphics))
   {
     throw std::runtime_error("No presentation support on the graphcis queue");
   }
 
-  m_memoryAllocator = std::make_unique<BG::MemoryAllocator>(m_physicalDevice, m_device.get(), m_instance.get(), MAX_FRAMES_IN_FLIGHT);
+  m_memoryAllocator = std::make_unique<BG::MemoryAllocator>(m_physicalDevice, m_device.get(), m_instance.get(), m_maxFramesInFlight);
 }
 
 void BG::Renderer::CreateSurface()
@@ -503,14 +677,36 @@ void BG::Renderer::CreateSwapChain()
     throw std::runtime_error("No suitable surface format");
   }
 
+  auto hasPresentMode = [&](vk::PresentModeKHR mode) {
+    return std::find(presentModes.begin(), presentModes.end(), mode) != presentModes.end();
+  };
+
+  // FIFO is always supported
   vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+  uint32_t imageCount = surfaceCapability.minImageCount + 1;
 
-  if (std::find(presentModes.begin(), presentModes.end(), vk::PresentModeKHR::eMailbox) != presentModes.end())
+  switch (m_framePacing)
   {
-    presentMode = vk::PresentModeKHR::eMailbox;
+  case FramePacing::LowLatency:
+    // No extra image to queue frames into
+    imageCount = std::max(surfaceCapability.minImageCount, 2u);
+    break;
+  case FramePacing::Balanced:
+    if (hasPresentMode(vk::PresentModeKHR::eMailbox)) presentMode = vk::PresentModeKHR::eMailbox;
+    break;
+  case FramePacing::MaxThroughput:
+  case FramePacing::HeadlessBenchmark:
+    if (hasPresentMode(vk::PresentModeKHR::eImmediate)) presentMode = vk::PresentModeKHR::eImmediate;
+    else if (hasPresentMode(vk::PresentModeKHR::eMailbox)) presentMode = vk::PresentModeKHR::eMailbox;
+    // Enough images that no frame in flight waits for one to come back from presentation
+    imageCount = std::max(imageCount, uint32_t(m_maxFramesInFlight) + 1);
+    break;
   }
 
-  uint32_t imageCount = std::min(surfaceCapability.minImageCount + 1, surfaceCapability.maxImageCount);
+  // maxImageCount of 0 means no limit
+  if (surfaceCapability.maxImageCount > 0) imageCount = std::min(imageCount, surfaceCapability.maxImageCount);
+
+  spdlog::info("Frame pacing: {} frames in flight, {} swapchain images, {}", m_maxFramesInFlight, imageCount, vk::to_string(presentMode));
 
   vk::SwapchainCreateInfoKHR createInfo;
 
@@ -546,7 +742,37 @@ void BG::Renderer::CreateSwapChain()
   }
 
   m_swapchainFormat = surfaceFormat.format;
+}
+
+void BG::Renderer::CreateHeadlessImages()
+{
+  // Stand-in for the swapchain: one color target per "swapchain image"
+  m_swapchainFormat = vk::Format::eR8G8B8A8Unorm;
+
+  for (int i = 0; i < m_maxFramesInFlight + 1; i++)
+  {
+    auto image = m_memoryAllocator->AllocImage2D(
+      glm::uvec2(m_width, m_height), 1, m_swapchainFormat,
+      vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc);
+
+    vk::ImageViewCreateInfo imageviewInfo;
 
+    imageviewInfo.setImage(image->image);
+    imageviewInfo.setViewType(vk::ImageViewType::e2D);
+    imageviewInfo.setFormat(m_swapchainFormat);
+    imageviewInfo.setComponents({ vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity, vk::ComponentSwizzle::eIdentity });
+    imageviewInfo.setSubresourceRange({ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
+
+    m_swapchainImages.push_back(image->image);
+    m_swapchainImageViews.push_back(m_device->createImageViewUnique(imageviewInfo));
+    m_headlessImages.push_back(std::move(image));
+  }
+
+  spdlog::info("Headless mode: {} offscreen targets, {}x{}", m_headlessImages.size(), m_width, m_height);
+}
+
+void BG::Renderer::CreateDepthImages()
+{
   for (int i = 0; i < m_swapchainImages.size(); i++)
   {
     auto image = m_memoryAllocator->AllocImage2D(glm::uvec2(m_width, m_height), 1, vk::Format::eD32Sfloat, vk::ImageUsageFlagBits::eDepthStencilAttachment);
@@ -570,6 +796,7 @@ void BG::Renderer::CreateCmdPools()
 {
   m_graphicsCmdPool = m_device->createCommandPoolUnique({ vk::CommandPoolCreateFlagBits::eResetCommandBuffer, uint32_t(m_selectedPhyDeviceQueueIndices.graphics) });
   m_guiCmdPool = m_device->createCommandPoolUnique({ vk::CommandPoolCreateFlagBits::eResetCommandBuffer, uint32_t(m_selectedPhyDeviceQueueIndices.graphics) });
+  m_computeCmdPool = m_device->createCommandPoolUnique({ vk::CommandPoolCreateFlagBits::eResetCommandBuffer, uint32_t(m_selectedPhyDeviceQueueIndices.compute) });
 }
 
 void BG::Renderer::CreateCmdBuffers()
@@ -578,45 +805,25 @@ void BG::Renderer::CreateCmdBuffers()
   {
     m_cmdBuffers.push_back(AllocCmdBuffer());
     m_ImGuiCmdBuffers.push_back(std::move(m_device->allocateCommandBuffersUnique({ m_guiCmdPool.get(), vk::CommandBufferLevel::ePrimary, 1 })[0]));
+    m_computeCmdBuffers.push_back(std::move(m_device->allocateCommandBuffersUnique({ m_computeCmdPool.get(), vk::CommandBufferLevel::ePrimary, 1 })[0]));
   }
 }
 
 void BG::Renderer::CreateSemaphore()
 {
-  for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+  for (int i = 0; i < m_maxFramesInFlight; i++)
   {
     m_imageAvailableSemaphores.push_back(m_device->createSemaphoreUnique({}));
     m_renderFinishedSemaphores.push_back(m_device->createSemaphoreUnique({}));
-    m_inFlightFences.push_back(m_device->createFenceUnique({}));
   }
 
-  m_imagesInFlight.resize(m_swapchainImages.size(), nullptr);
+  m_frameTimelineValues.resize(m_maxFramesInFlight, 0);
+  m_imageTimelineValues.resize(m_swapchainImages.size(), 0);
 }
 
 void BG::Renderer::CreateDescriptorPools()
 {
-  std::vector<vk::DescriptorPoolSize> poolSizes = {
-      { vk::DescriptorType::eSampler, 1000 },
-      { vk::DescriptorType::eCombinedImageSampler, 1000 },
-      { vk::DescriptorType::eSampledImage, 1000 },
-      { vk::DescriptorType::eStorageImage, 1000 },
-      { vk::DescriptorType::eUniformTexelBuffer, 1000 },
-      { vk::DescriptorType::eStorageTexelBuffer, 1000 },
-      { vk::DescriptorType::eUniformBuffer, 1000 },
-      { vk::DescriptorType::eStorageBuffer, 1000 },
-      { vk::DescriptorType::eUniformBufferDynamic, 1000 },
-      { vk::DescriptorType::eStorageBufferDynamic, 1000 },
-      { vk::DescriptorType::eInputAttachment, 1000 }
-  };
-
-  vk::DescriptorPoolCreateInfo info;
-  info.setPoolSizes(poolSizes);
-  info.maxSets = 256;
-
-  for (int i = 0; i < m_swapchainImages.size(); i++)
-  {
-    m_descPools.push_back(m_device->createDescriptorPoolUnique(info));
-  }
+  m_descAllocator = std::make_unique<DescriptorAllocator>(m_device.get(), uint32_t(m_swapchainImages.size()));
 }
 
 void BG::Renderer::DestroySwapChain()
@@ -625,8 +832,14 @@ void BG::Renderer::DestroySwapChain()
   m_swapchainImageViews.clear();
   m_depthImages.clear();
   m_depthImageViews.clear();
-  m_device->destroySwapchainKHR(m_swapchain.get());
-  m_swapchain.release();
+  m_headlessImages.clear();
+
+  // Headless renderers never create a swapchain
+  if (m_swapchain)
+  {
+    m_device->destroySwapchainKHR(m_swapchain.get());
+    m_swapchain.release();
+  }
 }
 
 void BG::Renderer::DestroyCmdPools()
@@ -635,25 +848,29 @@ void BG::Renderer::DestroyCmdPools()
   m_graphicsCmdPool.release();
   m_device->destroyCommandPool(m_guiCmdPool.get());
   m_guiCmdPool.release();
+  m_device->destroyCommandPool(m_computeCmdPool.get());
+  m_computeCmdPool.release();
 }
 
 void BG::Renderer::DestroyCmdBuffers()
 {
   m_cmdBuffers.clear();
   m_ImGuiCmdBuffers.clear();
+  m_computeCmdBuffers.clear();
 }
 
 void BG::Renderer::DestroySemaphore()
 {
   m_imageAvailableSemaphores.clear();
   m_renderFinishedSemaphores.clear();
-  m_inFlightFences.clear();
+  m_frameTimelineValues.clear();
+  m_imageTimelineValues.clear();
 }
 
 void BG::Renderer::DestroyDescriptorPools()
 {
-  m_descPools.clear();
-  vkDestroyDescriptorPool(m_device.get(), m_ImGuiDescPool, nullptr);
+  m_descAllocator = nullptr;
+  if (!m_headless) vkDestroyDescriptorPool(m_device.get(), m_ImGuiDescPool, nullptr);
 }
 
 void BG::Renderer::DestroySurface()
@@ -683,8 +900,15 @@ void BG::Renderer::DestroyImGuiSwapChain()
 }
 
 BG::Renderer::Renderer(std::string name, bool enableValidationLayers)
-  : m_name(name), m_enableValidationLayers(enableValidationLayers), m_tracker(std::make_unique<BG::Tracker>(MAX_FRAMES_IN_FLIGHT))
+  : Renderer(name, FramePacing::Balanced, enableValidationLayers)
 {
+}
+
+BG::Renderer::Renderer(std::string name, FramePacing framePacing, bool enableValidationLayers)
+  : m_name(name), m_enableValidationLayers(enableValidationLayers), m_tracker(std::make_unique<BG::Tracker>())
+{
+  SetFramePacing(framePacing);
+
   InitWindow();
   InitVulkan();
   InitImGui();
@@ -692,26 +916,98 @@ BG::Renderer::Renderer(std::string name, bool enableValidationLayers)
   m_textureSystem = std::make_unique<TextureSystem>(m_device.get(), *m_memoryAllocator, *this);
 }
 
+BG::Renderer::Renderer(std::string name, HeadlessConfig headless, bool enableValidationLayers)
+  : m_name(name), m_enableValidationLayers(enableValidationLayers), m_tracker(std::make_unique<BG::Tracker>())
+{
+  m_headless = true;
+  m_headlessFrameCount = headless.frameCount;
+  m_width = headless.width;
+  m_height = headless.height;
+
+  SetFramePacing(headless.framePacing);
+
+  InitWindow();
+  InitVulkan();
+
+  m_textureSystem = std::make_unique<TextureSystem>(m_device.get(), *m_memoryAllocator, *this);
+}
+
 BG::Renderer::~Renderer()
 {
+  // Finish pending pipeline builds
+  m_compileJobSystem = nullptr;
+
+  // Cached framebuffers reference the swapchain & depth views
+  m_framebufferCache = nullptr;
+
   DestroyCmdBuffers();
   DestroyCmdPools();
   DestroySemaphore();
-  DestroyImGuiSwapChain();
+  if (!m_headless) DestroyImGuiSwapChain();
   DestroySwapChain();
   DestroyDescriptorPools();
 
-  DestroyImGui();
+  if (!m_headless) DestroyImGui();
   
+  m_uploadEngine = nullptr;
   m_textureSystem = nullptr;
+  m_uniformRing = nullptr;
   m_tracker = nullptr;
+  m_gpuProfiler = nullptr;
+  m_telemetry = nullptr;
+  m_parallelRecorder = nullptr;
+  m_jobSystem = nullptr;
   m_memoryAllocator = nullptr;
+  m_pipelineStateCache = nullptr;
+  m_shaderCache = nullptr;
+  m_pipelineCache = nullptr;
+  m_timelines.clear();
 
   DestroySurface();
   DestroyDevice();
 
-  glfwDestroyWindow(m_window);
-  glfwTerminate();
+  if (!m_headless)
+  {
+    glfwDestroyWindow(m_window);
+    glfwTerminate();
+  }
+}
+
+void BG::Renderer::Context::RecordParallel(Pipeline& p, std::vector<vk::ImageView> renderTargets, glm::uvec2 extent, int numTasks, std::function<void(CommandBuffer&, int)> func)
+{
+  if (p.IsDynamicRendering())
+  {
+    parallelRecorder.Record(cmdBuffer, p, renderTargets, extent, glm::vec4(0.0), glm::ivec2(0), numTasks, func);
+    return;
+  }
+
+  vk::Framebuffer fb = cmdBuffer.GetFramebuffer(p, renderTargets, extent);
+
+  parallelRecorder.Record(cmdBuffer, p, fb, extent, glm::vec4(0.0), glm::ivec2(0), numTasks, func);
+}
+
+void BG::Renderer::RecordGUI(ImDrawData& drawData, int imageIndex)
+{
+  auto cmdBuf = m_ImGuiCmdBuffers[imageIndex].get();
+
+  cmdBuf.begin(vk::CommandBufferBeginInfo{ {}, nullptr });
+
+  vk::ClearValue clearValue{};
+
+  vk::RenderPassBeginInfo info = {};
+  info.renderPass = m_ImGuiRenderPass.get();
+  info.framebuffer = m_ImGuiFramebuffer[imageIndex].get();
+  info.renderArea.extent.width = m_width;
+  info.renderArea.extent.height = m_height;
+  info.clearValueCount = 1;
+  info.pClearValues = &clearValue;
+
+  cmdBuf.beginRenderPass(info, vk::SubpassContents::eInline);
+
+  ImGui_ImplVulkan_RenderDrawData(&drawData, cmdBuf);
+
+  cmdBuf.endRenderPass();
+  cmdBuf.end();
 }
 
 void BG::Renderer::Run(std::function<void()> init, std::function<void(Context&)> render, std::function<void()> renderGUI, std::function<void()> cleanup)
@@ -721,18 +1017,24 @@ void BG::Renderer::Run(std::function<void()> init, std::function<void(Context&)>
   int imageIndex = 0;
   size_t currentFrame = 0;
 
-  std::mutex m;
-  std::condition_variable cv;
-  bool ready = false;
-  bool processed = false;
+  // GUI thread publishes finished draw data, main thread records whatever is newest without waiting
+  TripleBuffer<GuiDrawData> guiFrames;
+
+  // Set by the main thread once input is polled for a new GUI frame, cleared by the GUI thread when done
+  std::atomic<bool> guiRequested{ false };
+  std::mutex guiMutex;
+  std::condition_variable guiCv;
 
-  std::thread guiThread([&] {
+  std::thread guiThread;
+
+  if (!m_headless) guiThread = std::thread([&] {
     while (m_isRunning)
     {
-      // Wait until main thread starts new frame
-      std::unique_lock<std::mutex> lk(m);
-      cv.wait(lk, [&] { return ready; });
-      ready = false;
+      {
+        // Both flags are set under the lock, so the wakeup can't be missed
+        std::unique_lock<std::mutex> lk(guiMutex);
+        guiCv.wait(lk, [&] { return guiRequested.load(std::memory_order_acquire) || !m_isRunning; });
+      }
 
       if (!m_isRunning) break;
 
@@ -745,36 +1047,16 @@ void BG::Renderer::Run(std::function<void()> init, std::function<void(Context&)>
       ImGui::Text("Last 100 frames took %fms", m_timeSpentLast100Frames * 1000.0);
       ImGui::Text("FPS = %f", 100.0 / m_timeSpentLast100Frames);
 
-      ImGui::Render();
-      ImDrawData* draw_data = ImGui::GetDrawData();
-
-      {
-        auto cmdBuf = m_ImGuiCmdBuffers[imageIndex].get();
+      m_telemetry->RenderGUI();
 
-        cmdBuf.begin(vk::CommandBufferBeginInfo{ {}, nullptr });
+      m_gpuProfiler->RenderGUI();
 
-        vk::ClearValue clearValue{};
-
-        vk::RenderPassBeginInfo info = {};
-        info.renderPass = m_ImGuiRenderPass.get();
-        info.framebuffer = m_ImGuiFramebuffer[imageIndex].get();
-        info.renderArea.extent.width = m_width;
-        info.renderArea.extent.height = m_height;
-        info.clearValueCount = 1;
-        info.pClearValues = &clearValue;
-
-        cmdBuf.beginRenderPass(info, vk::SubpassContents::eInline);
-
-        ImGui_ImplVulkan_RenderDrawData(draw_data, cmdBuf);
+      ImGui::Render();
 
-        cmdBuf.endRenderPass();
-        cmdBuf.end();
-      }
+      guiFrames.GetBack().CopyFrom(ImGui::GetDrawData());
+      guiFrames.Publish();
 
-      // GUI finished processing
-      processed = true;
-      lk.unlock();
-      cv.notify_one();
+      guiRequested.store(false, std::memory_order_release);
     }
     });
 
@@ -782,89 +1064,161 @@ void BG::Renderer::Run(std::function<void()> init, std::function<void(Context&)>
   auto startTime = std::chrono::high_resolution_clock::now();
 
   auto startTimeSteady = std::chrono::steady_clock::now();
+  auto lastFrameStart = startTimeSteady;
 
-  while (!glfwWindowShouldClose(m_window))
+  auto elapsedMs = [](std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+  };
+
+  while (m_headless ? frameCount < m_headlessFrameCount : !glfwWindowShouldClose(m_window))
   {
-    auto acquireNextImageResult = m_device->acquireNextImageKHR(m_swapchain.get(), UINT64_MAX, m_imageAvailableSemaphores[currentFrame].get(), nullptr);
+    FrameTelemetry::Sample sample{};
+    sample.frame = frameCount;
 
-    if (acquireNextImageResult.result != vk::Result::eSuccess)
-    {
-      spdlog::warn("Acquire next image failed!");
-    }
+    auto frameStart = std::chrono::steady_clock::now();
+    sample.frameMs = elapsedMs(lastFrameStart, frameStart);
+    lastFrameStart = frameStart;
 
-    imageIndex = acquireNextImageResult.value;
+    // The frame slot's semaphores are free again once its last submit is done.
+    // With a single frame in flight (low latency) this waits for the whole previous frame, so input below is as fresh as possible
+    m_graphicsTimeline->Wait(m_frameTimelineValues[currentFrame]);
 
-    if (m_imagesInFlight[imageIndex] != nullptr)
+    auto slotWaitEnd = std::chrono::steady_clock::now();
+
+    if (m_headless)
     {
-      if (m_device->waitForFences(1, &m_imagesInFlight[imageIndex]->get(), true, UINT64_MAX) != vk::Result::eSuccess) throw std::runtime_error("Wait for fence failed");
+      // No swapchain to acquire from, rotate through the offscreen targets
+      imageIndex = int(frameCount % m_swapchainImages.size());
     }
-    else if (std::find(m_imagesInFlight.begin(), m_imagesInFlight.end(), &m_inFlightFences[currentFrame]) != m_imagesInFlight.end())
+    else
     {
-      // This happens when there are more images than the in-flight limit
-      if (m_device->waitForFences(1, &m_inFlightFences[currentFrame].get(), true, UINT64_MAX) != vk::Result::eSuccess) throw std::runtime_error("Wait for fence failed");
+      auto acquireNextImageResult = m_device->acquireNextImageKHR(m_swapchain.get(), UINT64_MAX, m_imageAvailableSemaphores[currentFrame].get(), nullptr);
+
+      if (acquireNextImageResult.result != vk::Result::eSuccess)
+      {
+        spdlog::warn("Acquire next image failed!");
+      }
+
+      imageIndex = acquireNextImageResult.value;
     }
 
-    m_imagesInFlight[imageIndex] = &m_inFlightFences[currentFrame];
+    auto acquireEnd = std::chrono::steady_clock::now();
+    sample.acquireMs = elapsedMs(slotWaitEnd, acquireEnd);
 
-    // Check for window messages to process.
-    glfwPollEvents();
+    // Per-image resources (command buffers, descriptor pools) may still be used by an older frame slot
+    m_graphicsTimeline->Wait(m_imageTimelineValues[imageIndex]);
 
-    // Trigger GUI thread (GLFW is single threaded, therefore glfw related setup must be on main thread)
-    ImGui_ImplGlfw_NewFrame();
+    sample.fenceWaitMs = elapsedMs(frameStart, slotWaitEnd) + elapsedMs(acquireEnd, std::chrono::steady_clock::now());
+
+    if (!m_headless)
     {
-      std::lock_guard<std::mutex> lk(m);
-      ready = true;
+      // Only touch input while the GUI thread is idle, ImGui IO is not thread safe
+      if (!guiRequested.load(std::memory_order_acquire))
+      {
+        // Check for window messages to process.
+        glfwPollEvents();
+
+        // Trigger GUI thread (GLFW is single threaded, therefore glfw related setup must be on main thread)
+        ImGui_ImplGlfw_NewFrame();
+
+        {
+          std::lock_guard<std::mutex> lk(guiMutex);
+          guiRequested.store(true, std::memory_order_release);
+        }
+        guiCv.notify_one();
+      }
     }
-    cv.notify_one();
 
     // Begin new frame on main thread
-    m_device->resetDescriptorPool(m_descPools[imageIndex].get());
-    m_memoryAllocator->NewFrame();
-    m_tracker->NewFrame();
+    m_descAllocator->NewFrame(imageIndex);
+    uint64_t completedValue = m_graphicsTimeline->GetCompleted();
+    m_memoryAllocator->NewFrame(completedValue);
+    m_tracker->NewFrame(completedValue);
+    m_gpuProfiler->NewFrame(uint32_t(currentFrame));
+    m_uniformRing->NewFrame(uint32_t(currentFrame), completedValue);
+    m_framebufferCache->NewFrame();
+    m_parallelRecorder->NewFrame(imageIndex);
 
     float time = float((std::chrono::steady_clock::now() - startTimeSteady).count() * 1e-9);
-    CommandBuffer bgCmdBuf(m_device.get(), m_cmdBuffers[imageIndex].get(), *m_tracker);
+    CommandBuffer bgCmdBuf(m_device.get(), m_cmdBuffers[imageIndex].get(), *m_tracker, m_gpuProfiler.get(), m_framebufferCache.get(), &m_dispatcher);
     Context ctx{
       bgCmdBuf,
-      m_descPools[imageIndex].get(),
+      *m_descAllocator,
       m_swapchainImageViews[imageIndex].get(), m_depthImageViews[imageIndex].get(),
       m_swapchainImages[imageIndex],
-      imageIndex, int(currentFrame), time };
+      imageIndex, int(currentFrame), time,
+      *m_parallelRecorder };
+
+    auto renderStart = std::chrono::steady_clock::now();
 
     render(ctx);
 
-    vk::SubmitInfo submitInfo;
+    sample.renderCpuMs = elapsedMs(renderStart, std::chrono::steady_clock::now());
+
+    std::vector<Timeline::Wait> waits;
+    std::vector<vk::Semaphore> signals;
+
+    std::vector<vk::CommandBuffer> submitBuffers = { m_cmdBuffers[imageIndex].get() };
+
+    if (!m_headless)
+    {
+      waits.push_back({ m_imageAvailableSemaphores[ctx.currentFrame].get(), 0, vk::PipelineStageFlagBits::eColorAttachmentOutput });
+      signals.push_back(m_renderFinishedSemaphores[ctx.currentFrame].get());
+    }
+
+    if (m_asyncComputeSubmitted)
+    {
+      if (m_computeTimeline != m_graphicsTimeline)
+      {
+        waits.push_back({ m_computeTimeline->GetSemaphore(), m_asyncComputeValue, m_asyncComputeWaitStage });
+      }
+      m_asyncComputeSubmitted = false;
+    }
 
-    std::vector<vk::PipelineStageFlags> waitStages = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
+    // Uploads queued so far are acquired on the graphics queue ahead of this frame
+    m_uploadEngine->Flush();
 
-    std::vector<vk::CommandBuffer> submitBuffers = { m_cmdBuffers[imageIndex].get(), m_ImGuiCmdBuffers[imageIndex].get() };
+    auto guiWaitStart = std::chrono::steady_clock::now();
 
-    submitInfo.setWaitSemaphores(m_imageAvailableSemaphores[ctx.currentFrame].get());
-    submitInfo.setWaitDstStageMask(waitStages);
-    submitInfo.setCommandBuffers(submitBuffers);
-    submitInfo.setSignalSemaphores(m_renderFinishedSemaphores[ctx.currentFrame].get());
+    // Use the latest finished GUI frame, or keep drawing the previous one if the GUI thread is behind
+    guiFrames.Acquire();
 
-    auto result = m_device->resetFences(1, &m_imagesInFlight[imageIndex]->get());
+    sample.guiWaitMs = elapsedMs(guiWaitStart, std::chrono::steady_clock::now());
 
-    // wait for the GUI thread
+    if (!m_headless && guiFrames.HasFront())
     {
-      std::unique_lock<std::mutex> lk(m);
-      cv.wait(lk, [&] { return processed; });
+      RecordGUI(guiFrames.GetFront().drawData, imageIndex);
+      submitBuffers.push_back(m_ImGuiCmdBuffers[imageIndex].get());
     }
-    processed = false;
 
-    result = m_graphcisQueue.submit(1, &submitInfo, m_inFlightFences[ctx.currentFrame].get());
+    auto presentStart = std::chrono::steady_clock::now();
+
+    m_uniformRing->Flush();
+    uint64_t submitValue = m_graphicsTimeline->Submit(submitBuffers, waits, signals);
+
+    m_frameTimelineValues[currentFrame] = submitValue;
+    m_imageTimelineValues[imageIndex] = submitValue;
+    m_memoryAllocator->EndFrame(submitValue);
+    m_tracker->EndFrame(submitValue);
+    m_textureSystem->EndFrame(submitValue);
+    m_uniformRing->EndFrame(submitValue);
 
-    uint32_t imageIndexU32 = imageIndex;
+    if (!m_headless)
+    {
+      uint32_t imageIndexU32 = imageIndex;
+
+      vk::PresentInfoKHR presentInfo;
+      presentInfo.setWaitSemaphores(m_renderFinishedSemaphores[ctx.currentFrame].get());
+      presentInfo.setSwapchains(m_swapchain.get());
+      presentInfo.pImageIndices = &imageIndexU32;
 
-    vk::PresentInfoKHR presentInfo;
-    presentInfo.setWaitSemaphores(m_renderFinishedSemaphores[ctx.currentFrame].get());
-    presentInfo.setSwapchains(m_swapchain.get());
-    presentInfo.pImageIndices = &imageIndexU32;
+      auto result = m_graphicsTimeline->Present(presentInfo);
+    }
 
-    result = m_graphcisQueue.presentKHR(presentInfo);
+    sample.presentMs = elapsedMs(presentStart, std::chrono::steady_clock::now());
+    m_telemetry->Record(sample);
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    currentFrame = (currentFrame + 1) % m_maxFramesInFlight;
 
     frameCount++;
     if (frameCount % 100 == 99)
@@ -875,18 +1229,27 @@ void BG::Renderer::Run(std::function<void()> init, std::function<void(Context&)>
     }
   }
 
-  m_isRunning = false;
-
   {
-    std::lock_guard<std::mutex> lk(m);
-    ready = true;
+    std::lock_guard<std::mutex> lk(guiMutex);
+    m_isRunning = false;
   }
-  cv.notify_one();
+  guiCv.notify_one();
 
-  guiThread.join();
+  if (guiThread.joinable()) guiThread.join();
 
   m_device->waitIdle();
 
+  if (m_headless && frameCount > 0)
+  {
+    double seconds = (std::chrono::steady_clock::now() - startTimeSteady).count() * 1e-9;
+    spdlog::info("Headless run: {} frames in {:.3f}s, {:.3f}ms/frame, {:.1f} FPS", frameCount, seconds, seconds * 1000.0 / double(frameCount), double(frameCount) / seconds);
+  }
+
+  auto frameStats = m_telemetry->GetStats(FrameTelemetry::Metric::Frame);
+  spdlog::info("Frame time: p50={:.3f}ms p95={:.3f}ms p99={:.3f}ms max={:.3f}ms", frameStats.p50, frameStats.p95, frameStats.p99, frameStats.max);
+
+  m_telemetry->DumpOnExit();
+
   cleanup();
 }
 
@@ -907,6 +1270,8 @@ int Renderer::getHeight()
 
 glm::vec2 BG::Renderer::getCursorPos()
 {
+  if (m_headless) return glm::vec2(0.0f);
+
   double x, y;
   glfwGetCursorPos(m_window, &x, &y);
   return glm::vec2(x, y);
@@ -941,6 +1306,31 @@ vk::UniqueFramebuffer BG::Renderer::CreateFramebuffer(vk::RenderPass renderpass,
   return m_device->createFramebufferUnique(framebufferInfo);
 }
 
+void BG::Renderer::SubmitAsyncCompute(Context& ctx, std::function<void(CommandBuffer&)> record, vk::PipelineStageFlags waitStage)
+{
+  if (m_asyncComputeSubmitted)
+  {
+    spdlog::error("Async compute was already submitted this frame");
+    throw std::runtime_error("Async compute was already submitted this frame");
+  }
+
+  // Reusing the per-image buffer is safe: the last graphics submit of this image waited on it
+  auto buf = m_computeCmdBuffers[ctx.imageIndex].get();
+
+  buf.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit, nullptr });
+
+  CommandBuffer bgCmdBuf(m_device.get(), buf, *m_tracker);
+  record(bgCmdBuf);
+
+  buf.end();
+
+  // Constants written so far may be read by the compute work
+  m_uniformRing->Flush();
+  m_asyncComputeValue = m_computeTimeline->Submit({ buf });
+  m_asyncComputeSubmitted = true;
+  m_asyncComputeWaitStage = waitStage;
+}
+
 vk::UniqueCommandBuffer BG::Renderer::AllocCmdBuffer()
 {
   return std::move(m_device->allocateCommandBuffersUnique({ m_graphicsCmdPool.get(), vk::CommandBufferLevel::ePrimary, 1 })[0]);
@@ -948,21 +1338,10 @@ vk::UniqueCommandBuffer BG::Renderer::AllocCmdBuffer()
 
 void BG::Renderer::SubmitCmdBufferNow(vk::CommandBuffer buf, bool wait)
 {
-  vk::Fence fence;
-  vk::SubmitInfo submitInfo;
-
-  if (wait)
-  {
-    fence = m_device->createFence({});
-  }
-
-  submitInfo.setCommandBuffers(buf);
-
-  auto result = m_graphcisQueue.submit(1, &submitInfo, fence);
+  uint64_t value = m_graphicsTimeline->Submit({ buf });
 
   if (wait)
   {
-    result = m_device->waitForFences(1, &fence, true, UINT64_MAX);
-    m_device->destroyFence(fence);
+    m_graphicsTimeline->Wait(value);
   }
 }
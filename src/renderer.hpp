@@ -5,8 +5,11 @@
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.hpp>
 
+#include <atomic>
 #include <functional>
 
+struct ImDrawData;
+
 namespace BG
 {
 
@@ -16,11 +19,25 @@ namespace BG
 
   class Renderer
   {
+  public:
+    // Trade-off between input latency and throughput, picked when the renderer is created
+    enum class FramePacing
+    {
+      LowLatency,        // 1 frame in flight, FIFO, the CPU waits for the last frame before polling input
+      Balanced,          // 2 frames in flight, mailbox if available
+      MaxThroughput,     // 3 frames in flight, immediate / mailbox
+      HeadlessBenchmark  // 3 frames in flight, no presentation, for headless runs
+    };
+
   private:
-    GLFWwindow* m_window;
+    GLFWwindow* m_window = nullptr;
 
-    bool m_isRunning = true;
-    const int MAX_FRAMES_IN_FLIGHT = 2;
+    std::atomic<bool> m_isRunning{ true };
+    bool m_headless = false;
+    uint32_t m_headlessFrameCount = 0;
+
+    FramePacing m_framePacing = FramePacing::Balanced;
+    int m_maxFramesInFlight = 2;
 
     int m_width = 1280, m_height = 720;
 
@@ -40,8 +57,15 @@ namespace BG
     vk::Queue                          m_computeQueue;
     vk::Queue                          m_transferQueue;
 
+    // One timeline per distinct queue, queues shared between roles share the timeline
+    std::vector<std::unique_ptr<Timeline>> m_timelines;
+    Timeline*                          m_graphicsTimeline = nullptr;
+    Timeline*                          m_computeTimeline = nullptr;
+    Timeline*                          m_transferTimeline = nullptr;
+
     vk::UniqueCommandPool              m_graphicsCmdPool;
     vk::UniqueCommandPool              m_guiCmdPool;
+    vk::UniqueCommandPool              m_computeCmdPool;
 
     VkDescriptorPool                   m_ImGuiDescPool;
     vk::UniqueRenderPass               m_ImGuiRenderPass;
@@ -49,23 +73,41 @@ namespace BG
     // Vulkan per-frame stuff
     std::vector<vk::UniqueSemaphore>      m_imageAvailableSemaphores;
     std::vector<vk::UniqueSemaphore>      m_renderFinishedSemaphores;
-    std::vector<vk::UniqueFence>          m_inFlightFences;
-    std::vector<vk::UniqueFence*>         m_imagesInFlight;
+    std::vector<uint64_t>                 m_frameTimelineValues; // graphics timeline value of the last submit per frame slot
+    std::vector<uint64_t>                 m_imageTimelineValues; // ... and per swapchain image
     std::vector<vk::UniqueCommandBuffer>  m_cmdBuffers;
     std::vector<vk::UniqueCommandBuffer>  m_ImGuiCmdBuffers;
     std::vector<vk::UniqueFramebuffer>    m_ImGuiFramebuffer;
-    std::vector<vk::UniqueDescriptorPool> m_descPools;
+    std::vector<vk::UniqueCommandBuffer>  m_computeCmdBuffers;
+
+    // Set by SubmitAsyncCompute, the next graphics submit waits on the compute timeline
+    bool                                  m_asyncComputeSubmitted = false;
+    uint64_t                              m_asyncComputeValue = 0;
+    vk::PipelineStageFlags                m_asyncComputeWaitStage;
 
     // Images & image views
     std::vector<vk::Image>                  m_swapchainImages;
     std::vector<vk::UniqueImageView>        m_swapchainImageViews;
     std::vector<std::unique_ptr<BG::Image>> m_depthImages;
     std::vector<vk::UniqueImageView>        m_depthImageViews;
+    std::vector<std::unique_ptr<BG::Image>> m_headlessImages;
 
     // Misc components from BG
     std::unique_ptr<MemoryAllocator> m_memoryAllocator;
+    std::unique_ptr<PipelineCache>   m_pipelineCache;
+    std::unique_ptr<PipelineStateCache> m_pipelineStateCache;
+    std::unique_ptr<ShaderCache>     m_shaderCache;
+    std::unique_ptr<DescriptorAllocator> m_descAllocator;
     std::unique_ptr<TextureSystem>   m_textureSystem;
+    std::unique_ptr<UniformRing>     m_uniformRing;
+    std::unique_ptr<FramebufferCache> m_framebufferCache;
     std::unique_ptr<Tracker>         m_tracker;
+    std::unique_ptr<GpuProfiler>     m_gpuProfiler;
+    std::unique_ptr<FrameTelemetry>  m_telemetry;
+    std::unique_ptr<UploadEngine>     m_uploadEngine;
+    std::unique_ptr<JobSystem>        m_jobSystem;
+    std::unique_ptr<JobSystem>        m_compileJobSystem;
+    std::unique_ptr<ParallelRecorder> m_parallelRecorder;
 
     struct {
       int graphics = -1, compute = -1, transfer = -1;
@@ -74,6 +116,8 @@ namespace BG
     std::string m_name;
     bool m_enableValidationLayers = false;
 
+    void SetFramePacing(FramePacing framePacing);
+
     void InitWindow();
     void InitVulkan();
     void InitImGui();
@@ -84,11 +128,15 @@ namespace BG
     void CreateDevice();
     void CreateSurface();
     void CreateSwapChain();
+    void CreateHeadlessImages();
+    void CreateDepthImages();
     void CreateCmdPools();
     void CreateCmdBuffers();
     void CreateSemaphore();
     void CreateDescriptorPools();
 
+    void RecordGUI(ImDrawData& drawData, int imageIndex);
+
     void DestroySwapChain();
     void DestroyCmdPools();
     void DestroyCmdBuffers();
@@ -103,23 +151,49 @@ namespace BG
   public:
 
     bool m_hasDescriptorIndexing = false;
+    bool m_hasBindlessTextures = false;
+    bool m_hasPushDescriptor = false;
+    bool m_hasDynamicRendering = false;
 
     struct Context
     {
       CommandBuffer& cmdBuffer;
-      vk::DescriptorPool descPool;
+      DescriptorAllocator& descAllocator;
       vk::ImageView imageView;
       vk::ImageView depthImageView;
       vk::Image image;
       int imageIndex;
       int currentFrame;
       float time;
+      ParallelRecorder& parallelRecorder;
+
+      // Splits the draws of one render pass into numTasks chunks recorded on the job system workers,
+      // each into its own secondary command buffer. func gets the worker's command buffer (pipeline bound) and the task index.
+      void RecordParallel(
+        Pipeline& p,
+        std::vector<vk::ImageView> renderTargets,
+        glm::uvec2 extent,
+        int numTasks,
+        std::function<void(CommandBuffer&, int)> func);
+    };
+
+    // Offscreen rendering without a window / surface / swapchain.
+    // Run() renders frameCount frames into VMA allocated images and returns.
+    struct HeadlessConfig
+    {
+      int width = 1280, height = 720;
+      uint32_t frameCount = 1000;
+      FramePacing framePacing = FramePacing::HeadlessBenchmark;
     };
 
 #ifdef _DEBUG
     Renderer(std::string name, bool enableValidationLayers = true);
+    Renderer(std::string name, FramePacing framePacing, bool enableValidationLayers = true);
+    Renderer(std::string name, HeadlessConfig headless, bool enableValidationLayers = true);
 #else
     Renderer(std::string name, bool enableValidationLayers = false);
+    Renderer(std::string name, FramePacing framePacing, bool enableValidationLayers = false);
+    Renderer(std::string name, HeadlessConfig headless, bool enableValidationLayers = false);
 #endif
     ~Renderer();
 
@@ -128,17 +202,39 @@ namespace BG
     int getWidth();
     int getHeight();
 
+    inline bool isHeadless() { return m_headless; }
+
+    inline FramePacing getFramePacing() { return m_framePacing; }
+    inline int getMaxFramesInFlight() { return m_maxFramesInFlight; }
+
     glm::vec2 getCursorPos();
 
     inline BG::MemoryAllocator& getMemoryAllocator() { return *m_memoryAllocator; };
     inline BG::TextureSystem& getTextureSystem() { return *m_textureSystem; };
     inline BG::Tracker& getTracker() { return *m_tracker; }
+    inline BG::GpuProfiler& getGpuProfiler() { return *m_gpuProfiler; }
+    inline BG::FrameTelemetry& getTelemetry() { return *m_telemetry; }
+    inline BG::JobSystem& getJobSystem() { return *m_jobSystem; }
+    inline BG::JobSystem& getCompileJobSystem() { return *m_compileJobSystem; }
+    inline BG::UploadEngine& getUploadEngine() { return *m_uploadEngine; }
+    inline BG::PipelineCache& getPipelineCache() { return *m_pipelineCache; }
+    inline BG::PipelineStateCache& getPipelineStateCache() { return *m_pipelineStateCache; }
+    inline BG::ShaderCache& getShaderCache() { return *m_shaderCache; }
+    inline BG::UniformRing& getUniformRing() { return *m_uniformRing; }
+    inline BG::FramebufferCache& getFramebufferCache() { return *m_framebufferCache; }
+    inline BG::Timeline& getGraphicsTimeline() { return *m_graphicsTimeline; }
 
     inline std::vector<vk::Image>& getSwapchainImages() { return m_swapchainImages; };
     inline std::vector<vk::UniqueImageView>& getSwapchainImageViews() { return m_swapchainImageViews; };
     inline std::vector<vk::UniqueImageView>& getDepthImageViews() { return m_depthImageViews; };
 
     inline vk::Device getDevice() { return m_device.get(); }
+    inline const vk::DispatchLoaderDynamic& getDispatcher() { return m_dispatcher; }
+
+    inline uint32_t getGraphicsQueueFamily() { return uint32_t(m_selectedPhyDeviceQueueIndices.graphics); }
+    inline uint32_t getComputeQueueFamily() { return uint32_t(m_selectedPhyDeviceQueueIndices.compute); }
+    // True when compute runs on its own queue family and can overlap graphics work
+    inline bool hasAsyncCompute() { return m_selectedPhyDeviceQueueIndices.compute != m_selectedPhyDeviceQueueIndices.graphics; }
 
     vk::Format getSwapChainFormat();
 
@@ -149,6 +245,15 @@ namespace BG
 
     void SubmitCmdBufferNow(vk::CommandBuffer buf, bool wait = true);
 
+    // Records and submits compute work on the compute queue right away, call from the render callback.
+    // This frame's graphics submit waits on it at waitStage, so graphics work before that stage overlaps the compute.
+    // Resources written here and read by graphics need a queue family ownership transfer when hasAsyncCompute()
+    // (see CommandBuffer::BufferBarrier), or have to be created with concurrent sharing.
+    void SubmitAsyncCompute(
+      Context& ctx,
+      std::function<void(CommandBuffer&)> record,
+      vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader);
+
     void Run(std::function<void()> init, std::function<void(Context&)> render, std::function<void()> renderGUI, std::function<void()> cleanup);
   };
 }
\ No newline at end of file